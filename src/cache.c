@@ -0,0 +1,264 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void entry_path(char *path, size_t size, const char *dir, uint64_t hash) {
+    snprintf(path, size, "%s/%016llx.ast", dir, (unsigned long long) hash);
+}
+
+static bool section_fits(const pyc_cache_section *s, size_t item, size_t len) {
+    return s->offset % 8 == 0 && s->offset <= len && s->count <= (len - s->offset) / item;
+}
+
+// The strings of a pool section have to be inside the bytes section.
+static bool strings_fit(const char *map, const pyc_cache_section *s, const pyc_cache_section *bytes) {
+    const pyc_cache_str *strs = (const pyc_cache_str *) (map + s->offset);
+    for (size_t i = 0; i < s->count; i++) {
+        if (strs[i].offset > bytes->count || strs[i].len > bytes->count - strs[i].offset) return false;
+    }
+    return true;
+}
+
+// The tokens have to be inside the source and their payloads inside the pools.
+static bool tokens_fit(const char *map, const pyc_cache_header *h) {
+    const token *tokens = (const token *) (map + h->tokens.offset);
+    for (size_t i = 0; i < h->tokens.count; i++) {
+        token t = tokens[i];
+        if (t.start > t.end || t.end > h->source_len) return false;
+        unsigned shift = 4;
+        uint64_t count;
+        switch (t.type & 0xf) {
+            case TOKEN_STRING:
+                shift = 7;
+                count = h->strings.count;
+                break;
+            case TOKEN_FSTRING_START:
+                shift = 5;
+                count = h->strings.count;
+                break;
+            case TOKEN_FSTRING_MIDDLE:
+            case TOKEN_FSTRING_END:
+                count = h->strings.count;
+                break;
+            case TOKEN_IDENTIFIER:
+                count = h->identifiers.count;
+                break;
+            case TOKEN_INTEGER:
+                count = h->ints.count;
+                break;
+            case TOKEN_FLOAT:
+                count = h->floats.count;
+                break;
+            case TOKEN_BIG_INTEGER:
+                count = h->big_ints.count;
+                break;
+            default:
+                continue;
+        }
+        if (t.type >> shift >= count) return false;
+    }
+    return true;
+}
+
+bool pyc_cache_open(pyc_cache_entry *e, const char *dir, const char *code, size_t len) {
+    uint64_t hash = pyc_hash_bytes(code, len);
+    char path[4096];
+    entry_path(path, sizeof(path), dir, hash);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(pyc_cache_header)) {
+        close(fd);
+        return false;
+    }
+    size_t map_len = (size_t) st.st_size;
+    char *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const pyc_cache_header *h = (const pyc_cache_header *) map;
+    bool valid = h->magic == PYC_CACHE_MAGIC && h->version == PYC_CACHE_VERSION &&
+                 h->header_size == sizeof(pyc_cache_header) && h->token_size == sizeof(token) &&
+                 h->source_hash == hash && h->source_len == len &&
+                 section_fits(&h->tokens, sizeof(token), map_len) &&
+                 section_fits(&h->words, sizeof(uint32_t), map_len) && h->words.count > 0 && h->root < h->words.count &&
+                 section_fits(&h->ints, sizeof(uint64_t), map_len) &&
+                 section_fits(&h->floats, sizeof(double), map_len) &&
+                 section_fits(&h->big_ints, sizeof(pyc_cache_str), map_len) &&
+                 section_fits(&h->identifiers, sizeof(pyc_cache_str), map_len) &&
+                 section_fits(&h->strings, sizeof(pyc_cache_str), map_len) &&
+                 section_fits(&h->string_hashes, sizeof(uint64_t), map_len) &&
+                 h->string_hashes.count == h->strings.count && section_fits(&h->bytes, 1, map_len);
+    // a bad entry is a miss like any other, nothing in it is used before it is checked
+    valid = valid && strings_fit(map, &h->big_ints, &h->bytes) && strings_fit(map, &h->identifiers, &h->bytes) &&
+            strings_fit(map, &h->strings, &h->bytes) && tokens_fit(map, h);
+    pyc_flat_ast ast = {
+        .words = {.data = (uint32_t *) (map + h->words.offset), .size = h->words.count, .capacity = 0},
+        .tokens = (token *) (map + h->tokens.offset),
+        .token_count = h->tokens.count,
+    };
+    if (!valid || !pyc_flat_check(&ast, h->root)) {
+        munmap(map, map_len);
+        return false;
+    }
+
+    *e = (pyc_cache_entry){.map = map, .map_len = map_len, .header = h, .ast = ast, .root = h->root};
+    return true;
+}
+
+void pyc_cache_close(pyc_cache_entry *e) {
+    if (e->map != NULL) munmap(e->map, e->map_len);
+    *e = (pyc_cache_entry){0};
+}
+
+static code_substr *entry_substrs(pyc_cache_entry *e, const pyc_cache_section *s) {
+    const pyc_cache_str *strs = (const pyc_cache_str *) (e->map + s->offset);
+    char *bytes = e->map + e->header->bytes.offset;
+    code_substr *subs = malloc(s->count * sizeof(code_substr) + 1);
+    for (size_t i = 0; i < s->count; i++) {
+        subs[i] = (code_substr){.code = bytes, .start = strs[i].offset, .end = strs[i].offset + strs[i].len};
+    }
+    return subs;
+}
+
+pyc_constants pyc_cache_constants(pyc_cache_entry *e) {
+    const pyc_cache_header *h = e->header;
+    return (pyc_constants){
+        .ints = (const uint64_t *) (e->map + h->ints.offset),
+        .int_count = h->ints.count,
+        .floats = (const double *) (e->map + h->floats.offset),
+        .float_count = h->floats.count,
+        .big_ints = entry_substrs(e, &h->big_ints),
+        .big_int_count = h->big_ints.count,
+        .identifiers = entry_substrs(e, &h->identifiers),
+        .identifier_count = h->identifiers.count,
+        .strings = entry_substrs(e, &h->strings),
+        .string_hashes = (const uint64_t *) (e->map + h->string_hashes.offset),
+        .string_count = h->strings.count,
+    };
+}
+
+void pyc_cache_constants_free(pyc_constants *c) {
+    free((void *) c->big_ints);
+    free((void *) c->identifiers);
+    free((void *) c->strings);
+    *c = (pyc_constants){0};
+}
+
+// Appends a section to the entry, 8-byte aligned so every section can be read in place.
+static void put_section(char_list *out, pyc_cache_section *s, const void *data, size_t item, size_t count) {
+    size_t at = (out->size + 7) & ~(size_t) 7;
+    char_list_reserve(out, at + item * count);
+    memset(out->data + out->size, 0, at - out->size);
+    if (count > 0) memcpy(out->data + at, data, item * count);
+    out->size = at + item * count;
+    *s = (pyc_cache_section){.offset = at, .count = count};
+}
+
+static pyc_cache_str *put_strings(char_list *bytes, const code_substr *subs, size_t count) {
+    pyc_cache_str *strs = malloc(count * sizeof(pyc_cache_str) + 1);
+    for (size_t i = 0; i < count; i++) {
+        size_t len = subs[i].end - subs[i].start;
+        char_list_reserve(bytes, bytes->size + len);
+        memcpy(bytes->data + bytes->size, subs[i].code + subs[i].start, len);
+        strs[i] = (pyc_cache_str){.offset = bytes->size, .len = len};
+        bytes->size += len;
+    }
+    return strs;
+}
+
+bool pyc_cache_build(pyc_lexer *lx, node *tree, char_list *out) {
+    // symbol ids only mean something to the interner that handed them out
+    if (lx->interner != NULL || lx->streaming) return false;
+
+    pyc_flat_ast ast;
+    pyc_flat_init(&ast, lx->tokens.data, lx->tokens.size);
+    flat_ref root = pyc_flat_encode(&ast, tree);
+
+    pyc_constants c = pyc_lex_constants(lx);
+    char_list bytes = vec();
+    pyc_cache_str *big_ints = put_strings(&bytes, c.big_ints, c.big_int_count);
+    pyc_cache_str *identifiers = put_strings(&bytes, c.identifiers, c.identifier_count);
+    pyc_cache_str *strings = put_strings(&bytes, c.strings, c.string_count);
+
+    pyc_cache_header h = {
+        .magic = PYC_CACHE_MAGIC,
+        .version = PYC_CACHE_VERSION,
+        .header_size = sizeof(pyc_cache_header),
+        .token_size = sizeof(token),
+        .source_hash = pyc_hash_bytes(lx->code, lx->code_len),
+        .source_len = lx->code_len,
+        .root = root,
+    };
+    out->size = 0;
+    char_list_reserve(out, sizeof(h) + lx->tokens.size * sizeof(token) + ast.words.size * 4 + bytes.size + 4096);
+    out->size = sizeof(h);
+    put_section(out, &h.tokens, lx->tokens.data, sizeof(token), lx->tokens.size);
+    put_section(out, &h.words, ast.words.data, sizeof(uint32_t), ast.words.size);
+    put_section(out, &h.ints, c.ints, sizeof(uint64_t), c.int_count);
+    put_section(out, &h.floats, c.floats, sizeof(double), c.float_count);
+    put_section(out, &h.big_ints, big_ints, sizeof(pyc_cache_str), c.big_int_count);
+    put_section(out, &h.identifiers, identifiers, sizeof(pyc_cache_str), c.identifier_count);
+    put_section(out, &h.strings, strings, sizeof(pyc_cache_str), c.string_count);
+    put_section(out, &h.string_hashes, c.string_hashes, sizeof(uint64_t), c.string_count);
+    put_section(out, &h.bytes, bytes.data, 1, bytes.size);
+    memcpy(out->data, &h, sizeof(h));
+
+    free(big_ints);
+    free(identifiers);
+    free(strings);
+    char_list_clear(&bytes);
+    pyc_flat_free(&ast);
+    return true;
+}
+
+bool pyc_cache_store(const char *dir, pyc_lexer *lx, node *tree) {
+    char_list out = vec();
+    if (!pyc_cache_build(lx, tree, &out)) return false;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        char_list_clear(&out);
+        return false;
+    }
+
+    const pyc_cache_header *h = (const pyc_cache_header *) out.data;
+    char path[4096], temp[4096 + 32];
+    entry_path(path, sizeof(path), dir, h->source_hash);
+    snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long) getpid());
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && pyc_write_all(fd, out.data, out.size);
+    if (fd >= 0) ok = close(fd) == 0 && ok;
+    ok = ok && rename(temp, path) == 0;
+    if (!ok && fd >= 0) unlink(temp);
+
+    char_list_clear(&out);
+    return ok;
+}
+
+node *pyc_cache_load(const char *dir, pyc_lexer *lx, node *parent) {
+    pyc_constants own = pyc_lex_constants(lx);
+    if (lx->interner != NULL || lx->tokens.size != 0 || own.int_count != 0 || own.float_count != 0 ||
+        own.big_int_count != 0 || own.identifier_count != 0 || own.string_count != 0)
+        return NULL;
+
+    pyc_cache_entry e;
+    if (!pyc_cache_open(&e, dir, lx->code, lx->code_len)) return NULL;
+
+    tokens_reserve(&lx->tokens, e.ast.token_count);
+    memcpy(lx->tokens.data, e.ast.tokens, e.ast.token_count * sizeof(token));
+    lx->tokens.size = e.ast.token_count;
+    pyc_constants c = pyc_cache_constants(&e);
+    pyc_lex_load_constants(lx, c);
+    pyc_cache_constants_free(&c);
+
+    // the tree is built over the lexer's copy of the tokens, so it outlives the mapping
+    e.ast.tokens = lx->tokens.data;
+    node *tree = pyc_flat_expand(&e.ast, e.root, parent);
+    pyc_cache_close(&e);
+    return tree;
+}
@@ -0,0 +1,85 @@
+#ifndef PYC_CACHE_H
+#define PYC_CACHE_H
+
+#include "flat_ast.h"
+
+// On-disk cache of lexed and parsed files, one file per source in a cache directory, named after the hash of the
+// source. An entry is the header below followed by its sections, every offset is from the start of the entry, so it
+// can be used right where it is mapped. pyc_cache_open gives that zero-copy view, pyc_cache_load builds a lexer and a
+// node tree from it, which copies.
+// Only the byte order and the layout of the machine that wrote an entry can read it, any other entry is a miss.
+
+#define PYC_CACHE_MAGIC 0x3148434143435950ull // "PYCCACH1"
+#define PYC_CACHE_VERSION 1
+
+// A string of a pool, offset into the bytes section.
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} pyc_cache_str;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t count;
+} pyc_cache_section;
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    // sizeof(pyc_cache_header) and sizeof(token), a layout check
+    uint16_t header_size;
+    uint16_t token_size;
+    // pyc_hash_bytes of the source, and its length
+    uint64_t source_hash;
+    uint64_t source_len;
+    flat_ref root;
+    uint32_t reserved;
+    pyc_cache_section tokens;
+    pyc_cache_section words;
+    pyc_cache_section ints;
+    pyc_cache_section floats;
+    pyc_cache_section big_ints;    // pyc_cache_str
+    pyc_cache_section identifiers; // pyc_cache_str
+    pyc_cache_section strings;     // pyc_cache_str
+    pyc_cache_section string_hashes;
+    pyc_cache_section bytes;
+} pyc_cache_header;
+
+// A mapped entry. ast is a view of the mapping that must not be changed or passed to pyc_flat_free, it is read with the
+// accessors of flat_ast.h without copying anything. A subtree can be expanded on demand with pyc_flat_expand, its
+// token pointers then point into the mapping and are only valid until the entry is closed.
+typedef struct {
+    char *map;
+    size_t map_len;
+    const pyc_cache_header *header;
+    pyc_flat_ast ast;
+    flat_ref root;
+} pyc_cache_entry;
+
+// Maps the entry of the source if there is a valid one, a missing or broken entry is not an error. The whole entry is
+// checked here (see pyc_flat_check), so nothing read from it later can go out of bounds.
+bool pyc_cache_open(pyc_cache_entry *e, const char *dir, const char *code, size_t len);
+
+void pyc_cache_close(pyc_cache_entry *e);
+
+// The pools of an entry. The substring arrays are allocated and point into the mapping, free them with
+// pyc_cache_constants_free before the entry is closed.
+pyc_constants pyc_cache_constants(pyc_cache_entry *e);
+
+void pyc_cache_constants_free(pyc_constants *c);
+
+// Builds the entry of the lexer's source and tree into out, which is emptied first. False if the lexer has an
+// interner or streams, nothing is built then.
+bool pyc_cache_build(pyc_lexer *lx, node *tree, char_list *out);
+
+// Writes the entry of the lexer's source and tree, creating dir if needed. Goes to a temporary file first, so
+// readers never see a partial entry. Returns false if it couldn't be written.
+bool pyc_cache_store(const char *dir, pyc_lexer *lx, node *tree);
+
+// Fills a lexer that hasn't tokenized yet from the entry of its source and returns the tree, with its tokens in
+// lx->tokens. NULL if there is no entry, or the lexer has an interner or already has tokens or constants.
+// This is not zero-copy: the tokens and pools are copied into the lexer and every node is expanded, so the result
+// outlives the mapping. It still skips lexing and parsing, use pyc_cache_open for a view of the entry instead.
+node *pyc_cache_load(const char *dir, pyc_lexer *lx, node *parent);
+
+#endif // PYC_CACHE_H
@@ -0,0 +1,274 @@
+#include "document.h"
+
+#include <string.h>
+
+// Lines starting with these belong to the statement before them.
+static inline bool continues_statement(uint16_t kind) {
+    return kind == TOKEN_LINE_BREAK_INDENT || kind == TOKEN_KEYWORD_ELSE || kind == TOKEN_KEYWORD_ELIF ||
+           kind == TOKEN_KEYWORD_EXCEPT || kind == TOKEN_KEYWORD_FINALLY;
+}
+
+static void region_free(pyc_doc_region *region) {
+    pyc_lex_free(&region->lx);
+    pyc_arena_free(&region->ast);
+    free(region);
+}
+
+static void region_release(pyc_doc_region *region) {
+    if (--region->units > 0)
+        return;
+    region_free(region);
+}
+
+// Moves a unit and its tokens by delta bytes.
+static void shift_unit(pyc_doc_unit *unit, size_t delta) {
+    // offsets are 32-bit, so adding delta wraps around to the right place when the text got shorter
+    uint32_t shift = (uint32_t) delta;
+    unit->start += delta;
+    for (size_t t = 0; t < unit->token_count; t++) {
+        unit->tokens[t].start += shift;
+        unit->tokens[t].end += shift;
+    }
+}
+
+// What a reparse has made so far, kept outside of reparse_units so that it can be dropped when a syntax error jumps
+// out of it. pyc_doc_edit keeps it on the heap, locals of the frame that calls setjmp are indeterminate after the
+// jump if they changed.
+typedef struct {
+    pyc_lex_recovery recovery;
+    // the units being replaced
+    size_t i, k;
+    pyc_doc_region *region;
+    size_list bounds;
+    pyc_doc_units added;
+    nodes statements;
+} pyc_doc_reparse;
+
+static void reparse_free(pyc_doc_reparse *r) {
+    size_list_clear(&r->bounds);
+    free(r->added.data);
+    free(r->statements.data);
+}
+
+// Lexes and parses the units from r->i up to r->k again, their text is the one after the edit, which moved everything
+// after them by delta bytes. Lines the edit joined to the units around them take those units in too.
+static void reparse_units(pyc_document *doc, pyc_doc_reparse *r, size_t delta) {
+    pyc_doc_units *units = &doc->units;
+    pyc_parser ps;
+    // an unfinished string or bracket can run over many units, so each retry takes twice as many more
+    size_t more = 1;
+
+    for (;;) {
+        size_t start = r->i < units->size ? units->data[r->i].start : 0;
+        size_t end = r->k < units->size ? units->data[r->k].start + delta : doc->source.size;
+        r->region = malloc(sizeof(pyc_doc_region));
+        pyc_lex_init(&r->region->lx, doc->source.data, doc->source.size);
+        r->region->lx.interner = &doc->interner;
+        r->region->units = 0;
+        r->region->ast = (pyc_arena) pyc_arena(16 * 1024);
+        bool complete = pyc_lex_tokenize_range(&r->region->lx, start, end);
+        pyc_parser_init(&ps, &r->region->lx);
+
+        if (r->i > 0 && ps.tok_count > 0 && continues_statement(ps.kinds[0])) {
+            region_free(r->region);
+            r->i--;
+            continue;
+        }
+
+        bool decorated = false;
+        r->bounds.size = 0;
+        for (size_t t = 0; t < ps.tok_count; t = parse_top_level_end(&ps, t, &decorated))
+            size_list_push(&r->bounds, t);
+        if ((!complete || decorated) && r->k < units->size) {
+            region_free(r->region);
+            r->k = more < units->size - r->k ? r->k + more : units->size;
+            more *= 2;
+            continue;
+        }
+        break;
+    }
+
+    pyc_doc_region *region = r->region;
+    for (size_t b = 0; b < r->bounds.size; b++) {
+        size_t first = r->bounds.data[b];
+        ps.ti = first;
+        ps.tok_count = b + 1 < r->bounds.size ? r->bounds.data[b + 1] : region->lx.tokens.size;
+        // r->statements is an AST vector too, so the arena is only set while the group is parsed
+        pyc_ast_arena = &region->ast;
+        node *group = ast_node_create(doc->tree);
+        parse_statement_group(&ps, group, true);
+        pyc_ast_arena = NULL;
+
+        pyc_doc_unit unit = {
+            .start = r->i == 0 && b == 0 ? 0 : ps.tokens[first].start,
+            .region = region,
+            .tokens = ps.tokens + first,
+            .token_count = ps.tok_count - first,
+            .statements = group->group.v.size,
+        };
+        pyc_doc_units_push(&r->added, unit);
+        for (size_t s = 0; s < group->group.v.size; s++) {
+            group->group.v.data[s]->parent = doc->tree;
+            nodes_push(&r->statements, group->group.v.data[s]);
+        }
+    }
+
+    // nothing can fail from here on
+    size_t i = r->i, k = r->k;
+    pyc_doc_units *added = &r->added;
+    nodes *statements = &r->statements;
+    region->units = added->size;
+    if (added->size == 0)
+        region_free(region);
+    r->region = NULL;
+
+    // the statements of the old units go with their regions, the new ones take their place in the tree
+    nodes *tree = &doc->tree->group.v;
+    size_t first = 0, removed = 0;
+    for (size_t u = 0; u < k; u++) {
+        if (u < i)
+            first += units->data[u].statements;
+        else
+            removed += units->data[u].statements;
+    }
+    nodes_reserve(tree, tree->size - removed + statements->size);
+    memmove(tree->data + first + statements->size, tree->data + first + removed,
+            (tree->size - first - removed) * sizeof(node *));
+    if (statements->size > 0)
+        memcpy(tree->data + first, statements->data, statements->size * sizeof(node *));
+    tree->size = tree->size - removed + statements->size;
+
+    for (size_t u = i; u < k; u++)
+        region_release(units->data[u].region);
+    size_t after = units->size - k;
+    pyc_doc_units_reserve(units, i + added->size + after);
+    memmove(units->data + i + added->size, units->data + k, after * sizeof(pyc_doc_unit));
+    if (added->size > 0)
+        memcpy(units->data + i, added->data, added->size * sizeof(pyc_doc_unit));
+    units->size = i + added->size + after;
+    if (units->size > 0)
+        units->data[0].start = 0;
+
+    for (size_t u = i + added->size; u < units->size; u++)
+        shift_unit(&units->data[u], delta);
+}
+
+void pyc_doc_open(pyc_document *doc, char *filename, const char *code, size_t len) {
+    *doc = (pyc_document){.source = vec()};
+    pyc_doc_units_init(&doc->units);
+    char_list_reserve(&doc->source, len + 1);
+    memcpy(doc->source.data, code, len);
+    doc->source.data[len] = '\0';
+    doc->source.size = len;
+    pyc_interner_init(&doc->interner);
+
+    doc->module = ast_node_create(NULL);
+    doc->module->type = NODE_MODULE;
+    doc->module->module.filename = strdup(filename);
+    doc->module->module.code = doc->source.data;
+    doc->module->module.tokens = (tokens) vec();
+    doc->module->module.code_len = len;
+    doc->tree = ast_node_create(doc->module);
+    doc->tree->type = NODE_GROUP;
+    doc->tree->group.tok = NULL;
+    nodes_init(&doc->tree->group.v);
+
+    pyc_doc_reparse r = {.bounds = vec(), .added = vec(), .statements = vec()};
+    reparse_units(doc, &r, 0);
+    reparse_free(&r);
+}
+
+bool pyc_doc_edit(pyc_document *doc, size_t start, size_t removed, const char *text, size_t len) {
+    char_list *source = &doc->source;
+    if (start > source->size || removed > source->size - start) {
+        printf("ValueError: edit out of the bounds of the document\n");
+        fail();
+    }
+
+    size_t tail = source->size - start - removed;
+    size_t size = start + len + tail;
+    if (size + 1 > source->capacity)
+        char_list_reserve(source, size + 1 + size / 2);
+    memmove(source->data + start + len, source->data + start + removed, tail);
+    memcpy(source->data + start, text, len);
+    source->size = size;
+    source->data[size] = '\0';
+    doc->module->module.code = source->data;
+    doc->module->module.code_len = size;
+
+    // the unit the edit starts in and the ones up to where it ends, a unit that ends right at the start is damaged too
+    pyc_doc_units *units = &doc->units;
+    size_t lo = 0, hi = units->size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (units->data[mid].start <= start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    size_t i = lo > 0 ? lo - 1 : 0;
+    if (i > 0 && units->data[i].start == start)
+        i--;
+    size_t k = lo;
+    while (k < units->size && units->data[k].start <= start + removed)
+        k++;
+
+    // the units a failed edit left behind are parsed again with this one
+    if (doc->damaged_start < doc->damaged_end) {
+        if (doc->damaged_start < i)
+            i = doc->damaged_start;
+        if (doc->damaged_end > k)
+            k = doc->damaged_end;
+    }
+
+    size_t delta = len - removed;
+    pyc_doc_reparse *r = malloc(sizeof(pyc_doc_reparse));
+    *r = (pyc_doc_reparse){.i = i, .k = k, .bounds = vec(), .added = vec(), .statements = vec()};
+    pyc_lex_recovery *outer = pyc_lex_recover;
+    if (setjmp(r->recovery.env) != 0) {
+        pyc_lex_recover = outer;
+        pyc_ast_arena = NULL;
+        // everything parsed before the error is in the arena of the new region
+        if (r->region != NULL)
+            region_free(r->region);
+
+        // the old units stay and move with the text, the ones that started in the replaced bytes start after the
+        // new ones
+        for (size_t u = r->i + 1; u < units->size; u++) {
+            pyc_doc_unit *unit = &units->data[u];
+            if (unit->start > start + removed)
+                shift_unit(unit, delta);
+            else if (unit->start > start + len)
+                unit->start = start + len;
+        }
+        doc->damaged_start = r->i;
+        doc->damaged_end = r->k;
+        doc->error_pos = r->recovery.pos;
+        memcpy(doc->error, r->recovery.message, sizeof(doc->error));
+        reparse_free(r);
+        free(r);
+        return false;
+    }
+    pyc_lex_recover = &r->recovery;
+    reparse_units(doc, r, delta);
+    pyc_lex_recover = outer;
+    reparse_free(r);
+    free(r);
+
+    doc->damaged_start = doc->damaged_end = 0;
+    doc->error[0] = '\0';
+    return true;
+}
+
+void pyc_doc_free(pyc_document *doc) {
+    // the statements are freed with the arenas of their regions
+    doc->tree->group.v.size = 0;
+    node_free(doc->tree);
+    doc->module->module.code = NULL;
+    node_free(doc->module);
+    for (size_t u = 0; u < doc->units.size; u++)
+        region_release(doc->units.data[u].region);
+    free(doc->units.data);
+    char_list_clear(&doc->source);
+    pyc_interner_free(&doc->interner);
+}
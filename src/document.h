@@ -0,0 +1,59 @@
+#ifndef PYC_DOCUMENT_H
+#define PYC_DOCUMENT_H
+
+#include "parser.h"
+
+// A file that stays parsed while it is edited, e.g. the one open in an editor.
+// The top level statements are kept as units, each with the tokens it was parsed from. An edit re-lexes and reparses
+// only the units it touches and splices their new statements into the tree, every other statement keeps its nodes
+// and its tokens just move by the size difference of the edit.
+// The nodes of a region are bumped from an arena of its own and freed with it. pyc_ast_arena has to be unset while a
+// document is used, the tree itself is allocated outside of the arenas.
+
+// A lexer over a run of units and the nodes parsed from its tokens, it is freed with the last of them. lx.code is
+// the source at the time it tokenized, so it may be gone, the pools have their own copies.
+typedef struct {
+    pyc_lexer lx;
+    size_t units;
+    pyc_arena ast;
+} pyc_doc_region;
+
+typedef struct {
+    // offset of the first byte in the source, the first unit starts at 0 and each one ends where the next one starts
+    size_t start;
+    pyc_doc_region *region;
+    token *tokens;
+    size_t token_count;
+    // how many of the statements in the tree are from this unit
+    size_t statements;
+} pyc_doc_unit;
+
+vec_define(pyc_doc_unit, pyc_doc_units);
+
+typedef struct {
+    char_list source;
+    // shared by the lexers of all regions, so identifier tokens carry the same symbol ids across them
+    pyc_interner interner;
+    pyc_doc_units units;
+    node *module;
+    // the NODE_GROUP of all statements, like parse_file returns it
+    node *tree;
+    // Left by an edit that failed, the units from damaged_start up to damaged_end still have the statements from
+    // before it and are parsed again with the next edit. error_pos is the offset the error was found at and error
+    // its message, empty after an edit that worked.
+    size_t damaged_start, damaged_end;
+    size_t error_pos;
+    char error[128];
+} pyc_document;
+
+// Copies code and parses it, a syntax error is reported like for parse_file.
+void pyc_doc_open(pyc_document *doc, char *filename, const char *code, size_t len);
+
+// Replaces the removed bytes at start with the len bytes of text and updates doc->tree. The text is always changed,
+// but if it has a syntax error where it was parsed again, the tree keeps the old statements of that part (their
+// tokens may not match the text anymore) and false is returned with the error in doc->error.
+bool pyc_doc_edit(pyc_document *doc, size_t start, size_t removed, const char *text, size_t len);
+
+void pyc_doc_free(pyc_document *doc);
+
+#endif // PYC_DOCUMENT_H
@@ -0,0 +1,680 @@
+#include "dump.h"
+#include "cache.h"
+#include "walk.h"
+
+typedef struct {
+    pyc_writer *w;
+    // the source the tokens point into
+    const char *code;
+} dumper;
+
+bool pyc_dump_format_parse(const char *name, pyc_dump_format *format) {
+    if (strcmp(name, "text") == 0)
+        *format = PYC_DUMP_TEXT;
+    else if (strcmp(name, "json") == 0)
+        *format = PYC_DUMP_JSON;
+    else if (strcmp(name, "bin") == 0)
+        *format = PYC_DUMP_BIN;
+    else
+        return false;
+    return true;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static void text_indent(dumper *d, size_t indent) {
+    static const char spaces[] = "                                                                ";
+    size_t n = indent * _VCINDENT_MULT;
+    for (; n > sizeof(spaces) - 1; n -= sizeof(spaces) - 1)
+        pyc_write(d->w, spaces, sizeof(spaces) - 1);
+    pyc_write(d->w, spaces, n);
+}
+
+// The text between quotes like token_print prints it, runs of printable characters are copied as they are.
+static void text_token(dumper *d, token *tok) {
+    if (tok == NULL) {
+        pyc_write_str(d->w, "NULL");
+        return;
+    }
+
+    pyc_write_char(d->w, '"');
+    const char *code = d->code;
+    size_t run = tok->start;
+    for (size_t i = tok->start; i < tok->end; i++) {
+        char c = code[i];
+        if (c >= ' ' && c < 0x7F)
+            continue;
+        pyc_write(d->w, code + run, i - run);
+        run = i + 1;
+        if (c == '\n') {
+            pyc_write_str(d->w, "\\n");
+            continue;
+        }
+        // print_readable passes the char to %02x, so bytes from 0x80 on come out sign extended
+        char hex[10] = {'\\', 'x'};
+        unsigned v = (unsigned) (int) c;
+        size_t len = 2;
+        for (int shift = v > 0xFF ? 28 : 4; shift >= 0; shift -= 4)
+            hex[len++] = hex_digits[(v >> shift) & 0xF];
+        pyc_write(d->w, hex, len);
+    }
+    pyc_write(d->w, code + run, tok->end - run);
+    pyc_write_char(d->w, '"');
+}
+
+typedef void (*text_item_fn)(dumper *d, const void *item, int indent);
+
+// Like the print_indent functions of vec_define_print, type is the element type the way they spell it.
+static void text_list(dumper *d, const char *type, const void *data, size_t size, size_t elem, text_item_fn item,
+                      size_t indent) {
+    pyc_write_str(d->w, type);
+    if (data == NULL) {
+        pyc_write_str(d->w, "[]");
+        return;
+    }
+    pyc_write_char(d->w, '[');
+    if (size == 0) {
+        pyc_write_char(d->w, ']');
+        return;
+    }
+    pyc_write_char(d->w, '\n');
+    indent++;
+    for (size_t i = 0; i < size; i++) {
+        text_indent(d, indent);
+        item(d, (const char *) data + i * elem, (int) indent);
+        if (i < size - 1)
+            pyc_write_char(d->w, ',');
+        pyc_write_char(d->w, '\n');
+    }
+    text_indent(d, indent <= 1 ? 0 : indent - 2);
+    pyc_write_char(d->w, ']');
+}
+
+#define text_vec(d, type, v, item, indent) text_list(d, type, (v).data, (v).size, sizeof(*(v).data), item, indent)
+
+static void text_node(dumper *d, node *node, int indent);
+static void text_comprehension(dumper *d, const void *item, int indent);
+static void text_import_alias(dumper *d, const void *item, int indent);
+static void text_import_lib(dumper *d, const void *item, int indent);
+static void text_keyword(dumper *d, const void *item, int indent);
+static void text_match_case(dumper *d, const void *item, int indent);
+static void text_except_handler(dumper *d, const void *item, int indent);
+
+static void text_node_item(dumper *d, const void *item, int indent) { text_node(d, *(node *const *) item, indent); }
+
+static void text_token_item(dumper *d, const void *item, int indent) { text_token(d, *(token *const *) item); }
+
+static void text_node(dumper *d, node *node, int indent) {
+    if (node == NULL) {
+        pyc_write_str(d->w, "node(NULL)");
+        return;
+    }
+
+    if (node->type == EXPR_IDENTIFIER) {
+        pyc_write_str(d->w, "I(");
+        text_token(d, node->identifier);
+        pyc_write_str(d->w, ")");
+        return;
+    }
+
+    pyc_write_str(d->w, "node(type=");
+
+    switch (node->type) {
+        case NODE_MODULE:
+            pyc_write_str(d->w, "module, filename=");
+            pyc_write_str(d->w, node->module.filename != NULL ? node->module.filename : "(null)");
+            pyc_write_str(d->w, ", code_len=");
+            pyc_write_int(d->w, (long long) node->module.code_len);
+            break;
+        case NODE_GROUP:
+            pyc_write_str(d->w, "group, value=");
+            text_vec(d, "node *", node->group.v, text_node_item, indent + 1);
+            break;
+        case EXPR_IDENTIFIER:
+            pyc_write_str(d->w, "identifier, value=");
+            text_token(d, node->identifier);
+            break;
+        case EXPR_CONSTANT:
+            pyc_write_str(d->w, "constant, value=");
+            text_token(d, node->constant);
+            break;
+        case EXPR_BINARY_OPERATION:
+            pyc_write_str(d->w, "binary_operation, operator");
+            text_token(d, node->bin_op.op);
+            pyc_write_str(d->w, ", left=");
+            text_node(d, node->bin_op.left, indent + 1);
+            pyc_write_str(d->w, ", right=");
+            text_node(d, node->bin_op.right, indent + 1);
+            break;
+        case EXPR_UNARY_OPERATION:
+            pyc_write_str(d->w, "unary_operation, operator=");
+            text_token(d, node->unary_op.op);
+            pyc_write_str(d->w, ", value=");
+            text_node(d, node->unary_op.expr, indent + 1);
+            break;
+        case EXPR_CMP_OPERATION:
+            pyc_write_str(d->w, "cmp_operation, operator=");
+            text_vec(d, "token*", node->cmp_op.op, text_token_item, indent + 1);
+            pyc_write_str(d->w, ", values=");
+            text_vec(d, "node *", node->cmp_op.ex, text_node_item, indent + 1);
+            break;
+        case EXPR_WALRUS_OPERATION:
+            pyc_write_str(d->w, "walrus_operation, left=");
+            text_node(d, node->walrus_op.left, indent + 1);
+            pyc_write_str(d->w, ", right=");
+            text_node(d, node->walrus_op.right, indent + 1);
+            break;
+        case EXPR_FORMAT_STRING:
+            pyc_write_str(d->w, "format_string, start_string=");
+            text_token(d, node->fstring.start_string);
+            pyc_write_str(d->w, ", values=");
+            text_vec(d, "node *", node->fstring.values, text_node_item, indent + 1);
+            pyc_write_str(d->w, ", strings=");
+            text_vec(d, "token*", node->fstring.strings, text_token_item, indent + 1);
+            pyc_write_str(d->w, ", extras=");
+            text_vec(d, "node *", node->fstring.extras, text_node_item, indent + 1);
+            break;
+        case EXPR_LIST_COMP:
+            pyc_write_str(d->w, "list_comp, value=");
+            text_node(d, node->list_comp.value, indent);
+            pyc_write_str(d->w, ", comp=");
+            text_vec(d, "comprehension", node->list_comp.comp, text_comprehension, indent + 1);
+            break;
+        case EXPR_LIST:
+            pyc_write_str(d->w, "list, value=");
+            text_vec(d, "node *", node->list.v, text_node_item, indent + 1);
+            break;
+        case EXPR_DICT_COMP:
+            pyc_write_str(d->w, "dict_comp, key=");
+            text_node(d, node->dict_comp.key, indent);
+            pyc_write_str(d->w, ", value=");
+            text_node(d, node->dict_comp.value, indent);
+            pyc_write_str(d->w, ", comp=");
+            text_vec(d, "comprehension", node->dict_comp.comp, text_comprehension, indent + 1);
+            break;
+        case EXPR_DICT:
+            pyc_write_str(d->w, "dict, keys=");
+            text_vec(d, "node *", node->dict.keys, text_node_item, indent + 1);
+            pyc_write_str(d->w, ", values=");
+            text_vec(d, "node *", node->dict.values, text_node_item, indent + 1);
+            break;
+        case EXPR_SET_COMP:
+            pyc_write_str(d->w, "set_comp, value=");
+            text_node(d, node->set_comp.value, indent);
+            pyc_write_str(d->w, ", comp=");
+            text_vec(d, "comprehension", node->set_comp.comp, text_comprehension, indent + 1);
+            break;
+        case EXPR_SET:
+            pyc_write_str(d->w, "set, value=");
+            text_vec(d, "node *", node->set.v, text_node_item, indent + 1);
+            break;
+        case EXPR_TUPLE:
+            pyc_write_str(d->w, "tuple, value=");
+            text_vec(d, "node *", node->tuple.v, text_node_item, indent + 1);
+            break;
+        case EXPR_LAMBDA:
+            pyc_write_str(d->w, "lambda, args=");
+            text_vec(d, "token*", node->lambda.args, text_token_item, indent + 1);
+            pyc_write_str(d->w, ", body=");
+            text_node(d, node->lambda.body, indent);
+            break;
+        case EXPR_IF_EXP:
+            pyc_write_str(d->w, "if_exp, if_expr=");
+            text_node(d, node->if_else_expr.if_expr, indent);
+            pyc_write_str(d->w, ", condition=");
+            text_node(d, node->if_else_expr.condition, indent);
+            pyc_write_str(d->w, ", else_expr=");
+            text_node(d, node->if_else_expr.else_expr, indent);
+            break;
+        case EXPR_GENERATOR:
+            pyc_write_str(d->w, "generator, value=");
+            text_node(d, node->generator.value, indent);
+            pyc_write_str(d->w, ", comp=");
+            text_vec(d, "comprehension", node->generator.comp, text_comprehension, indent + 1);
+            break;
+        case EXPR_AWAIT:
+            pyc_write_str(d->w, "await, value=");
+            text_node(d, node->await, indent);
+            break;
+        case EXPR_YIELD:
+            pyc_write_str(d->w, "yield, value=");
+            text_node(d, node->yield, indent);
+            break;
+        case EXPR_YIELD_FROM:
+            pyc_write_str(d->w, "yield_from, value=");
+            text_node(d, node->yield_from, indent);
+            break;
+        case EXPR_CALL:
+            pyc_write_str(d->w, "call, base=");
+            text_node(d, node->call.base, indent);
+            pyc_write_str(d->w, ", args=");
+            text_vec(d, "node *", node->call.args, text_node_item, indent + 1);
+            pyc_write_str(d->w, ", kws=");
+            text_vec(d, "keyword", node->call.kws, text_keyword, indent + 1);
+            break;
+        case EXPR_ATTRIBUTE:
+            pyc_write_str(d->w, "attribute, base=");
+            text_node(d, node->attribute.base, indent);
+            pyc_write_str(d->w, ", key=");
+            text_token(d, node->attribute.key);
+            break;
+        case EXPR_INDEX:
+            pyc_write_str(d->w, "index, base=");
+            text_node(d, node->index.base, indent);
+            pyc_write_str(d->w, ", slices=[");
+            pyc_write_char(d->w, '\n');
+            for (int i = 0; i < 3; i++) {
+                text_indent(d, indent + 1);
+                text_node(d, node->index.slices[i], indent);
+                if (i != 2) {
+                    pyc_write_char(d->w, ',');
+                }
+                pyc_write_char(d->w, '\n');
+            }
+            text_indent(d, indent);
+            pyc_write_char(d->w, ']');
+            break;
+        case STMT_FUNCTION_DEF:
+            pyc_write_str(d->w, "function_def, name=");
+            text_token(d, node->function_def.name);
+            pyc_write_str(d->w, ", args=");
+            text_vec(d, "token*", node->function_def.args, text_token_item, indent + 1);
+            pyc_write_str(d->w, ", body=");
+            text_node(d, node->function_def.body, indent + 1);
+            pyc_write_str(d->w, ", is_async=");
+            pyc_write_str(d->w, node->function_def.is_async ? "true" : "false");
+            pyc_write_str(d->w, ", decorators=");
+            text_vec(d, "node *", node->function_def.decorators, text_node_item, indent + 1);
+            break;
+        case STMT_CLASS_DEF:
+            pyc_write_str(d->w, "class_def, name=");
+            text_token(d, node->class_def.name);
+            pyc_write_str(d->w, ", extends=");
+            text_vec(d, "token*", node->class_def.extends, text_token_item, indent + 1);
+            pyc_write_str(d->w, ", methods=");
+            text_vec(d, "node *", node->class_def.methods, text_node_item, indent + 1);
+            pyc_write_str(d->w, ", properties=");
+            text_vec(d, "node *", node->class_def.properties, text_node_item, indent + 1);
+            pyc_write_str(d->w, ", decorators=");
+            text_vec(d, "node *", node->class_def.decorators, text_node_item, indent + 1);
+            break;
+        case STMT_RETURN:
+            pyc_write_str(d->w, "return, value=");
+            text_node(d, node->ret.v, indent);
+            break;
+        case STMT_DELETE:
+            pyc_write_str(d->w, "delete, value=");
+            text_node(d, node->del, indent);
+            break;
+        case STMT_ASSIGN:
+            pyc_write_str(d->w, "assign, var=");
+            text_node(d, node->assign.var, indent);
+            pyc_write_str(d->w, ", set_op=");
+            text_token(d, node->assign.set_op);
+            pyc_write_str(d->w, ", val=");
+            text_node(d, node->assign.val, indent);
+            break;
+        case STMT_ASSIGN_MULT:
+            pyc_write_str(d->w, "assign_multiple, var=");
+            text_vec(d, "node *", node->assign_mult.targets, text_node_item, indent + 1);
+            pyc_write_str(d->w, ", val=");
+            text_node(d, node->assign_mult.val, indent);
+            break;
+        case STMT_FOR:
+            pyc_write_str(d->w, "for, is_async=");
+            pyc_write_str(d->w, node->for_loop.is_async ? "true" : "false");
+            pyc_write_str(d->w, ", value=");
+            text_node(d, node->for_loop.value, indent);
+            pyc_write_str(d->w, ", iter=");
+            text_node(d, node->for_loop.iter, indent);
+            pyc_write_str(d->w, ", body=");
+            text_node(d, node->for_loop.body, indent + 1);
+            break;
+        case STMT_WHILE:
+            pyc_write_str(d->w, "while, condition=");
+            text_node(d, node->while_loop.cond, indent);
+            pyc_write_str(d->w, ", body=");
+            text_node(d, node->while_loop.body, indent + 1);
+            break;
+        case STMT_IF:
+            pyc_write_str(d->w, "if, conditions=");
+            text_vec(d, "node *", node->if_stmt.conditions, text_node_item, indent + 1);
+            pyc_write_str(d->w, ", bodies=");
+            text_vec(d, "node *", node->if_stmt.bodies, text_node_item, indent + 1);
+            break;
+        case STMT_WITH:
+            pyc_write_str(d->w, "with, is_async=");
+            pyc_write_str(d->w, node->with.is_async ? "true" : "false");
+            pyc_write_str(d->w, ", vars=");
+            text_vec(d, "token*", node->with.vars, text_token_item, indent + 1);
+            pyc_write_str(d->w, ", contexts=");
+            text_vec(d, "node *", node->with.contexts, text_node_item, indent + 1);
+            pyc_write_str(d->w, ", body=");
+            text_node(d, node->with.body, indent + 1);
+            break;
+        case STMT_MATCH:
+            pyc_write_str(d->w, "match, subject=");
+            text_node(d, node->match.subject, indent);
+            pyc_write_str(d->w, ", cases=");
+            text_vec(d, "match_case", node->match.cases, text_match_case, indent + 1);
+            break;
+        case STMT_RAISE:
+            pyc_write_str(d->w, "raise, exception=");
+            text_node(d, node->raise.exception, indent);
+            pyc_write_str(d->w, ", cause=");
+            text_node(d, node->raise.cause, indent);
+            break;
+        case STMT_TRY_CATCH:
+            pyc_write_str(d->w, "try_catch, is_star=");
+            pyc_write_str(d->w, node->try_catch.is_star ? "true, try=" : "false, try=");
+            text_node(d, node->try_catch.try_body, indent + 1);
+            pyc_write_str(d->w, ", excepts=");
+            text_vec(d, "except_handler", node->try_catch.handlers, text_except_handler, indent + 1);
+            pyc_write_str(d->w, ", else=");
+            text_node(d, node->try_catch.else_body, indent);
+            pyc_write_str(d->w, ", finally=");
+            text_node(d, node->try_catch.finally_body, indent);
+            break;
+        case STMT_ASSERT:
+            pyc_write_str(d->w, "assert, condition=");
+            text_node(d, node->assert.condition, indent);
+            pyc_write_str(d->w, ", message=");
+            text_node(d, node->assert.message, indent);
+            break;
+        case STMT_IMPORT:
+            pyc_write_str(d->w, "import, imports=");
+            text_vec(d, "import_lib", node->imports.v, text_import_lib, indent + 1);
+            break;
+        case STMT_IMPORT_FROM:
+            pyc_write_str(d->w, "import_from, level=");
+            pyc_write_int(d->w, node->import_from.level);
+            pyc_write_str(d->w, ", lib=");
+            text_vec(d, "token*", node->import_from.lib, text_token_item, indent + 1);
+            pyc_write_str(d->w, ", imports=");
+            text_vec(d, "import_alias", node->import_from.imports, text_import_alias, indent + 1);
+            break;
+        case STMT_GLOBAL:
+            pyc_write_str(d->w, "global, names=");
+            text_vec(d, "token*", node->global, text_token_item, indent + 1);
+            break;
+        case STMT_NONLOCAL:
+            pyc_write_str(d->w, "nonlocal, names=");
+            text_vec(d, "token*", node->nonlocal, text_token_item, indent + 1);
+            break;
+        case STMT_EXPR:
+            pyc_write_str(d->w, "expr, value=");
+            text_node(d, node->stmt_expr, indent);
+            break;
+        case STMT_PASS:
+            pyc_write_str(d->w, "pass");
+            break;
+        case STMT_BREAK:
+            pyc_write_str(d->w, "break");
+            break;
+        case STMT_CONTINUE:
+            pyc_write_str(d->w, "continue");
+            break;
+        case NODE_LAZY_GROUP:
+            pyc_write_str(d->w, "lazy_group");
+            break;
+    }
+
+    pyc_write_char(d->w, ')');
+}
+
+static void text_comprehension(dumper *d, const void *item, int indent) {
+    const comprehension *comp = item;
+    pyc_write_str(d->w, "comprehension(target=");
+    text_node(d, comp->target, indent);
+    pyc_write_str(d->w, ", iter=");
+    text_node(d, comp->iter, indent);
+    pyc_write_str(d->w, ", ifs=");
+    text_vec(d, "node *", comp->ifs, text_node_item, indent + 1);
+    pyc_write_str(d->w, ", is_async=");
+    pyc_write_str(d->w, comp->is_async ? "true)" : "false)");
+}
+
+static void text_import_alias(dumper *d, const void *item, int indent) {
+    const import_alias *al = item;
+    pyc_write_str(d->w, "(val=");
+    text_token(d, al->tok);
+    pyc_write_str(d->w, ", as=");
+    text_token(d, al->as);
+    pyc_write_char(d->w, ')');
+}
+
+static void text_import_lib(dumper *d, const void *item, int indent) {
+    const import_lib *al = item;
+    pyc_write_str(d->w, "(val=");
+    text_vec(d, "token*", al->tok, text_token_item, indent + 1);
+    pyc_write_str(d->w, ", as=");
+    text_token(d, al->as);
+    pyc_write_char(d->w, ')');
+}
+
+static void text_keyword(dumper *d, const void *item, int indent) {
+    const keyword *kws = item;
+    pyc_write_str(d->w, "(key=");
+    text_token(d, kws->name);
+    pyc_write_str(d->w, ", value=");
+    text_node(d, kws->value, indent);
+    pyc_write_char(d->w, ')');
+}
+
+static void text_match_case(dumper *d, const void *item, int indent) {
+    const match_case *cas = item;
+    pyc_write_str(d->w, "(pattern=");
+    text_node(d, cas->pattern, indent);
+    pyc_write_str(d->w, ", as=");
+    text_token(d, cas->as);
+    pyc_write_str(d->w, ", condition=");
+    text_node(d, cas->condition, indent);
+    pyc_write_str(d->w, ", body=");
+    text_node(d, cas->body, indent + 1);
+    pyc_write_char(d->w, ')');
+}
+
+static void text_except_handler(dumper *d, const void *item, int indent) {
+    const except_handler *eh = item;
+    pyc_write_str(d->w, "(type=");
+    text_node(d, eh->class, indent);
+    pyc_write_str(d->w, ", name=");
+    text_token(d, eh->name);
+    pyc_write_str(d->w, ", body=");
+    text_node(d, eh->body, indent + 1);
+    pyc_write_char(d->w, ')');
+}
+
+void pyc_dump_text(pyc_writer *w, const char *code, node *n, int indent) {
+    dumper d = {.w = w, .code = code};
+    text_node(&d, n, indent);
+}
+
+static const char *const node_type_names[] = {
+    [NODE_MODULE] = "module",
+    [NODE_GROUP] = "group",
+    [EXPR_IDENTIFIER] = "identifier",
+    [EXPR_CONSTANT] = "constant",
+    [EXPR_FORMAT_STRING] = "format_string",
+    [EXPR_BINARY_OPERATION] = "binary_operation",
+    [EXPR_UNARY_OPERATION] = "unary_operation",
+    [EXPR_CMP_OPERATION] = "cmp_operation",
+    [EXPR_WALRUS_OPERATION] = "walrus_operation",
+    [EXPR_LIST_COMP] = "list_comp",
+    [EXPR_LIST] = "list",
+    [EXPR_DICT_COMP] = "dict_comp",
+    [EXPR_DICT] = "dict",
+    [EXPR_SET_COMP] = "set_comp",
+    [EXPR_SET] = "set",
+    [EXPR_TUPLE] = "tuple",
+    [EXPR_LAMBDA] = "lambda",
+    [EXPR_IF_EXP] = "if_exp",
+    [EXPR_GENERATOR] = "generator",
+    [EXPR_AWAIT] = "await",
+    [EXPR_YIELD] = "yield",
+    [EXPR_YIELD_FROM] = "yield_from",
+    [EXPR_CALL] = "call",
+    [EXPR_ATTRIBUTE] = "attribute",
+    [EXPR_INDEX] = "index",
+    [STMT_FUNCTION_DEF] = "function_def",
+    [STMT_CLASS_DEF] = "class_def",
+    [STMT_RETURN] = "return",
+    [STMT_DELETE] = "delete",
+    [STMT_ASSIGN] = "assign",
+    [STMT_ASSIGN_MULT] = "assign_multiple",
+    [STMT_FOR] = "for",
+    [STMT_WHILE] = "while",
+    [STMT_IF] = "if",
+    [STMT_WITH] = "with",
+    [STMT_MATCH] = "match",
+    [STMT_RAISE] = "raise",
+    [STMT_TRY_CATCH] = "try_catch",
+    [STMT_ASSERT] = "assert",
+    [STMT_IMPORT] = "import",
+    [STMT_IMPORT_FROM] = "import_from",
+    [STMT_GLOBAL] = "global",
+    [STMT_NONLOCAL] = "nonlocal",
+    [STMT_EXPR] = "expr",
+    [STMT_PASS] = "pass",
+    [STMT_BREAK] = "break",
+    [STMT_CONTINUE] = "continue",
+    [NODE_LAZY_GROUP] = "lazy_group"
+};
+
+static void json_string(dumper *d, const char *s, size_t len) {
+    pyc_write_char(d->w, '"');
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) s[i];
+        if (c >= ' ' && c != '"' && c != '\\')
+            continue;
+        pyc_write(d->w, s + run, i - run);
+        run = i + 1;
+        if (c == '"' || c == '\\') {
+            char esc[2] = {'\\', (char) c};
+            pyc_write(d->w, esc, 2);
+        } else if (c == '\n') {
+            pyc_write_str(d->w, "\\n");
+        } else if (c == '\t') {
+            pyc_write_str(d->w, "\\t");
+        } else if (c == '\r') {
+            pyc_write_str(d->w, "\\r");
+        } else {
+            char esc[6] = {'\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 0xF]};
+            pyc_write(d->w, esc, 6);
+        }
+    }
+    pyc_write(d->w, s + run, len - run);
+    pyc_write_char(d->w, '"');
+}
+
+static void json_token(dumper *d, const token *tok) {
+    if (tok == NULL) {
+        pyc_write_str(d->w, "null");
+        return;
+    }
+    pyc_write_str(d->w, "{\"start\":");
+    pyc_write_int(d->w, tok->start);
+    pyc_write_str(d->w, ",\"end\":");
+    pyc_write_int(d->w, tok->end);
+    pyc_write_str(d->w, ",\"text\":");
+    json_string(d, d->code + tok->start, tok->end - tok->start);
+    pyc_write_char(d->w, '}');
+}
+
+static void json_node(dumper *d, node *n);
+
+static void json_fields(dumper *d, const pyc_schema *s, const char *obj, bool first);
+
+static void json_value(dumper *d, pyc_field_kind kind, const char *p) {
+    switch (kind) {
+        case FIELD_TOKEN:
+            json_token(d, *(token *const *) p);
+            return;
+        case FIELD_NODE:
+            json_node(d, *(node *const *) p);
+            return;
+        case FIELD_BOOL:
+            pyc_write_str(d->w, *(const bool *) p ? "true" : "false");
+            return;
+        case FIELD_INT:
+            pyc_write_int(d->w, *(const int *) p);
+            return;
+        default:
+            break;
+    }
+
+    pyc_raw_vec v;
+    memcpy(&v, p, sizeof(v));
+    pyc_write_char(d->w, '[');
+    if (v.data != NULL) {
+        const pyc_schema *rec = kind >= FIELD_COMPREHENSIONS ? &pyc_record_schemas[kind - FIELD_COMPREHENSIONS] : NULL;
+        for (size_t i = 0; i < v.size; i++) {
+            if (i > 0)
+                pyc_write_char(d->w, ',');
+            if (rec != NULL) {
+                pyc_write_char(d->w, '{');
+                json_fields(d, rec, v.data + i * rec->size, true);
+                pyc_write_char(d->w, '}');
+            } else {
+                json_value(d, kind == FIELD_NODES ? FIELD_NODE : FIELD_TOKEN, v.data + i * sizeof(void *));
+            }
+        }
+    }
+    pyc_write_char(d->w, ']');
+}
+
+static void json_fields(dumper *d, const pyc_schema *s, const char *obj, bool first) {
+    for (size_t i = 0; i < s->count; i++) {
+        // the key is the member without the struct it's in, "bin_op.left" is "left"
+        const char *name = s->fields[i].name;
+        const char *dot = strrchr(name, '.');
+        if (dot != NULL)
+            name = dot + 1;
+        if (!first)
+            pyc_write_char(d->w, ',');
+        first = false;
+        pyc_write_char(d->w, '"');
+        pyc_write_str(d->w, name);
+        pyc_write_str(d->w, "\":");
+        json_value(d, s->fields[i].kind, obj + s->fields[i].offset);
+    }
+}
+
+static void json_node(dumper *d, node *n) {
+    if (n == NULL) {
+        pyc_write_str(d->w, "null");
+        return;
+    }
+    pyc_write_str(d->w, "{\"type\":\"");
+    pyc_write_str(d->w, node_type_names[n->type]);
+    pyc_write_char(d->w, '"');
+    json_fields(d, &pyc_node_schemas[n->type], (const char *) n, false);
+    pyc_write_char(d->w, '}');
+}
+
+void pyc_dump_json(pyc_writer *w, const char *code, node *n) {
+    dumper d = {.w = w, .code = code};
+    json_node(&d, n);
+}
+
+bool pyc_dump(pyc_writer *w, pyc_dump_format format, pyc_lexer *lx, node *tree) {
+    switch (format) {
+        case PYC_DUMP_TEXT:
+            pyc_dump_text(w, lx->code, tree, 0);
+            return true;
+        case PYC_DUMP_JSON:
+            pyc_dump_json(w, lx->code, tree);
+            pyc_write_char(w, '\n');
+            return true;
+        case PYC_DUMP_BIN: {
+            char_list entry = vec();
+            bool ok = pyc_cache_build(lx, tree, &entry);
+            if (ok)
+                pyc_write(w, entry.data, entry.size);
+            char_list_clear(&entry);
+            return ok;
+        }
+    }
+    return false;
+}
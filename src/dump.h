@@ -0,0 +1,31 @@
+#ifndef PYC_DUMP_H
+#define PYC_DUMP_H
+
+#include "parser.h"
+
+// Dumps of a parsed tree for other tools, written through a pyc_writer.
+//  text  the format of node_print
+//  json  one object per node, {"type": "binary_operation", "left": ..., "op": ..., "right": ...}, with the fields
+//        named like the members of struct node. A token is {"start": ..., "end": ..., "text": "..."}, a record (keyword,
+//        comprehension etc.) an object of its fields, a vector an array and a NULL node or token null.
+//  bin   a cache entry of the file (see cache.h), the tree as a flat AST together with the tokens and constants
+
+typedef enum {
+    PYC_DUMP_TEXT,
+    PYC_DUMP_JSON,
+    PYC_DUMP_BIN
+} pyc_dump_format;
+
+// false for an unknown name
+bool pyc_dump_format_parse(const char *name, pyc_dump_format *format);
+
+// code is the source the tokens of the tree are from.
+void pyc_dump_text(pyc_writer *w, const char *code, node *n, int indent);
+
+void pyc_dump_json(pyc_writer *w, const char *code, node *n);
+
+// Dumps the tree the lexer was parsed into. A bin dump needs a lexer without an interner that doesn't stream,
+// false if it can't be made.
+bool pyc_dump(pyc_writer *w, pyc_dump_format format, pyc_lexer *lx, node *tree);
+
+#endif // PYC_DUMP_H
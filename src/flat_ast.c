@@ -0,0 +1,215 @@
+#include "flat_ast.h"
+#include "walk.h"
+
+void pyc_flat_init(pyc_flat_ast *ast, token *tokens, size_t token_count) {
+    *ast = (pyc_flat_ast){.words = vec(), .tokens = tokens, .token_count = token_count};
+    // offset 0 is the NULL ref and the empty list
+    u32_list_push(&ast->words, 0);
+}
+
+void pyc_flat_free(pyc_flat_ast *ast) { u32_list_clear(&ast->words); }
+
+// Appends n words to be filled in later and returns the offset of the first one.
+static size_t flat_reserve(pyc_flat_ast *ast, size_t n) {
+    u32_list *w = &ast->words;
+    size_t at = w->size;
+    if (at + n > UINT32_MAX) {
+        printf("OverflowError: flat AST is larger than 16 GiB\n");
+        fail();
+    }
+    if (at + n > w->capacity) u32_list_reserve(w, at + n > w->capacity * 2 ? at + n : w->capacity * 2);
+    w->size = at + n;
+    return at;
+}
+
+static void encode_fields(pyc_flat_ast *ast, const pyc_schema *s, const char *obj, size_t at);
+
+static uint32_t encode_value(pyc_flat_ast *ast, pyc_field_kind kind, const char *p) {
+    switch (kind) {
+        case FIELD_TOKEN: {
+            token *tok = *(token *const *) p;
+            if (tok == NULL) return PYC_FLAT_NONE;
+            if (tok < ast->tokens || tok >= ast->tokens + ast->token_count) {
+                printf("flat AST: token outside of the token array\n");
+                fail();
+            }
+            return (uint32_t) (tok - ast->tokens);
+        }
+        case FIELD_NODE:
+            return pyc_flat_encode(ast, *(node *const *) p);
+        case FIELD_BOOL:
+            return *(const bool *) p;
+        case FIELD_INT:
+            return (uint32_t) *(const int *) p;
+        default:
+            break;
+    }
+
+    pyc_raw_vec v;
+    memcpy(&v, p, sizeof(v));
+    if (v.data == NULL) return 0;
+
+    bool records = kind >= FIELD_COMPREHENSIONS;
+    const pyc_schema *rec = records ? &pyc_record_schemas[kind - FIELD_COMPREHENSIONS] : NULL;
+    size_t per = records ? rec->count : 1;
+    size_t block = flat_reserve(ast, 1 + v.size * per);
+    ast->words.data[block] = (uint32_t) v.size;
+    for (size_t i = 0; i < v.size; i++) {
+        if (records) {
+            encode_fields(ast, rec, v.data + i * rec->size, block + 1 + i * per);
+            continue;
+        }
+        uint32_t word = encode_value(ast, kind == FIELD_NODES ? FIELD_NODE : FIELD_TOKEN, v.data + i * sizeof(void *));
+        ast->words.data[block + 1 + i] = word;
+    }
+    return (uint32_t) block;
+}
+
+static void encode_fields(pyc_flat_ast *ast, const pyc_schema *s, const char *obj, size_t at) {
+    for (size_t i = 0; i < s->count; i++) {
+        // encoding a child may move the buffer
+        uint32_t word = encode_value(ast, s->fields[i].kind, obj + s->fields[i].offset);
+        ast->words.data[at + i] = word;
+    }
+}
+
+flat_ref pyc_flat_encode(pyc_flat_ast *ast, node *n) {
+    if (n == NULL) return 0;
+    // a stub can't be expanded again without its lexer
+    if (n->type == NODE_LAZY_GROUP) parse_lazy_group(n);
+    const pyc_schema *s = &pyc_node_schemas[n->type];
+    size_t at = flat_reserve(ast, 1 + s->count);
+    ast->words.data[at] = n->type;
+    encode_fields(ast, s, (const char *) n, at + 1);
+    return (flat_ref) at;
+}
+
+// The fields of a node or a record that still have to be checked, at is the offset of the first one.
+typedef struct {
+    const pyc_schema *s;
+    size_t at;
+} flat_run;
+
+vec_define(flat_run, flat_runs);
+
+// Marks words[at, at + n) as used if they are all after from, inside the buffer and not used yet.
+static bool flat_claim(uint8_t *used, size_t size, size_t from, size_t at, size_t n) {
+    if (at <= from || at >= size || n > size - at) return false;
+    for (size_t i = at; i < at + n; i++) {
+        if (used[i]) return false;
+        used[i] = 1;
+    }
+    return true;
+}
+
+static bool check_node(const pyc_flat_ast *ast, uint8_t *used, flat_runs *runs, size_t from, uint32_t ref) {
+    if (ref == 0) return true;
+    if (ref >= ast->words.size || ast->words.data[ref] >= NODE_LAZY_GROUP) return false;
+    const pyc_schema *s = &pyc_node_schemas[ast->words.data[ref]];
+    if (!flat_claim(used, ast->words.size, from, ref, 1 + s->count)) return false;
+    flat_runs_push(runs, (flat_run){.s = s, .at = ref + 1});
+    return true;
+}
+
+static bool check_token(const pyc_flat_ast *ast, uint32_t word) {
+    return word == PYC_FLAT_NONE || word < ast->token_count;
+}
+
+static bool check_fields(const pyc_flat_ast *ast, uint8_t *used, flat_runs *runs, flat_run r) {
+    const uint32_t *w = ast->words.data;
+    for (size_t i = 0; i < r.s->count; i++) {
+        pyc_field_kind kind = r.s->fields[i].kind;
+        uint32_t word = w[r.at + i];
+        if (kind == FIELD_TOKEN && !check_token(ast, word)) return false;
+        if (kind == FIELD_NODE && !check_node(ast, used, runs, r.at + i, word)) return false;
+        if (kind < FIELD_TOKENS || word == 0) continue;
+
+        bool records = kind >= FIELD_COMPREHENSIONS;
+        const pyc_schema *rec = records ? &pyc_record_schemas[kind - FIELD_COMPREHENSIONS] : NULL;
+        size_t per = records ? rec->count : 1;
+        if (word >= ast->words.size) return false;
+        size_t count = w[word];
+        if (count > (ast->words.size - word - 1) / per) return false;
+        if (!flat_claim(used, ast->words.size, r.at + i, word, 1 + count * per)) return false;
+
+        for (size_t k = 0; k < count; k++) {
+            size_t at = word + 1 + k * per;
+            if (records) flat_runs_push(runs, (flat_run){.s = rec, .at = at});
+            else if (kind == FIELD_TOKENS ? !check_token(ast, w[at]) : !check_node(ast, used, runs, at, w[at])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool pyc_flat_check(const pyc_flat_ast *ast, flat_ref root) {
+    if (root == 0) return false;
+    // every node and list block gets words of its own, so a bad buffer can't make the expansion loop or blow up
+    uint8_t *used = calloc(ast->words.size, 1);
+    flat_runs runs;
+    flat_runs_init(&runs);
+    bool ok = check_node(ast, used, &runs, 0, root);
+    while (ok && runs.size > 0) ok = check_fields(ast, used, &runs, flat_runs_pop(&runs));
+    free(runs.data);
+    free(used);
+    return ok;
+}
+
+static void expand_fields(pyc_flat_ast *ast, const pyc_schema *s, size_t at, char *obj, node *owner);
+
+static void expand_value(pyc_flat_ast *ast, pyc_field_kind kind, uint32_t word, char *p, node *owner) {
+    switch (kind) {
+        case FIELD_TOKEN:
+            *(token **) p = pyc_flat_token(ast, word);
+            return;
+        case FIELD_NODE:
+            *(node **) p = pyc_flat_expand(ast, word, owner);
+            return;
+        case FIELD_BOOL:
+            *(bool *) p = word != 0;
+            return;
+        case FIELD_INT:
+            *(int *) p = (int) word;
+            return;
+        default:
+            break;
+    }
+
+    pyc_raw_vec v = {.size = 0, .capacity = 0, .data = NULL};
+    if (word != 0) {
+        bool records = kind >= FIELD_COMPREHENSIONS;
+        const pyc_schema *rec = records ? &pyc_record_schemas[kind - FIELD_COMPREHENSIONS] : NULL;
+        size_t per = records ? rec->count : 1;
+        size_t elem = records ? rec->size : sizeof(void *);
+
+        v.size = v.capacity = ast->words.data[word];
+        v.data = pyc_ast_malloc(v.size == 0 ? elem : v.size * elem);
+        for (size_t i = 0; i < v.size; i++) {
+            if (records) {
+                memset(v.data + i * elem, 0, elem);
+                expand_fields(ast, rec, word + 1 + i * per, v.data + i * elem, owner);
+            } else {
+                expand_value(ast, kind == FIELD_NODES ? FIELD_NODE : FIELD_TOKEN, ast->words.data[word + 1 + i],
+                             v.data + i * elem, owner);
+            }
+        }
+    }
+    memcpy(p, &v, sizeof(v));
+}
+
+static void expand_fields(pyc_flat_ast *ast, const pyc_schema *s, size_t at, char *obj, node *owner) {
+    for (size_t i = 0; i < s->count; i++) {
+        expand_value(ast, s->fields[i].kind, ast->words.data[at + i], obj + s->fields[i].offset, owner);
+    }
+}
+
+node *pyc_flat_expand(pyc_flat_ast *ast, flat_ref ref, node *parent) {
+    if (ref == 0) return NULL;
+    node *n = ast_node_create(parent);
+    memset(n, 0, sizeof(node));
+    n->parent = parent;
+    n->type = pyc_flat_type(ast, ref);
+    expand_fields(ast, &pyc_node_schemas[n->type], ref + 1, (char *) n, n);
+    return n;
+}
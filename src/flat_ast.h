@@ -0,0 +1,58 @@
+#ifndef PYC_FLAT_AST_H
+#define PYC_FLAT_AST_H
+
+#include "parser.h"
+
+// Compact form of a parsed tree that can be kept around for a whole codebase.
+// Every node is a run of 32-bit words in one flat buffer: its node_type followed by one word per field, in the order
+// the fields have in its member of struct node. A node is referenced by the offset of its first word, 0 is NULL.
+// Fields hold token indices into the lexer's tokens (PYC_FLAT_NONE for NULL), refs of child nodes, bools/ints, or
+// the offset of a list block for vectors (0 for a vector without data). A list block is a count followed by that
+// many tokens, refs, or records with their fields inline (comprehensions, keywords, except handlers etc.).
+// The parent links and the tok fields that only some node kinds fill in are not kept.
+
+#define PYC_FLAT_NONE UINT32_MAX
+
+typedef uint32_t flat_ref;
+
+typedef struct {
+    u32_list words;
+    // the tokens the token indices point into, not owned
+    token *tokens;
+    size_t token_count;
+} pyc_flat_ast;
+
+void pyc_flat_init(pyc_flat_ast *ast, token *tokens, size_t token_count);
+
+void pyc_flat_free(pyc_flat_ast *ast);
+
+// Appends the tree to the buffer, its tokens have to be ones of ast->tokens. Lazy groups in it are parsed first.
+flat_ref pyc_flat_encode(pyc_flat_ast *ast, node *n);
+
+// Checks that a buffer from outside, e.g. a mapped cache entry, is a tree pyc_flat_expand can build from root: known
+// node types, refs and list blocks that are inside the buffer and don't overlap, and token indices below token_count.
+bool pyc_flat_check(const pyc_flat_ast *ast, flat_ref root);
+
+// Builds the node tree back, e.g. for node_print. Allocates through pyc_ast_malloc, so it goes to pyc_ast_arena if
+// that is set.
+node *pyc_flat_expand(pyc_flat_ast *ast, flat_ref ref, node *parent);
+
+static inline node_type pyc_flat_type(const pyc_flat_ast *ast, flat_ref ref) {
+    return (node_type) ast->words.data[ref];
+}
+
+static inline uint32_t pyc_flat_field(const pyc_flat_ast *ast, flat_ref ref, size_t i) {
+    return ast->words.data[ref + 1 + i];
+}
+
+static inline token *pyc_flat_token(const pyc_flat_ast *ast, uint32_t word) {
+    return word == PYC_FLAT_NONE ? NULL : &ast->tokens[word];
+}
+
+// The entries of a list field, NULL for a vector without data.
+static inline const uint32_t *pyc_flat_list(const pyc_flat_ast *ast, uint32_t word, size_t *count) {
+    *count = word == 0 ? 0 : ast->words.data[word];
+    return word == 0 ? NULL : &ast->words.data[word + 1];
+}
+
+#endif // PYC_FLAT_AST_H
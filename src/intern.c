@@ -0,0 +1,137 @@
+#include "intern.h"
+#include "utils.h"
+
+static pyc_symbol_table *symbol_table_new(size_t capacity, pyc_symbol_table *retired) {
+    pyc_symbol_table *t = calloc(1, sizeof(pyc_symbol_table) + capacity * sizeof(t->slots[0]));
+    if (t == NULL) {
+        perror("Error allocating memory for pyc_interner");
+        exit(EXIT_FAILURE);
+    }
+    t->retired = retired;
+    t->capacity = capacity;
+    return t;
+}
+
+void pyc_interner_init(pyc_interner *in) {
+    for (size_t i = 0; i < PYC_INTERN_SHARDS; i++) {
+        pyc_intern_shard *shard = &in->shards[i];
+        atomic_init(&shard->table, symbol_table_new(16, NULL));
+        shard->count = 0;
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+    for (size_t i = 0; i < PYC_INTERN_SEGMENTS; i++) atomic_init(&in->segments[i], NULL);
+    atomic_init(&in->next_id, 0);
+}
+
+void pyc_interner_free(pyc_interner *in) {
+    for (size_t i = 0; i < PYC_INTERN_SHARDS; i++) {
+        pyc_intern_shard *shard = &in->shards[i];
+        pyc_symbol_table *t = atomic_load_explicit(&shard->table, memory_order_relaxed);
+        for (size_t j = 0; j < t->capacity; j++) free(atomic_load_explicit(&t->slots[j], memory_order_relaxed));
+        while (t != NULL) {
+            pyc_symbol_table *retired = t->retired;
+            free(t);
+            t = retired;
+        }
+        atomic_store_explicit(&shard->table, NULL, memory_order_relaxed);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    for (size_t i = 0; i < PYC_INTERN_SEGMENTS; i++) {
+        free(atomic_load_explicit(&in->segments[i], memory_order_relaxed));
+        atomic_store_explicit(&in->segments[i], NULL, memory_order_relaxed);
+    }
+    atomic_store_explicit(&in->next_id, 0, memory_order_relaxed);
+}
+
+// Probes for the string, returns NULL with *slot set to the empty slot the probe ended on if it isn't there.
+static pyc_symbol *symbol_table_find(pyc_symbol_table *t, const char *s, size_t len, uint64_t hash, size_t *slot) {
+    size_t mask = t->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        pyc_symbol *sym = atomic_load_explicit(&t->slots[i], memory_order_acquire);
+        if (sym == NULL) {
+            *slot = i;
+            return NULL;
+        }
+        if (sym->hash == hash && sym->len == len && memcmp(sym->bytes, s, len) == 0) return sym;
+    }
+}
+
+// segment k holds the ids from PYC_INTERN_SEGMENT_BASE * (2^k - 1) on
+static inline _Atomic(pyc_symbol *) *id_slot(pyc_interner *in, uint32_t id, bool create) {
+    uint64_t n = (uint64_t) id / PYC_INTERN_SEGMENT_BASE + 1;
+    size_t k = 63 - __builtin_clzll(n);
+    size_t offset = id - PYC_INTERN_SEGMENT_BASE * ((1ull << k) - 1);
+
+    _Atomic(pyc_symbol *) *segment = atomic_load_explicit(&in->segments[k], memory_order_acquire);
+    if (segment == NULL && create) {
+        // two shards may need the same segment at once, the loser frees its copy
+        _Atomic(pyc_symbol *) *fresh = calloc((size_t) PYC_INTERN_SEGMENT_BASE << k, sizeof(fresh[0]));
+        if (fresh == NULL) {
+            perror("Error allocating memory for pyc_interner");
+            exit(EXIT_FAILURE);
+        }
+        if (atomic_compare_exchange_strong_explicit(&in->segments[k], &segment, fresh, memory_order_acq_rel,
+                                                    memory_order_acquire)) {
+            segment = fresh;
+        } else free(fresh);
+    }
+    return segment == NULL ? NULL : &segment[offset];
+}
+
+uint32_t pyc_intern_hashed(pyc_interner *in, const char *s, size_t len, uint64_t hash) {
+    // the tables probe with the low bits, so the shard is picked by the high ones
+    pyc_intern_shard *shard = &in->shards[hash >> 58 & (PYC_INTERN_SHARDS - 1)];
+    size_t slot;
+    pyc_symbol *sym = symbol_table_find(atomic_load_explicit(&shard->table, memory_order_acquire), s, len, hash, &slot);
+    if (sym != NULL) return sym->id;
+
+    pthread_mutex_lock(&shard->lock);
+    pyc_symbol_table *t = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    sym = symbol_table_find(t, s, len, hash, &slot);
+    if (sym != NULL) {
+        pthread_mutex_unlock(&shard->lock);
+        return sym->id;
+    }
+
+    if ((shard->count + 1) * 2 > t->capacity) {
+        pyc_symbol_table *grown = symbol_table_new(t->capacity * 2, t);
+        size_t mask = grown->capacity - 1;
+        for (size_t i = 0; i < t->capacity; i++) {
+            pyc_symbol *old = atomic_load_explicit(&t->slots[i], memory_order_relaxed);
+            if (old == NULL) continue;
+            size_t j = old->hash & mask;
+            while (atomic_load_explicit(&grown->slots[j], memory_order_relaxed) != NULL) j = (j + 1) & mask;
+            atomic_store_explicit(&grown->slots[j], old, memory_order_relaxed);
+        }
+        atomic_store_explicit(&shard->table, grown, memory_order_release);
+        t = grown;
+        symbol_table_find(t, s, len, hash, &slot);
+    }
+
+    sym = malloc(sizeof(pyc_symbol) + len + 1);
+    if (sym == NULL) {
+        perror("Error allocating memory for pyc_interner");
+        exit(EXIT_FAILURE);
+    }
+    sym->hash = hash;
+    sym->len = (uint32_t) len;
+    memcpy(sym->bytes, s, len);
+    sym->bytes[len] = '\0';
+    sym->id = atomic_fetch_add_explicit(&in->next_id, 1, memory_order_relaxed);
+
+    // the id has to lead to the symbol before anyone can find the id
+    atomic_store_explicit(id_slot(in, sym->id, true), sym, memory_order_release);
+    atomic_store_explicit(&t->slots[slot], sym, memory_order_release);
+    shard->count++;
+    pthread_mutex_unlock(&shard->lock);
+    return sym->id;
+}
+
+uint32_t pyc_intern(pyc_interner *in, const char *s, size_t len) {
+    return pyc_intern_hashed(in, s, len, pyc_hash_bytes(s, len));
+}
+
+const pyc_symbol *pyc_interner_symbol(pyc_interner *in, uint32_t id) {
+    _Atomic(pyc_symbol *) *slot = id_slot(in, id, false);
+    return slot == NULL ? NULL : atomic_load_explicit(slot, memory_order_acquire);
+}
@@ -0,0 +1,67 @@
+#ifndef PYC_INTERN_H
+#define PYC_INTERN_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// String interner that any number of threads can share, e.g. the lexers of all files of a project.
+// Every distinct string gets a dense 32-bit symbol id that keeps pointing to the same bytes until the interner is
+// freed, so names from different files compare as integers.
+// The strings are spread over shards by their hash. Finding a string that is already interned takes no lock: a shard
+// publishes its table and every symbol with a release store and readers probe it with acquire loads. Only inserting
+// locks the one shard the string falls into.
+
+#define PYC_INTERN_SHARDS 64
+// ids are looked up in segments of doubling size, the first one holds this many
+#define PYC_INTERN_SEGMENT_BASE 1024
+#define PYC_INTERN_SEGMENTS 23
+
+typedef struct {
+    uint64_t hash;
+    uint32_t id;
+    uint32_t len;
+    char bytes[]; // NUL terminated
+} pyc_symbol;
+
+typedef struct pyc_symbol_table {
+    // a table that was outgrown, readers may still be probing it so it is only freed with the interner
+    struct pyc_symbol_table *retired;
+    size_t capacity; // always a power of two
+    _Atomic(pyc_symbol *) slots[];
+} pyc_symbol_table;
+
+typedef struct {
+    _Atomic(pyc_symbol_table *) table;
+    size_t count; // only touched with the lock held
+    pthread_mutex_t lock;
+} pyc_intern_shard;
+
+typedef struct {
+    pyc_intern_shard shards[PYC_INTERN_SHARDS];
+    _Atomic(_Atomic(pyc_symbol *) *) segments[PYC_INTERN_SEGMENTS];
+    atomic_uint_least32_t next_id;
+} pyc_interner;
+
+void pyc_interner_init(pyc_interner *in);
+
+// No other thread may use the interner anymore, every symbol is freed.
+void pyc_interner_free(pyc_interner *in);
+
+// Returns the id of the string, interning a copy of it if it is new. hash has to be pyc_hash_bytes(s, len).
+uint32_t pyc_intern_hashed(pyc_interner *in, const char *s, size_t len, uint64_t hash);
+
+uint32_t pyc_intern(pyc_interner *in, const char *s, size_t len);
+
+// Returns the symbol of an id that some pyc_intern call returned.
+const pyc_symbol *pyc_interner_symbol(pyc_interner *in, uint32_t id);
+
+// Number of ids handed out so far, insertions that run at the same time may not be visible through
+// pyc_interner_symbol yet.
+static inline uint32_t pyc_interner_count(pyc_interner *in) {
+    return atomic_load_explicit(&in->next_id, memory_order_acquire);
+}
+
+#endif // PYC_INTERN_H
@@ -3,8 +3,10 @@
 #endif
 
 #include "lexer.h"
+#include "number.h"
+#include "simd.h"
+#include "unicode.h"
 
-#include <ctype.h>
 #include <string.h>
 
 // ReSharper disable CppParameterNamesMismatch
@@ -20,409 +22,1159 @@ char* strndup(const char* s, size_t n) {
 }
 #endif
 
-char* pyc_code;
-size_t pyc_ci;
-size_t pyc_code_len;
-tokens pyc_tokens;
-size_t pyc_tok_count;
-size_t pyc_ti;
-code_substrs pyc_temp_identifiers = vec();
-u64_list pyc_temp_int = vec();
-f64_list pyc_temp_floats = vec();
-code_substrs pyc_temp_strings = vec();
-
-void pyc_lexer_init(char* code) {
-    pyc_code = code;
-    pyc_ci = 0;
-    pyc_code_len = strlen(code);
-    pyc_ti = 0;
-    tokens_init(&pyc_tokens);
+// plain ASCII checks, the <ctype.h> ones depend on the locale and may accept bytes of multibyte characters
+#define is_digit(c) ((c) >= '0' && (c) <= '9')
+#define is_alpha(c) (((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z')
+
+pyc_lexer pyc_global_lexer;
+_Thread_local pyc_lex_recovery *pyc_lex_recover = NULL;
+
+void pyc_lex_init(pyc_lexer* lx, char* code, size_t len) {
+    *lx = (pyc_lexer){
+        .code = code,
+        .ci = 0,
+        .code_len = len,
+        .kinds = vec(),
+        .groups = vec(),
+        .next_stop = vec(),
+        .next_newline = vec(),
+        .next_colon = vec(),
+        .lines = vec(),
+        .indents = vec(),
+        .identifiers = vec(),
+        .identifiers_index = hash_index(),
+        .identifier_symbols = vec(),
+        .strings = vec(),
+        .string_hashes = vec(),
+        .strings_index = hash_index(),
+        .string_arena = pyc_arena(64 * 1024),
+        .ints = vec(),
+        .ints_index = hash_index(),
+        .floats = vec(),
+        .floats_index = hash_index(),
+        .big_ints = vec(),
+        .stream_buffer = vec(),
+        .stream_held = vec(),
+        .stream_fstrings = vec()
+    };
+    tokens_init(&lx->tokens);
+}
+
+void pyc_lex_free(pyc_lexer* lx) {
+    tokens_clear(&lx->tokens);
+    u16_list_clear(&lx->kinds);
+    u32_list_clear(&lx->groups);
+    u32_list_clear(&lx->next_stop);
+    u32_list_clear(&lx->next_newline);
+    u32_list_clear(&lx->next_colon);
+    size_list_clear(&lx->lines);
+    free(lx->indents.data);
+    lx->indents = (indent_levels) vec();
+    if (lx->streaming) {
+        for (size_t i = 0; i < lx->identifiers.size; i++) free(lx->identifiers.data[i].code);
+        for (size_t i = 0; i < lx->big_ints.size; i++) free(lx->big_ints.data[i].code);
+    }
+    free(lx->identifiers.data);
+    hash_index_clear(&lx->identifiers_index);
+    u32_list_clear(&lx->identifier_symbols);
+    free(lx->strings.data);
+    free(lx->string_hashes.data);
+    hash_index_clear(&lx->strings_index);
+    pyc_arena_free(&lx->string_arena);
+    free(lx->ints.data);
+    free(lx->floats.data);
+    hash_index_clear(&lx->ints_index);
+    hash_index_clear(&lx->floats_index);
+    free(lx->big_ints.data);
+    char_list_clear(&lx->stream_buffer);
+    free(lx->stream_held.data);
+    lx->stream_held = (tokens) vec();
+    free(lx->stream_fstrings.data);
+    lx->stream_fstrings = (fstrings) vec();
+    lx->streaming = false;
+}
+
+pyc_constants pyc_lex_constants(pyc_lexer* lx) {
+    return (pyc_constants){
+        .ints = lx->ints.data,
+        .int_count = lx->ints.size,
+        .floats = lx->floats.data,
+        .float_count = lx->floats.size,
+        .big_ints = lx->big_ints.data,
+        .big_int_count = lx->big_ints.size,
+        .identifiers = lx->identifiers.data,
+        .identifier_count = lx->identifiers.size,
+        .identifier_symbols = lx->interner == NULL ? NULL : lx->identifier_symbols.data,
+        .strings = lx->strings.data,
+        .string_hashes = lx->string_hashes.data,
+        .string_count = lx->strings.size
+    };
+}
+
+// the bytes go to the string arena, so the entry doesn't depend on where they came from
+static code_substr copy_substr(pyc_lexer* lx, code_substr sub) {
+    size_t len = sub.end - sub.start;
+    char* bytes = pyc_arena_bytes(&lx->string_arena, len);
+    memcpy(bytes, sub.code + sub.start, len);
+    return (code_substr){.code = bytes, .start = 0, .end = len};
+}
+
+static void index_entry(hash_index* index, uint64_t hash, size_t i) {
+    hash_index_reserve(index, i + 1);
+    hash_slot* slot = hash_index_first(index, hash);
+    while (slot->index != 0) slot = hash_index_next(index, slot);
+    hash_index_insert(index, slot, hash, i);
+}
+
+void pyc_lex_load_constants(pyc_lexer* lx, pyc_constants c) {
+    u64_list_reserve(&lx->ints, c.int_count);
+    for (size_t i = 0; i < c.int_count; i++) {
+        lx->ints.data[i] = c.ints[i];
+        index_entry(&lx->ints_index, pyc_hash_u64(c.ints[i]), i);
+    }
+    lx->ints.size = c.int_count;
+
+    f64_list_reserve(&lx->floats, c.float_count);
+    for (size_t i = 0; i < c.float_count; i++) {
+        uint64_t bits;
+        memcpy(&bits, &c.floats[i], sizeof(bits));
+        lx->floats.data[i] = c.floats[i];
+        index_entry(&lx->floats_index, pyc_hash_u64(bits), i);
+    }
+    lx->floats.size = c.float_count;
+
+    code_substrs_reserve(&lx->identifiers, c.identifier_count);
+    for (size_t i = 0; i < c.identifier_count; i++) {
+        code_substr sub = copy_substr(lx, c.identifiers[i]);
+        lx->identifiers.data[i] = sub;
+        index_entry(&lx->identifiers_index, pyc_hash_bytes(sub.code, sub.end), i);
+    }
+    lx->identifiers.size = c.identifier_count;
+
+    code_substrs_reserve(&lx->strings, c.string_count);
+    u64_list_reserve(&lx->string_hashes, c.string_count);
+    for (size_t i = 0; i < c.string_count; i++) {
+        lx->strings.data[i] = copy_substr(lx, c.strings[i]);
+        lx->string_hashes.data[i] = c.string_hashes[i];
+        index_entry(&lx->strings_index, c.string_hashes[i], i);
+    }
+    lx->strings.size = lx->string_hashes.size = c.string_count;
+
+    code_substrs_reserve(&lx->big_ints, c.big_int_count);
+    for (size_t i = 0; i < c.big_int_count; i++) lx->big_ints.data[i] = copy_substr(lx, c.big_ints[i]);
+    lx->big_ints.size = c.big_int_count;
 }
 
-size_t temp_identifiers_introduce(size_t start, size_t end) {
+// Fills the kind array and the lookahead tables, in one pass from the back so the next tokens are always known.
+static void index_tokens(pyc_lexer* lx) {
+    size_t n = lx->tokens.size;
+    u16_list_reserve(&lx->kinds, n);
+    for (size_t i = 0; i < n; i++) lx->kinds.data[i] = token_kind(lx->tokens.data[i].type);
+    lx->kinds.size = n;
+
+    u32_list_reserve(&lx->groups, n + 1);
+    u32_list_reserve(&lx->next_stop, n + 1);
+    u32_list_reserve(&lx->next_newline, n + 1);
+    u32_list_reserve(&lx->next_colon, n + 1);
+    uint32_t* groups = lx->groups.data;
+    uint32_t *stop = lx->next_stop.data, *newline = lx->next_newline.data, *colon = lx->next_colon.data;
+    groups[n] = stop[n] = newline[n] = colon[n] = n;
+
+    // the closing brackets of the pairs around the current token, a closing bracket without a partner on the
+    // left stays on it and ends the lookahead of every token before it
+    u32_list closes;
+    u32_list_init(&closes);
+    for (size_t i = n; i-- > 0;) {
+        uint16_t kind = lx->kinds.data[i];
+        uint32_t around = closes.size > 0 ? *u32_list_back(closes) : n;
+
+        groups[i] = around;
+        if (token_kind_is_open(kind)) {
+            if (closes.size > 0) closes.size--;
+        } else if (token_kind_is_close(kind)) u32_list_push(&closes, i);
+
+        stop[i] = token_kind_is_stop(kind) ? i : stop[i + 1];
+        newline[i] = kind == TOKEN_LINE_BREAK_NEWLINE ? i : newline[i + 1];
+        colon[i] = kind == TOKEN_SYMBOL_COLON ? i : colon[i + 1];
+    }
+    u32_list_clear(&closes);
+
+    lx->groups.size = lx->next_stop.size = lx->next_newline.size = lx->next_colon.size = n;
+}
+
+// the pools are shared by every file loaded through the global lexer
+void pyc_lexer_init_len(char* code, size_t len) {
+    pyc_lexer* lx = &pyc_global_lexer;
+    lx->code = code;
+    lx->ci = 0;
+    lx->code_len = len;
+    lx->lines.size = 0;
+    tokens_init(&lx->tokens);
+}
+
+void pyc_lexer_init(char* code) { pyc_lexer_init_len(code, strlen(code)); }
+
+static size_t temp_identifiers_introduce(pyc_lexer* lx, size_t start, size_t end) {
     size_t len = end - start;
-    for (size_t i = 0; i < pyc_temp_identifiers.size; i++) {
-        code_substr ex = pyc_temp_identifiers.data[i];
-        if (ex.start == start) return i;
-        if (end - start == ex.end - ex.start) {
-            char* p1 = pyc_code + start;
-            char* p2 = ex.code + ex.start;
-            for (size_t j = 0; j < len; j++) {
-                if (*p1++ != *p2++) break;
-                if (j == len - 1) return i;
-            }
-        }
+    char* word = lx->code + start;
+    uint64_t hash = pyc_hash_bytes(word, len);
+
+    if (lx->identifiers.size >= TOKEN_MAX_PAYLOAD) pyc_lex_error(lx, start, "OverflowError: too many identifiers", false);
+    hash_index_reserve(&lx->identifiers_index, lx->identifiers.size + 1);
+    hash_slot* slot = hash_index_first(&lx->identifiers_index, hash);
+    for (; slot->index != 0; slot = hash_index_next(&lx->identifiers_index, slot)) {
+        if (slot->hash != hash) continue;
+        code_substr ex = lx->identifiers.data[slot->index - 1];
+        if (ex.end - ex.start != len || memcmp(ex.code + ex.start, word, len) != 0) continue;
+        return lx->interner == NULL ? slot->index - 1 : lx->identifier_symbols.data[slot->index - 1];
     }
 
-    code_substrs_push(&pyc_temp_identifiers, (code_substr){.code = pyc_code, .start = start, .end = end});
-    return pyc_temp_identifiers.size - 1;
+    // the streaming buffer gets overwritten, so the identifier has to own its bytes
+    code_substr sub = lx->streaming
+                          ? (code_substr){.code = strndup(word, len), .start = 0, .end = len}
+                          : (code_substr){.code = lx->code, .start = start, .end = end};
+    code_substrs_push(&lx->identifiers, sub);
+    hash_index_insert(&lx->identifiers_index, slot, hash, lx->identifiers.size - 1);
+    if (lx->interner == NULL) return lx->identifiers.size - 1;
+
+    uint32_t id = pyc_intern_hashed(lx->interner, word, len, hash);
+    if (id >= TOKEN_MAX_PAYLOAD) pyc_lex_error(lx, start, "OverflowError: too many identifiers", false);
+    u32_list_push(&lx->identifier_symbols, id);
+    return id;
 }
 
-size_t temp_ints_introduce(uint64_t x) {
-    for (size_t i = 0; i < pyc_temp_ints.size; i++) { if (pyc_temp_ints.data[i] == x) return i; }
+static size_t temp_ints_introduce(pyc_lexer* lx, uint64_t x) {
+    uint64_t hash = pyc_hash_u64(x);
+    hash_index_reserve(&lx->ints_index, lx->ints.size + 1);
+    hash_slot* slot = hash_index_first(&lx->ints_index, hash);
+    for (; slot->index != 0; slot = hash_index_next(&lx->ints_index, slot)) {
+        if (slot->hash == hash && lx->ints.data[slot->index - 1] == x) return slot->index - 1;
+    }
 
-    u64_list_push(&pyc_temp_ints, x);
-    return pyc_temp_ints.size - 1;
+    if (lx->ints.size >= TOKEN_MAX_PAYLOAD) pyc_lex_error(lx, lx->ci, "OverflowError: too many integer constants", false);
+    u64_list_push(&lx->ints, x);
+    hash_index_insert(&lx->ints_index, slot, hash, lx->ints.size - 1);
+    return lx->ints.size - 1;
 }
 
-size_t temp_floats_introduce(double x) {
-    for (size_t i = 0; i < pyc_temp_floats.size; i++) { if (pyc_temp_floats.data[i] == x) return i; }
+// keyed by the bit pattern, so 0.0 and -0.0 are different constants and a NaN finds itself
+static size_t temp_floats_introduce(pyc_lexer* lx, double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    uint64_t hash = pyc_hash_u64(bits);
+    hash_index_reserve(&lx->floats_index, lx->floats.size + 1);
+    hash_slot* slot = hash_index_first(&lx->floats_index, hash);
+    for (; slot->index != 0; slot = hash_index_next(&lx->floats_index, slot)) {
+        if (slot->hash == hash && memcmp(&lx->floats.data[slot->index - 1], &bits, sizeof(bits)) == 0) {
+            return slot->index - 1;
+        }
+    }
 
-    f64_list_push(&pyc_temp_floats, x);
-    return pyc_temp_floats.size - 1;
+    if (lx->floats.size >= TOKEN_MAX_PAYLOAD) pyc_lex_error(lx, lx->ci, "OverflowError: too many float constants", false);
+    f64_list_push(&lx->floats, x);
+    hash_index_insert(&lx->floats_index, slot, hash, lx->floats.size - 1);
+    return lx->floats.size - 1;
+}
+
+// Integer literals that don't fit in 64 bits are kept as they were written, prefix and '_' included.
+static size_t temp_big_ints_introduce(pyc_lexer* lx, size_t start, size_t end) {
+    if (lx->big_ints.size >= TOKEN_MAX_PAYLOAD) pyc_lex_error(lx, start, "OverflowError: too many integer constants", false);
+    code_substr sub = lx->streaming
+                          ? (code_substr){.code = strndup(lx->code + start, end - start), .start = 0, .end = end - start}
+                          : (code_substr){.code = lx->code, .start = start, .end = end};
+    code_substrs_push(&lx->big_ints, sub);
+    return lx->big_ints.size - 1;
 }
 
 void pyc_load(char* code, tokens tokens) {
     pyc_code = code;
     pyc_code_len = strlen(code);
-    pyc_ti = 0;
+    pyc_global_lexer.lines.size = 0;
     pyc_tokens = tokens;
+    index_tokens(&pyc_global_lexer);
 }
 
-bool str_ind_eq(size_t start, size_t end, char* target) {
+bool pyc_lex_str_eq(pyc_lexer* lx, size_t start, size_t end, char* target) {
     size_t len = end - start;
     if (len != strlen(target)) return 0;
-    return strncmp(pyc_code + start, target, len) == 0;
+    return strncmp(lx->code + start, target, len) == 0;
 }
 
+bool str_ind_eq(size_t start, size_t end, char* target) { return pyc_lex_str_eq(&pyc_global_lexer, start, end, target); }
+
 char* str_ind_dup(size_t start, size_t end) { return strndup(pyc_code + start, end - start); }
 
 char* str_tok_dup(token t) { return strndup(pyc_code + t.start, t.end - t.start); }
 
-size_t match_symbol(size_t i, size_t len, char** matched) {
-    for (size_t s = 0; s < symbols_count; s++) {
-        size_t sLen = strlen(symbols[s]);
-        if (i + sLen <= len && str_ind_eq(i, i + sLen, symbols[s])) {
-            *matched = (char*)symbols[s];
-            return s;
+#define word_is(w, lit) (memcmp(w, lit, sizeof(lit) - 1) == 0)
+
+// Classifies a word in place without copying it, returns TOKEN_IDENTIFIER if it is not reserved.
+static size_t classify_word(const char* w, size_t len) {
+    switch (len) {
+    case 2:
+        switch (w[0]) {
+        case 'i':
+            if (w[1] == 'f') return TOKEN_KEYWORD_IF;
+            if (w[1] == 'n') return TOKEN_OPERATOR_IN;
+            if (w[1] == 's') return TOKEN_OPERATOR_IS;
+            break;
+        case 'a':
+            if (w[1] == 's') return TOKEN_KEYWORD_AS;
+            break;
+        case 'o':
+            if (w[1] == 'r') return TOKEN_OPERATOR_OR;
+            break;
         }
+        break;
+    case 3:
+        switch (w[0]) {
+        case 'f':
+            if (word_is(w, "for")) return TOKEN_KEYWORD_FOR;
+            break;
+        case 'd':
+            if (word_is(w, "def")) return TOKEN_KEYWORD_DEF;
+            if (word_is(w, "del")) return TOKEN_KEYWORD_DEL;
+            break;
+        case 't':
+            if (word_is(w, "try")) return TOKEN_KEYWORD_TRY;
+            break;
+        case 'n':
+            if (word_is(w, "not")) return TOKEN_OPERATOR_NOT;
+            break;
+        case 'a':
+            if (word_is(w, "and")) return TOKEN_OPERATOR_AND;
+            break;
+        }
+        break;
+    case 4:
+        switch (w[0]) {
+        case 'e':
+            if (word_is(w, "else")) return TOKEN_KEYWORD_ELSE;
+            if (word_is(w, "elif")) return TOKEN_KEYWORD_ELIF;
+            break;
+        case 't':
+            if (word_is(w, "type")) return TOKEN_KEYWORD_CLASS;
+            break;
+        case 'f':
+            if (word_is(w, "from")) return TOKEN_KEYWORD_FROM;
+            break;
+        case 'w':
+            if (word_is(w, "with")) return TOKEN_KEYWORD_WITH;
+            break;
+        case 'p':
+            if (word_is(w, "pass")) return TOKEN_KEYWORD_PASS;
+            break;
+        case 'c':
+            if (word_is(w, "case")) return TOKEN_KEYWORD_CASE;
+            break;
+        case 'T':
+            if (word_is(w, "True")) return TOKEN_BOOLEAN_TRUE;
+            break;
+        case 'N':
+            if (word_is(w, "None")) return TOKEN_NONE;
+            break;
+        }
+        break;
+    case 5:
+        switch (w[0]) {
+        case 'w':
+            if (word_is(w, "while")) return TOKEN_KEYWORD_WHILE;
+            break;
+        case 'r':
+            if (word_is(w, "raise")) return TOKEN_KEYWORD_RAISE;
+            break;
+        case 'b':
+            if (word_is(w, "break")) return TOKEN_KEYWORD_BREAK;
+            break;
+        case 'y':
+            if (word_is(w, "yield")) return TOKEN_KEYWORD_YIELD;
+            break;
+        case 'a':
+            if (word_is(w, "async")) return TOKEN_KEYWORD_ASYNC;
+            if (word_is(w, "await")) return TOKEN_KEYWORD_AWAIT;
+            break;
+        case 'm':
+            if (word_is(w, "match")) return TOKEN_KEYWORD_MATCH;
+            break;
+        case 'F':
+            if (word_is(w, "False")) return TOKEN_BOOLEAN_FALSE;
+            break;
+        }
+        break;
+    case 6:
+        switch (w[0]) {
+        case 'r':
+            if (word_is(w, "return")) return TOKEN_KEYWORD_RETURN;
+            break;
+        case 'i':
+            if (word_is(w, "import")) return TOKEN_KEYWORD_IMPORT;
+            break;
+        case 'e':
+            if (word_is(w, "except")) return TOKEN_KEYWORD_EXCEPT;
+            break;
+        case 'l':
+            if (word_is(w, "lambda")) return TOKEN_KEYWORD_LAMBDA;
+            break;
+        case 'g':
+            if (word_is(w, "global")) return TOKEN_KEYWORD_GLOBAL;
+            break;
+        case 'a':
+            if (word_is(w, "assert")) return TOKEN_KEYWORD_ASSERT;
+            break;
+        }
+        break;
+    case 7:
+        if (word_is(w, "finally")) return TOKEN_KEYWORD_FINALLY;
+        break;
+    case 8:
+        if (word_is(w, "continue")) return TOKEN_KEYWORD_CONTINUE;
+        if (word_is(w, "nonlocal")) return TOKEN_KEYWORD_NONLOCAL;
+        break;
     }
-    return -1;
+
+    return TOKEN_IDENTIFIER;
 }
 
-typedef struct {
-    bool is_triple;
-    char quote;
-    token tok;
-    int open;
-} fstring;
+#define symbol_2(ch, type2, type1) (n1 == (ch) ? (*len = 2, (type2)) : (*len = 1, (type1)))
+
+// Matches the longest symbol at i, returns its token type or -1 with *len set to the symbol length.
+static size_t match_symbol(pyc_lexer* lx, size_t i, size_t* len) {
+    char c = lx->code[i];
+    char n1 = i + 1 < lx->code_len ? lx->code[i + 1] : '\0';
+    char n2 = i + 2 < lx->code_len ? lx->code[i + 2] : '\0';
+
+    switch (c) {
+    case '=':
+        return symbol_2('=', TOKEN_OPERATOR_EQ, TOKEN_SET_OPERATOR_EQ);
+    case '+':
+        return symbol_2('=', TOKEN_SET_OPERATOR_ADD, TOKEN_OPERATOR_ADD);
+    case '-':
+        return symbol_2('=', TOKEN_SET_OPERATOR_SUB, TOKEN_OPERATOR_SUB);
+    case '%':
+        return symbol_2('=', TOKEN_SET_OPERATOR_MOD, TOKEN_OPERATOR_MOD);
+    case '&':
+        return symbol_2('=', TOKEN_SET_OPERATOR_BIT_AND, TOKEN_OPERATOR_BIT_AND);
+    case '|':
+        return symbol_2('=', TOKEN_SET_OPERATOR_BIT_OR, TOKEN_OPERATOR_BIT_OR);
+    case '^':
+        return symbol_2('=', TOKEN_SET_OPERATOR_XOR, TOKEN_OPERATOR_BIT_XOR);
+    case '@':
+        return symbol_2('=', TOKEN_SET_OPERATOR_MAT_MUL, TOKEN_OPERATOR_MAT_MUL);
+    case '!':
+        return symbol_2('=', TOKEN_OPERATOR_NEQ, TOKEN_SYMBOL_EXC);
+    case ':':
+        return symbol_2('=', TOKEN_OPERATOR_WALRUS, TOKEN_SYMBOL_COLON);
+    case '*':
+        if (n1 == '*') return n2 == '=' ? (*len = 3, TOKEN_SET_OPERATOR_POW) : (*len = 2, TOKEN_OPERATOR_POW);
+        return symbol_2('=', TOKEN_SET_OPERATOR_MUL, TOKEN_OPERATOR_MUL);
+    case '/':
+        if (n1 == '/') return n2 == '=' ? (*len = 3, TOKEN_SET_OPERATOR_FDIV) : (*len = 2, TOKEN_OPERATOR_FDIV);
+        return symbol_2('=', TOKEN_SET_OPERATOR_DIV, TOKEN_OPERATOR_DIV);
+    case '<':
+        if (n1 == '<') return n2 == '=' ? (*len = 3, TOKEN_SET_OPERATOR_LSH) : (*len = 2, TOKEN_OPERATOR_LSH);
+        return symbol_2('=', TOKEN_OPERATOR_LTE, TOKEN_OPERATOR_LT);
+    case '>':
+        if (n1 == '>') return n2 == '=' ? (*len = 3, TOKEN_SET_OPERATOR_RSH) : (*len = 2, TOKEN_OPERATOR_RSH);
+        return symbol_2('=', TOKEN_OPERATOR_GTE, TOKEN_OPERATOR_GT);
+    case '~':
+        *len = 1;
+        return TOKEN_OPERATOR_BIT_NOT;
+    case '(':
+        *len = 1;
+        return TOKEN_SYMBOL_LPAREN;
+    case ')':
+        *len = 1;
+        return TOKEN_SYMBOL_RPAREN;
+    case '[':
+        *len = 1;
+        return TOKEN_SYMBOL_LBRACKET;
+    case ']':
+        *len = 1;
+        return TOKEN_SYMBOL_RBRACKET;
+    case '{':
+        *len = 1;
+        return TOKEN_SYMBOL_LBRACE;
+    case '}':
+        *len = 1;
+        return TOKEN_SYMBOL_RBRACE;
+    case ',':
+        *len = 1;
+        return TOKEN_SYMBOL_COMMA;
+    case '.':
+        *len = 1;
+        return TOKEN_SYMBOL_DOT;
+    default:
+        return -1;
+    }
+}
 
-vec_define_pyc(fstring, fstrings, fstring)
+static inline unsigned digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return 255;
+}
 
-inline void fstring_free(fstring t) {
+static size_t utf8_encode(uint32_t cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = (char) cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char) (0xC0 | cp >> 6);
+        out[1] = (char) (0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char) (0xE0 | cp >> 12);
+        out[1] = (char) (0x80 | (cp >> 6 & 0x3F));
+        out[2] = (char) (0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char) (0xF0 | cp >> 18);
+    out[1] = (char) (0x80 | (cp >> 12 & 0x3F));
+    out[2] = (char) (0x80 | (cp >> 6 & 0x3F));
+    out[3] = (char) (0x80 | (cp & 0x3F));
+    return 4;
 }
 
-void pyc_feed() {
-    // TODO: re-implement the tokenizer to allow live-streaming data
+// Reads exactly n hex digits at i, the escape is an error otherwise.
+static uint32_t decode_hex_escape(pyc_lexer* lx, size_t i, size_t end, size_t n) {
+    uint32_t cp = 0;
+    for (size_t k = 0; k < n; k++) {
+        unsigned d = i + k < end ? digit_value(lx->code[i + k]) : 255;
+        if (d >= 16) pyc_lex_error(lx, i - 2, "SyntaxError: (unicode error) truncated escape sequence", false);
+        cp = cp << 4 | d;
+    }
+    return cp;
 }
 
-#include <stdlib.h>
-#include <stdbool.h>
+// Decodes the string literal body in [start, end) to out, which has to be at least end - start bytes long as no
+// escape decodes to more bytes than it is written with. Newlines are normalized to '\n'. Bytes literals keep \u,
+// \U and \N as they are, \N{...} is kept in str literals too since there is no name database.
+static size_t decode_string(pyc_lexer* lx, size_t start, size_t end, bool raw, bool binary, bool fstring_part,
+                            char* out) {
+    char* s = lx->code;
+    size_t n = 0;
+
+    for (size_t i = start; i < end;) {
+        char c = s[i];
+
+        if (c == '\r') {
+            out[n++] = '\n';
+            i += i + 1 < end && s[i + 1] == '\n' ? 2 : 1;
+            continue;
+        }
+
+        if (fstring_part && (c == '{' || c == '}') && i + 1 < end && s[i + 1] == c) {
+            out[n++] = c;
+            i += 2;
+            continue;
+        }
 
-bool extract_number(size_t start, size_t end, size_t exp_index, bool is_float, uint64_t* out) {
+        if (c != '\\' || raw || i + 1 >= end) {
+            out[n++] = c;
+            i++;
+            continue;
+        }
+
+        char e = s[i + 1];
+        i += 2;
+        switch (e) {
+        case '\n':
+            break;
+        case '\r':
+            if (i < end && s[i] == '\n') i++;
+            break;
+        case '\\':
+        case '\'':
+        case '"':
+            out[n++] = e;
+            break;
+        case 'a':
+            out[n++] = '\a';
+            break;
+        case 'b':
+            out[n++] = '\b';
+            break;
+        case 'f':
+            out[n++] = '\f';
+            break;
+        case 'n':
+            out[n++] = '\n';
+            break;
+        case 'r':
+            out[n++] = '\r';
+            break;
+        case 't':
+            out[n++] = '\t';
+            break;
+        case 'v':
+            out[n++] = '\v';
+            break;
+        case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': {
+            uint32_t cp = e - '0';
+            for (size_t k = 0; k < 2 && i < end && s[i] >= '0' && s[i] <= '7'; k++) cp = cp << 3 | (s[i++] - '0');
+            if (binary) out[n++] = (char) (cp & 0xFF);
+            else n += utf8_encode(cp, out + n);
+            break;
+        }
+        case 'x': {
+            uint32_t cp = decode_hex_escape(lx, i, end, 2);
+            i += 2;
+            if (binary) out[n++] = (char) cp;
+            else n += utf8_encode(cp, out + n);
+            break;
+        }
+        case 'u':
+        case 'U': {
+            if (binary) {
+                out[n++] = '\\';
+                out[n++] = e;
+                break;
+            }
+            size_t digits = e == 'u' ? 4 : 8;
+            uint32_t cp = decode_hex_escape(lx, i, end, digits);
+            if (cp > 0x10FFFF) pyc_lex_error(lx, i - 2, "SyntaxError: (unicode error) illegal Unicode character", false);
+            i += digits;
+            n += utf8_encode(cp, out + n);
+            break;
+        }
+        default:
+            // unknown escapes stay as they are
+            out[n++] = '\\';
+            out[n++] = e;
+            break;
+        }
+    }
+
+    return n;
+}
+
+// Decodes the body of a string literal once and interns it. A body that decodes to itself is referenced in place,
+// others are copied to the string arena. Bytes and str literals with the same contents are separate constants.
+static size_t temp_strings_introduce(pyc_lexer* lx, size_t start, size_t end, bool raw, bool binary,
+                                     bool fstring_part) {
+    if (end < start) end = start;
     size_t len = end - start;
-    char* buf = malloc(len + 1);
-    if (!buf) return false;
-    memcpy(buf, pyc_code + start, len);
-    buf[len] = '\0';
-
-    size_t offset = 0;
-    for (size_t i = 0; i < len; i++) {
-        if (buf[i] == '_') {
-            offset++;
+    char* body = lx->code + start;
+
+    bool plain = memchr(body, '\r', len) == NULL && (raw || memchr(body, '\\', len) == NULL) &&
+                 (!fstring_part || memchr(body, '}', len) == NULL);
+    if (fstring_part && plain) {
+        // the lexer already stopped at every single '{', so only "{{" is left
+        plain = memchr(body, '{', len) == NULL;
+    }
+
+    char* text = body;
+    if (!plain || lx->streaming) {
+        text = pyc_arena_bytes(&lx->string_arena, len);
+        size_t reserved = len;
+        len = plain ? (memcpy(text, body, len), len) : decode_string(lx, start, end, raw, binary, fstring_part, text);
+        // decoding never grows a string, what it didn't use goes back to the arena
+        pyc_arena_unwind(&lx->string_arena, text + len, reserved - len);
+    }
+
+    uint64_t hash = pyc_hash_bytes(text, len) ^ (binary ? 0x5BD1E9955BD1E995ull : 0);
+    hash_index_reserve(&lx->strings_index, lx->strings.size + 1);
+    hash_slot* slot = hash_index_first(&lx->strings_index, hash);
+    for (; slot->index != 0; slot = hash_index_next(&lx->strings_index, slot)) {
+        if (lx->string_hashes.data[slot->index - 1] != hash) continue;
+        code_substr ex = lx->strings.data[slot->index - 1];
+        if (ex.end - ex.start != len || memcmp(ex.code + ex.start, text, len) != 0) continue;
+
+        if (text != body) pyc_arena_unwind(&lx->string_arena, text, len);
+        return slot->index - 1;
+    }
+
+    if (lx->strings.size >= TOKEN_MAX_STRING_PAYLOAD) pyc_lex_error(lx, start, "OverflowError: too many string constants", false);
+    code_substr sub = text == body
+                          ? (code_substr){.code = lx->code, .start = start, .end = start + len}
+                          : (code_substr){.code = text, .start = 0, .end = len};
+    code_substrs_push(&lx->strings, sub);
+    u64_list_push(&lx->string_hashes, hash);
+    hash_index_insert(&lx->strings_index, slot, hash, lx->strings.size - 1);
+    return lx->strings.size - 1;
+}
+
+inline void fstring_free(fstring t) {
+}
+
+// Skips digits of the given base with single '_' separators between them, returns false if there are none or a '_'
+// is not followed by a digit.
+static bool skip_digits(pyc_lexer* lx, unsigned base) {
+    size_t start = lx->ci;
+    while (lx->ci < lx->code_len) {
+        char c = lx->code[lx->ci];
+        if (c == '_') {
+            if (lx->ci + 1 >= lx->code_len || digit_value(lx->code[lx->ci + 1]) >= base) return false;
+            lx->ci++;
             continue;
         }
+        if (digit_value(c) >= base) break;
+        lx->ci++;
+    }
+
+    return lx->ci > start;
+}
 
-        buf[i - offset] = buf[i];
+// Scans the numeric literal at lx->ci and parses its value straight from the source.
+static void lex_number(pyc_lexer* lx, token* tok) {
+    char* s = lx->code;
+    size_t start = tok->start = lx->ci;
+    char prefix = start + 1 < lx->code_len ? s[start + 1] | 0x20 : '\0';
+
+    if (s[start] == '0' && (prefix == 'x' || prefix == 'o' || prefix == 'b')) {
+        unsigned base = prefix == 'x' ? 16 : prefix == 'o' ? 8 : 2;
+        char* err = base == 16 ? "SyntaxError: invalid hexadecimal literal"
+                    : base == 8 ? "SyntaxError: invalid octal literal"
+                    : "SyntaxError: invalid binary literal";
+        lx->ci += 2;
+        // a '_' may follow the prefix
+        if (lx->ci < lx->code_len && s[lx->ci] == '_') lx->ci++;
+        if (!skip_digits(lx, base) || (lx->ci < lx->code_len && is_digit(s[lx->ci]))) pyc_lex_error(lx, lx->ci, err, false);
+
+        tok->end = lx->ci;
+        uint64_t value;
+        if (pyc_parse_uint(s + start + 2, tok->end - start - 2, base, &value)) {
+            tok->type = TOKEN_INTEGER | temp_ints_introduce(lx, value) << 4;
+        } else tok->type = TOKEN_BIG_INTEGER | temp_big_ints_introduce(lx, start, tok->end) << 4;
+        return;
     }
 
-    buf[len - offset] = '\0';
+    bool is_float = false;
+    if (s[start] != '.' && !skip_digits(lx, 10)) pyc_lex_error(lx, lx->ci, "SyntaxError: invalid decimal literal", false);
+
+    if (lx->ci < lx->code_len && s[lx->ci] == '.') {
+        is_float = true;
+        lx->ci++;
+        if (lx->ci < lx->code_len && (s[lx->ci] == '_' || (is_digit(s[lx->ci]) && !skip_digits(lx, 10)))) {
+            pyc_lex_error(lx, lx->ci, "SyntaxError: invalid decimal literal", false);
+        }
+    }
 
-    int base = 10;
-    if (len > 2 && buf[0] == '0') {
-        if (buf[1] == 'x' || buf[1] == 'X') base = 16;
-        else if (buf[1] == 'o' || buf[1] == 'O') base = 8;
-        else if (buf[1] == 'b' || buf[1] == 'B') base = 2;
+    if (lx->ci < lx->code_len && (s[lx->ci] | 0x20) == 'e') {
+        size_t e = lx->ci + 1;
+        if (e < lx->code_len && (s[e] == '+' || s[e] == '-')) e++;
+        if (e >= lx->code_len || !is_digit(s[e])) pyc_lex_error(lx, e, "SyntaxError: invalid decimal literal", false);
+        lx->ci = e;
+        if (!skip_digits(lx, 10)) pyc_lex_error(lx, lx->ci, "SyntaxError: invalid decimal literal", false);
+        is_float = true;
     }
 
+    tok->end = lx->ci;
+    size_t len = tok->end - start;
+
     if (is_float) {
-        if (base != 10) { raise_error_i(start, "SyntaxError: invalid float literal with base other than 10", false); }
-        char* end_ptr;
-        union {
-            double d;
-            uint64_t u;
-        } r;
-        r.d = strtod(buf, &end_ptr);
-        *out = r.u;
-        bool success = *end_ptr == '\0';
-        free(buf);
-        return success;
-    }
-
-    char* end_ptr;
-    *out = strtol(buf, &end_ptr, base);
-    bool success = *end_ptr == '\0' || (*end_ptr == 'L' && end_ptr[1] == '\0');
-    free(buf);
-    return success;
+        tok->type = TOKEN_FLOAT | temp_floats_introduce(lx, pyc_parse_float(s + start, len)) << 4;
+        return;
+    }
+
+    if (s[start] == '0') {
+        for (size_t i = start; i < tok->end; i++) {
+            if (s[i] != '0' && s[i] != '_') {
+                pyc_lex_error(lx, start, "SyntaxError: leading zeros in decimal integer literals "
+                              "are not permitted; use an 0o prefix for octal integers", false);
+            }
+        }
+    }
+
+    uint64_t value;
+    if (pyc_parse_uint(s + start, len, 10, &value)) tok->type = TOKEN_INTEGER | temp_ints_introduce(lx, value) << 4;
+    else tok->type = TOKEN_BIG_INTEGER | temp_big_ints_introduce(lx, start, tok->end) << 4;
 }
 
-void pyc_tokenize() {
-    fstrings fstrings;
-    fstrings_init(&fstrings);
+static void reset_indents(pyc_lexer* lx) {
+    lx->indents.size = 0;
+    indent_levels_push(&lx->indents, (indent_level){0, 0});
+    lx->depth = 0;
+    lx->line_start = true;
+}
+
+#define indent_error(lx, i) pyc_lex_error(lx, i, "TabError: inconsistent use of tabs and spaces in indentation", false)
+
+// Measures the indentation of the line that starts at begin and has its first token at lx->ci, and emits the
+// INDENT or DEDENT tokens for it. Works like the tokenizer of CPython, including which mixes of tabs and spaces are
+// errors.
+static void indent_line(pyc_lexer* lx, size_t begin) {
+    size_t col = 0, alt_col = 0;
+    for (size_t i = begin; i < lx->ci; i++) {
+        char c = lx->code[i];
+        if (c == ' ') {
+            col++;
+            alt_col++;
+        } else if (c == '\t') {
+            col = (col / 8 + 1) * 8;
+            alt_col++;
+        } else if (c != '\r') col = alt_col = 0;
+    }
+
+    indent_level top = *indent_levels_back(lx->indents);
+    token tok = {.start = lx->ci, .end = lx->ci};
+
+    if (col == top.col) {
+        if (alt_col != top.alt_col) indent_error(lx, lx->ci);
+    } else if (col > top.col) {
+        if (alt_col <= top.alt_col) indent_error(lx, lx->ci);
+        if (lx->indents.size > PYC_MAX_INDENT) {
+            pyc_lex_error(lx, lx->ci, "IndentationError: too many levels of indentation", false);
+        }
+
+        indent_levels_push(&lx->indents, (indent_level){col, alt_col});
+        tok.start = begin;
+        tok.type = TOKEN_LINE_BREAK_INDENT;
+        tokens_push(&lx->tokens, tok);
+    } else {
+        tok.type = TOKEN_LINE_BREAK_DEDENT;
+        while (lx->indents.size > 1 && col < indent_levels_back(lx->indents)->col) {
+            lx->indents.size--;
+            tokens_push(&lx->tokens, tok);
+        }
+
+        top = *indent_levels_back(lx->indents);
+        if (col != top.col) {
+            pyc_lex_error(lx, lx->ci, "IndentationError: unindent does not match any outer indentation level", false);
+        }
+        if (alt_col != top.alt_col) indent_error(lx, lx->ci);
+    }
+}
+
+// The source is passed with an explicit length, so a NUL byte is just another byte the scanners stop at.
+// Returns the length of the identifier character at i, or 0 if there is none. ASCII is answered inline, anything
+// else is decoded and looked up as XID_Start or XID_Continue. Identifiers are compared by their bytes, they are not
+// NFKC normalized like CPython does.
+static inline size_t identifier_char(pyc_lexer* lx, size_t i, bool first) {
+    char c = lx->code[i];
+    if ((unsigned char) c < 0x80) return is_alpha(c) || c == '_' || (!first && is_digit(c));
+
+    uint32_t cp;
+    size_t n = pyc_utf8_decode(lx->code + i, lx->code_len - i, &cp);
+    if (n == 0) return 0;
+    return (first ? pyc_is_xid_start(cp) : pyc_is_xid_continue(cp)) ? n : 0;
+}
+
+static size_t skip_identifier(pyc_lexer* lx, size_t i) {
+    for (;;) {
+        i = scan_identifier(lx->code, i, lx->code_len);
+        if (i >= lx->code_len || (unsigned char) lx->code[i] < 0x80) return i;
+        size_t n = identifier_char(lx, i, false);
+        if (n == 0) return i;
+        i += n;
+    }
+}
+
+__THROWNL __attribute__((noreturn)) static void invalid_character_error(pyc_lexer* lx, size_t i) {
+    uint32_t cp = 0;
+    size_t n = pyc_utf8_decode(lx->code + i, lx->code_len - i, &cp);
+    char err[64];
+    snprintf(err, sizeof(err), "SyntaxError: invalid character '%.*s' (U+%04X)", (int) n, lx->code + i, cp);
+    pyc_lex_error(lx, i, err, false);
+}
+
+// Checks that lx->code[from, lx->code_len) is UTF-8, from has to be at the start of a character.
+static void validate_utf8(pyc_lexer* lx, size_t from) {
+    size_t i = scan_utf8(lx->code, from, lx->code_len);
+    if (i == lx->code_len) return;
+
+    char err[96];
+    snprintf(err, sizeof(err), "SyntaxError: 'utf-8' codec can't decode byte 0x%02x in position %zu",
+             (unsigned char) lx->code[i], lx->stream_base + i);
+    pyc_lex_error(lx, i, err, false);
+}
+
+#define null_byte_error(lx) pyc_lex_error(lx, (lx)->ci, "SyntaxError: source code cannot contain null bytes", false)
+
+// the blocks still open at the end of the source
+static void close_blocks(pyc_lexer* lx) {
+    token tok = {.type = TOKEN_LINE_BREAK_DEDENT, .start = lx->ci, .end = lx->ci};
+    for (; lx->indents.size > 1; lx->indents.size--) tokens_push(&lx->tokens, tok);
+}
+
+// Scans the body of a string from lx->ci up to its closing quote or, in an f-string, the '{' of a replacement field.
+// Returns false if the input ends first, s->slash then tells whether the scan stopped right after a backslash.
+static bool scan_string_body(pyc_lexer* lx, pyc_open_string* s, bool* has_format) {
+    char quote = s->quote;
+    bool slash = s->slash;
+
+    while (lx->ci < lx->code_len) {
+        if (!slash) {
+            lx->ci = scan_string(lx->code, lx->ci, lx->code_len, quote, s->is_fstring);
+            if (lx->ci >= lx->code_len) break;
+        }
 
-    while (pyc_ci < pyc_code_len) {
-        char c = pyc_code[pyc_ci];
+        char c = lx->code[lx->ci];
+        if (s->is_fstring && c == '{') {
+            if (lx->ci + 1 < lx->code_len && lx->code[lx->ci + 1] == '{') {
+                lx->ci += 2;
+                continue;
+            }
+
+            *has_format = true;
+            lx->ci++;
+            return true;
+        }
 
         if (c == '\r') {
-            pyc_ci++;
+            lx->ci++;
             continue;
         }
 
-        if (c == '#') {
-            while (pyc_ci < pyc_code_len && pyc_code[pyc_ci] != '\n') { pyc_ci++; }
+        if (c == '\0') null_byte_error(lx);
+
+        if (!slash && !s->is_triple && c == '\n') {
+            pyc_lex_error(lx, lx->ci, "SyntaxError: invalid syntax", !s->continued);
+        }
+
+        if (c == '\\') slash = !slash;
+        else if (!slash && c == quote) {
+            if (s->is_triple) {
+                if (lx->ci + 2 < lx->code_len && lx->code[lx->ci + 1] == quote && lx->code[lx->ci + 2] == quote) {
+                    lx->ci += 3;
+                    return true;
+                }
+            } else {
+                lx->ci++;
+                return true;
+            }
+        } else slash = false;
+
+        lx->ci++;
+    }
+
+    s->slash = slash;
+    return false;
+}
+
+// Lexes the rest of the string s from lx->ci and pushes its token. In partial mode returns false without a token if
+// the input ends in it.
+static bool lex_string(pyc_lexer* lx, pyc_open_string* s, fstrings* fstrings, bool partial) {
+    bool has_format = false;
+    bool done = scan_string_body(lx, s, &has_format);
+    if (!done && partial) return false;
+
+    size_t body_end = !done ? lx->ci : lx->ci - (has_format || !s->is_triple ? 1 : 3);
+    token tok;
+    tok.start = s->tok_start;
+
+    if (s->continued) {
+        fstring* opt = fstrings_back(*fstrings);
+        if (has_format) opt->open++;
+        size_t index = temp_strings_introduce(lx, s->start + 1, body_end, s->is_raw, false, true);
+
+        tok.end = lx->ci - (has_format ? 1 : s->is_triple ? 3 : 1);
+        tok.type = (has_format ? TOKEN_FSTRING_MIDDLE : TOKEN_FSTRING_END) | index << 4;
+        if (!has_format) fstrings_pop(fstrings);
+    } else {
+        size_t index = temp_strings_introduce(lx, s->start + (s->is_triple ? 3 : 1), body_end, s->is_raw,
+                                              s->is_binary, s->is_fstring);
+
+        tok.end = lx->ci - 1;
+        if (has_format) {
+            tok.type = TOKEN_FSTRING_START | (s->is_raw ? 0x10 : 0) | index << 5;
+            fstring opt = {.is_triple = s->is_triple, .is_raw = s->is_raw, .quote = s->quote, .tok = tok, .open = 1};
+            fstrings_push(fstrings, opt);
+        } else {
+            // ((x >> 4) & 0b111) of a string token, see src/lexer.h
+            int flag = s->is_fstring ? (s->is_raw ? 0x50 : 0x10)
+                                     : s->is_binary ? (s->is_raw ? 0x40 : 0x30)
+                                     : s->is_raw ? 0x20 : 0;
+            tok.type = TOKEN_STRING | flag | index << 7;
+        }
+    }
 
+    tokens_push(&lx->tokens, tok);
+    return true;
+}
+
+static void stream_unpause(pyc_lexer* lx) {
+    lx->stream_paused = false;
+    lx->stream_held.size = 0;
+}
+
+// Stops a partial tokenize in a string or an f-string. The tokens after the safe point are moved to stream_held and
+// lx->ci goes back to it, the rest of the state stays as it is for the next call to go on with.
+static bool stream_pause(pyc_lexer* lx, size_t safe_ci, size_t safe_tok, pyc_open_string* s) {
+    lx->stream_paused = true;
+    lx->stream_resume = lx->ci;
+    lx->stream_string = s != NULL ? *s : (pyc_open_string){0};
+    lx->stream_string.open = s != NULL;
+
+    if (safe_tok == 0) {
+        // a long f-string holds back more and more tokens, they are swapped instead of copied on every feed
+        tokens t = lx->stream_held;
+        lx->stream_held = lx->tokens;
+        lx->tokens = t;
+    } else if (lx->tokens.size > safe_tok) {
+        tokens_reserve(&lx->stream_held, lx->tokens.size - safe_tok);
+        memcpy(lx->stream_held.data, lx->tokens.data + safe_tok, (lx->tokens.size - safe_tok) * sizeof(token));
+        lx->stream_held.size = lx->tokens.size - safe_tok;
+    }
+    lx->tokens.size = safe_tok;
+    lx->ci = safe_ci;
+    return false;
+}
+
+// Tokenizes lx->code from lx->ci up to lx->code_len into lx->tokens.
+// In partial mode the input may end in the middle of a string, an f-string or a continued line. Then every token
+// after the last complete logical line is held back, lx->ci is moved back to its start and false is returned. The
+// next call goes on where this one stopped, see pyc_lexer.stream_paused.
+static bool tokenize(pyc_lexer* lx, bool partial) {
+    // the open f-strings are kept in the lexer, so a pause leaves them there and an error recovered from leaks nothing
+    fstrings* fstrings = &lx->stream_fstrings;
+    if (!lx->stream_paused) fstrings->size = 0;
+    size_t safe_ci = lx->ci;
+    size_t safe_tok = lx->tokens.size;
+    size_t line_begin = lx->ci;
+
+    if (lx->stream_paused) {
+        size_t held = lx->stream_held.size;
+        if (lx->tokens.size == 0) {
+            tokens t = lx->tokens;
+            lx->tokens = lx->stream_held;
+            lx->stream_held = t;
+        } else if (held > 0) {
+            tokens_reserve(&lx->tokens, lx->tokens.size + held);
+            memcpy(lx->tokens.data + lx->tokens.size, lx->stream_held.data, held * sizeof(token));
+            lx->tokens.size += held;
+        }
+        lx->ci = lx->stream_resume;
+        pyc_open_string s = lx->stream_string;
+        stream_unpause(lx);
+
+        if (s.open && !lex_string(lx, &s, fstrings, partial)) {
+            return stream_pause(lx, safe_ci, safe_tok, &s);
+        }
+    }
+
+    while (lx->ci < lx->code_len) {
+        char c = lx->code[lx->ci];
+
+        if (c == '\r') {
+            lx->ci++;
+            continue;
+        }
+
+        if (c == '#') {
+            lx->ci = scan_line_end(lx->code, lx->ci, lx->code_len);
+            if (lx->ci < lx->code_len && lx->code[lx->ci] == '\0') null_byte_error(lx);
             continue;
         }
 
         if (c == '\\') {
-            pyc_ci++;
+            lx->ci++;
             char c2;
-            while (pyc_ci < pyc_code_len && (c2 = pyc_code[pyc_ci]) == '\r') pyc_ci++;
-            if (pyc_ci >= pyc_code_len || c2 != '\n') { raise_error_i(pyc_ci, "SyntaxError: invalid syntax", false); }
+            while (lx->ci < lx->code_len && (c2 = lx->code[lx->ci]) == '\r') lx->ci++;
+            if (lx->ci >= lx->code_len || c2 != '\n') { pyc_lex_error(lx, lx->ci, "SyntaxError: invalid syntax", false); }
 
-            pyc_ci++;
+            lx->ci++;
             continue;
         }
 
         if (c == '\n' || c == ';') {
-            if (pyc_tokens.size == 0) {
-                pyc_ci++;
-                continue;
+            if (lx->tokens.size != 0 || lx->stream_tokens != 0) {
+                token tok;
+                tok.start = lx->ci;
+                tok.end = lx->ci + 1;
+                tok.type = c == '\n' ? TOKEN_LINE_BREAK_NEWLINE : TOKEN_LINE_BREAK_SEMICOLON;
+                tokens_push(&lx->tokens, tok);
+            }
+            lx->ci++;
+            if (c == '\n' && fstrings->size == 0) {
+                line_begin = lx->ci;
+                if (lx->depth == 0) lx->line_start = true;
+                safe_ci = lx->ci;
+                safe_tok = lx->tokens.size;
             }
-            token tok;
-            tok.start = pyc_ci;
-            tok.end = pyc_ci + 1;
-            tok.type = c == '\n' ? TOKEN_LINE_BREAK_NEWLINE : TOKEN_LINE_BREAK_SEMICOLON;
-            tokens_push(&pyc_tokens, tok);
-            pyc_ci++;
             continue;
         }
 
         if (c == ' ' || c == '\t') {
-            pyc_ci++;
+            lx->ci = scan_blank(lx->code, lx->ci + 1, lx->code_len);
             continue;
         }
 
-        if (fstrings.size > 0) {
-            if (c == '{') fstrings_back(fstrings)->open++;
+        if (lx->line_start) {
+            lx->line_start = false;
+            indent_line(lx, line_begin);
+        }
+
+        if (fstrings->size > 0) {
+            if (c == '{') fstrings_back(*fstrings)->open++;
 
             if (c == '}') {
-                fstring* opt = fstrings_back(fstrings);
+                fstring* opt = fstrings_back(*fstrings);
                 if (--opt->open == 0) {
-                    size_t start = pyc_ci;
-                    char quote = opt->quote;
-                    bool has_format = false;
-                    bool is_triple = opt->is_triple;
-                    bool slash = false;
-
-                    while (pyc_ci < pyc_code_len) {
-                        c = pyc_code[pyc_ci];
-                        if (c == '{') {
-                            if (pyc_ci + 1 < pyc_code_len && pyc_code[pyc_ci + 1] == '{') {
-                                pyc_ci += 2;
-                                continue;
-                            }
-                            opt->open++;
-                            has_format = true;
-                            pyc_ci++;
-                            break;
-                        }
-
-                        if (c == '\r') {
-                            pyc_ci++;
-                            continue;
-                        }
-
-                        if (!slash && !is_triple && c == '\n') {
-                            raise_error_i(pyc_ci, "SyntaxError: invalid syntax", false);
-                        }
-
-                        if (c == '\\') slash = !slash;
-                        else if (!slash && c == quote) {
-                            if (is_triple) {
-                                if (pyc_ci + 2 < pyc_code_len && pyc_code[pyc_ci + 1] == quote &&
-                                    pyc_code[pyc_ci + 2] == quote) {
-                                    pyc_ci += 3;
-                                    break;
-                                }
-                            } else {
-                                pyc_ci++;
-                                break;
-                            }
-                        } else slash = false;
-
-                        pyc_ci++;
+                    pyc_open_string str = {
+                        .continued = true,
+                        .is_triple = opt->is_triple,
+                        .is_raw = opt->is_raw,
+                        .is_fstring = true,
+                        .quote = opt->quote,
+                        .tok_start = lx->ci,
+                        .start = lx->ci
+                    };
+                    if (!lex_string(lx, &str, fstrings, partial)) {
+                        return stream_pause(lx, safe_ci, safe_tok, &str);
                     }
-
-                    token tok;
-                    tok.start = start;
-                    tok.end = pyc_ci - (has_format ? 1 : is_triple ? 3 : 1);
-                    tok.type = has_format ? TOKEN_FSTRING_MIDDLE : TOKEN_FSTRING_END;
-                    if (!has_format) fstrings_pop(&fstrings);
-                    tokens_push(&pyc_tokens, tok);
                     continue;
                 }
             }
         }
 
-        char* matched = NULL;
-        size_t symbol_ind = match_symbol(pyc_ci, pyc_code_len, &matched);
-        if (symbol_ind != -1 && (c != '.' || pyc_ci + 1 >= pyc_code_len || !isdigit(pyc_code[pyc_ci + 1]))) {
-            size_t match_len = strlen(matched);
-
-            token tok;
-            tok.start = pyc_ci;
-            tok.end = pyc_ci += match_len;
-            tok.type = symbol_ind == 0
-                           ? TOKEN_OPERATOR_EQ
-                           : (symbol_ind <= SYMBOLS_SET_OPERATOR
-                                  ? (TOKEN_SET_OPERATOR | ((symbol_ind - 1) << 4))
-                                  : (symbol_ind <= SYMBOLS_OPERATOR
-                                         ? (TOKEN_OPERATOR | ((symbol_ind - SYMBOLS_SET_OPERATOR) << 4))
-                                         : (TOKEN_SYMBOL | ((symbol_ind - SYMBOLS_OPERATOR - 1) << 4))));
-            tokens_push(&pyc_tokens, tok);
-            continue;
-        }
-
-        if (isalpha(c) || c == '_') {
+        size_t symbol_len;
+        size_t symbol_type = match_symbol(lx, lx->ci, &symbol_len);
+        if (symbol_type != -1 && (c != '.' || lx->ci + 1 >= lx->code_len || !is_digit(lx->code[lx->ci + 1]))) {
             token tok;
-            tok.start = pyc_ci;
-
-            while (pyc_ci < pyc_code_len && (isalnum(pyc_code[pyc_ci]) || pyc_code[pyc_ci] == '_')) { pyc_ci++; }
-            size_t len = pyc_ci - tok.start;
-
-            char* word = strndup(pyc_code + tok.start, len);
-
-            tok.end = pyc_ci;
-
-            bool is_true = strcmp(word, "True") == 0;
-            if (is_true || strcmp(word, "False") == 0) {
-                tok.type = is_true ? TOKEN_BOOLEAN_TRUE : TOKEN_BOOLEAN_FALSE;
-            } else if (strcmp(word, "None") == 0) { tok.type = TOKEN_NONE; } else {
-                int j = 0;
-                for (; j < keywords_count; j++) { if (strcmp(word, keyword_names[j]) == 0) break; }
-
-                if (j != keywords_count) tok.type = TOKEN_KEYWORD | ((j + 1) << 4);
-                else {
-                    j = 0;
-                    for (; j < word_operators_count; j++) { if (strcmp(word, word_operators[j]) == 0) break; }
-
-                    if (j != word_operators_count) {
-                        if ((j == WORD_OPERATOR_IN_INDEX || j == WORD_OPERATOR_NOT_INDEX) && pyc_tokens.size > 0) {
-                            token* prev = tokens_back(pyc_tokens);
-
-                            if (j == WORD_OPERATOR_IN_INDEX && p_tok_val_eq(prev, "not")) {
-                                prev->type = TOKEN_OPERATOR_NOT_IN;
-                                prev->end = pyc_ci;
-                                free(word);
-                                continue;
-                            } else if (j == WORD_OPERATOR_NOT_INDEX && p_tok_val_eq(prev, "is")) {
-                                prev->type = TOKEN_OPERATOR_IS_NOT;
-                                prev->end = pyc_ci;
-                                free(word);
-                                continue;
-                            }
-                        }
-
-                        tok.type = TOKEN_OPERATOR | ((j + 0x14) << 4);
-                    } else { tok.type = TOKEN_IDENTIFIER | (temp_identifiers_introduce(tok.start, tok.end) << 4); }
-                }
+            tok.start = lx->ci;
+            tok.end = lx->ci += symbol_len;
+            tok.type = symbol_type;
+            tokens_push(&lx->tokens, tok);
+
+            if (symbol_type == TOKEN_SYMBOL_LPAREN || symbol_type == TOKEN_SYMBOL_LBRACKET ||
+                symbol_type == TOKEN_SYMBOL_LBRACE) {
+                lx->depth++;
+            } else if ((symbol_type == TOKEN_SYMBOL_RPAREN || symbol_type == TOKEN_SYMBOL_RBRACKET ||
+                        symbol_type == TOKEN_SYMBOL_RBRACE) && lx->depth > 0) {
+                lx->depth--;
             }
-
-            free(word);
-
-            tokens_push(&pyc_tokens, tok);
             continue;
         }
 
-        if (c == '.' || isdigit(c)) {
+        size_t first_len = identifier_char(lx, lx->ci, true);
+        if (first_len > 0) {
             token tok;
-            tok.start = pyc_ci;
-            bool has_dot = c == '.';
-            bool has_exponent = false;
-            char cn;
-
-            if (has_dot) pyc_ci++;
-            else if (c == '0') {
-                if (pyc_ci + 1 < pyc_code_len && (
-                    pyc_code[pyc_ci + 1] == 'x'
-                    || pyc_code[pyc_ci + 1] == 'X'
-                    || pyc_code[pyc_ci + 1] == 'o'
-                    || pyc_code[pyc_ci + 1] == 'O'
-                    || pyc_code[pyc_ci + 1] == 'b'
-                    || pyc_code[pyc_ci + 1] == 'B'
-                )) { pyc_ci += 2; } else {
-                    raise_error_i(pyc_ci, "SyntaxError: leading zeros in decimal integer literals "
-                                  "are not permitted; use an 0o prefix for octal integers", false);
-                }
-            }
+            tok.start = lx->ci;
 
-            while (pyc_ci < pyc_code_len && (isdigit(cn = pyc_code[pyc_ci]) || cn == '.' || cn == '_')) {
-                if (cn == '_' && pyc_code[pyc_ci - 1] == '_') {
-                    raise_error_i(pyc_ci, "invalid decimal literal", false);
-                }
+            lx->ci = skip_identifier(lx, lx->ci + first_len);
+            tok.end = lx->ci;
+            tok.type = classify_word(lx->code + tok.start, tok.end - tok.start);
 
-                if (cn == '.') {
-                    if (has_dot) break;
-                    if (pyc_code[pyc_ci - 1] == '_' || (pyc_ci + 1 < pyc_code_len && pyc_code[pyc_ci + 1] == '_')) {
-                        raise_error_i(pyc_ci, "invalid decimal literal", false);
-                    }
-                    has_dot = true;
-                }
+            if ((tok.type == TOKEN_OPERATOR_IN || tok.type == TOKEN_OPERATOR_NOT) && lx->tokens.size > 0) {
+                token* prev = tokens_back(lx->tokens);
 
-                pyc_ci++;
-            }
-
-            size_t exp_index = 0;
-
-            if (pyc_ci < pyc_code_len && ((cn = pyc_code[pyc_ci]) == 'e' || cn == 'E')) {
-                has_exponent = true;
-                pyc_ci++;
-                exp_index = pyc_ci;
-                cn = pyc_code[pyc_ci];
-                if (pyc_ci < pyc_code_len && (cn == '+' || cn == '-')) { pyc_ci++; }
-
-                if (pyc_ci >= pyc_code_len || !isdigit(pyc_code[pyc_ci])) {
-                    raise_error_i(pyc_ci, "invalid decimal literal",
-                                  false); // todo: python throws the slices into weird places
+                if (tok.type == TOKEN_OPERATOR_IN && prev->type == TOKEN_OPERATOR_NOT) {
+                    prev->type = TOKEN_OPERATOR_NOT_IN;
+                    prev->end = lx->ci;
+                    continue;
                 }
 
-                int exponent = 0;
-                while (pyc_ci < pyc_code_len && (isdigit(cn = pyc_code[pyc_ci]) || cn == '_')) {
-                    if (cn == '_' && pyc_code[pyc_ci - 1] == '_') {
-                        raise_error_i(pyc_ci, "invalid decimal literal", false);
-                    }
-
-                    if (cn != '_') exponent = exponent * 10 + (cn - '0');
-                    pyc_ci++;
+                if (tok.type == TOKEN_OPERATOR_NOT && prev->type == TOKEN_OPERATOR_IS) {
+                    prev->type = TOKEN_OPERATOR_IS_NOT;
+                    prev->end = lx->ci;
+                    continue;
                 }
             }
 
-            tok.end = pyc_ci;
-            uint64_t result;
-            bool is_float = has_dot || has_exponent;
-
-            if (!extract_number(tok.start, tok.end, exp_index, is_float, &result)) {
-                raise_error_i(tok.start, "invalid number literal", false);
-            }
+            if (tok.type == TOKEN_IDENTIFIER) tok.type |= temp_identifiers_introduce(lx, tok.start, tok.end) << 4;
 
-            if (pyc_code[pyc_ci - 1] == '_') { raise_error_i(pyc_ci - 1, "invalid number literal", false); }
-
-            if (is_float) { tok.type = TOKEN_FLOAT | (temp_floats_introduce(*(double*)&result) << 4); } else {
-                tok.type = TOKEN_INTEGER | (temp_ints_introduce(result) << 4);
-            }
+            tokens_push(&lx->tokens, tok);
+            continue;
+        }
 
-            tokens_push(&pyc_tokens, tok);
+        if (c == '.' || is_digit(c)) {
+            token tok;
+            lex_number(lx, &tok);
+            tokens_push(&lx->tokens, tok);
             continue;
         }
 
@@ -430,150 +1182,266 @@ void pyc_tokenize() {
             char quote = c;
 
             token tok;
-            size_t start = tok.start = pyc_ci;
+            size_t start = tok.start = lx->ci;
 
-            bool is_triple = (pyc_ci + 2 < pyc_code_len && pyc_code[pyc_ci + 1] == quote &&
-                pyc_code[pyc_ci + 2] == quote);
-            pyc_ci += is_triple ? 3 : 1;
+            bool is_triple = (lx->ci + 2 < lx->code_len && lx->code[lx->ci + 1] == quote &&
+                lx->code[lx->ci + 2] == quote);
+            lx->ci += is_triple ? 3 : 1;
 
             bool is_fstring = false;
-            bool slash = false;
-            bool has_format = false;
-            int flag = 0;
+            bool is_raw = false;
+            bool is_binary = false;
 
+            // a prefix is lexed as an identifier right before the quote
             token back;
-            if (pyc_tokens.size > 0 && (back = *tokens_back(pyc_tokens)).type == TOKEN_IDENTIFIER &&
-                back.end == start) {
-                bool is_binary = false;
-                bool is_raw = false;
-                if (tok_val_eq(back, "f")) {
-                    flag = 0x10;
-                    is_binary = true;
-                    is_raw = true;
-                } else if (tok_val_eq(back, "r")) {
-                    flag = 0x50;
-                    is_raw = true;
-                } else if (tok_val_eq(back, "b")) {
-                    flag = 0x50;
-                    is_binary = true;
-                } else if (tok_val_eq(back, "rf") || tok_val_eq(back, "fr")) {
-                    flag = 0x50;
-                    is_fstring = true;
-                    is_raw = true;
+            if (lx->tokens.size > 0 && ((back = *tokens_back(lx->tokens)).type & 0xf) == TOKEN_IDENTIFIER &&
+                back.end == start && back.end - back.start <= 2) {
+                bool valid = true;
+                for (size_t i = back.start; i < back.end; i++) {
+                    switch (lx->code[i] | 0x20) {
+                    case 'f':
+                        valid &= !is_fstring && !is_binary;
+                        is_fstring = true;
+                        break;
+                    case 'r':
+                        valid &= !is_raw;
+                        is_raw = true;
+                        break;
+                    case 'b':
+                        valid &= !is_binary && !is_fstring;
+                        is_binary = true;
+                        break;
+                    case 'u':
+                        valid &= back.end - back.start == 1;
+                        break;
+                    default:
+                        valid = false;
+                    }
                 }
 
-                if (is_fstring || is_raw || is_binary) {
+                if (valid) {
                     tok.start = back.start;
-                    tokens_pop(&pyc_tokens);
-                }
+                    tokens_pop(&lx->tokens);
+                } else is_fstring = is_raw = is_binary = false;
             }
 
-            while (pyc_ci < pyc_code_len) {
-                c = pyc_code[pyc_ci];
-                if (is_fstring && c == '{') {
-                    if (pyc_ci + 1 < pyc_code_len && pyc_code[pyc_ci + 1] == '{') {
-                        pyc_ci += 2;
-                        continue;
-                    }
+            pyc_open_string str = {
+                .is_triple = is_triple,
+                .is_raw = is_raw,
+                .is_binary = is_binary,
+                .is_fstring = is_fstring,
+                .quote = quote,
+                .tok_start = tok.start,
+                .start = start
+            };
+            if (!lex_string(lx, &str, fstrings, partial)) return stream_pause(lx, safe_ci, safe_tok, &str);
+            continue;
+        }
 
-                    has_format = true;
-                    pyc_ci++;
-                    break;
-                }
+        if (c == '\0') null_byte_error(lx);
+        if ((unsigned char) c >= 0x80) invalid_character_error(lx, lx->ci);
+        pyc_lex_error(lx, lx->ci, "invalid syntax", false);
+    }
 
-                if (c == '\r') {
-                    pyc_ci++;
-                    continue;
-                }
+    if (fstrings->size > 0) {
+        if (partial) return stream_pause(lx, safe_ci, safe_tok, NULL);
+        fstring optBack = fstrings_pop(fstrings);
+        pyc_lex_error(lx, optBack.tok.start, "SyntaxError: unterminated string literal", false);
+    }
 
-                if (!slash && !is_triple && c == '\n') { raise_error_i(pyc_ci, "SyntaxError: invalid syntax", true); }
-
-                if (c == '\\') slash = !slash;
-                else if (!slash && c == quote) {
-                    if (is_triple) {
-                        if (pyc_ci + 2 < pyc_code_len && pyc_code[pyc_ci + 1] == quote &&
-                            pyc_code[pyc_ci + 2] == quote) {
-                            pyc_ci += 3;
-                            break;
-                        }
-                    } else {
-                        pyc_ci++;
-                        break;
-                    }
-                } else slash = false;
+    if (!partial) close_blocks(lx);
+    return true;
+}
 
-                pyc_ci++;
-            }
+static void index_lines(pyc_lexer* lx) {
+    size_t n = scan_newlines(lx->code, lx->code_len, NULL);
+    size_list_reserve(&lx->lines, n + 1);
+    lx->lines.data[0] = 0;
+    scan_newlines(lx->code, lx->code_len, lx->lines.data + 1);
+    lx->lines.size = n + 1;
+}
 
-            tok.end = pyc_ci - 1;
-            if (has_format) {
-                tok.type = TOKEN_FSTRING_START | flag;
-                fstring opt = {.is_triple = is_triple, .quote = quote, .tok = tok, .open = 1};
-                fstrings_push(&fstrings, opt);
-            } else { tok.type = TOKEN_STRING | flag; }
+// Returns the index of the line i is in, the lines before it are the ones that start at or before i.
+static size_t line_of(pyc_lexer* lx, size_t i) {
+    if (lx->lines.size == 0) index_lines(lx);
+    size_t lo = 0, hi = lx->lines.size;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (lx->lines.data[mid] <= i) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
 
-            tokens_push(&pyc_tokens, tok);
-            continue;
-        }
+void pyc_lex_tokenize(pyc_lexer* lx) {
+    if (lx->code_len > TOKEN_MAX_OFFSET) pyc_lex_error(lx, 0, "OverflowError: source is larger than 4 GiB", false);
+    index_lines(lx);
+    validate_utf8(lx, 0);
+    reset_indents(lx);
+    tokenize(lx, false);
+    tokens_shrink(&lx->tokens);
+    index_tokens(lx);
+}
 
-        raise_error_i(pyc_ci, "invalid syntax", false);
+bool pyc_lex_tokenize_range(pyc_lexer* lx, size_t start, size_t end) {
+    size_t len = lx->code_len;
+    if (len > TOKEN_MAX_OFFSET) pyc_lex_error(lx, 0, "OverflowError: source is larger than 4 GiB", false);
+    bool last = end == len;
+    // the pools copy what they keep like they do for a stream
+    lx->streaming = true;
+    lx->ci = start;
+    lx->code_len = end;
+    validate_utf8(lx, start);
+    reset_indents(lx);
+    stream_unpause(lx);
+
+    bool complete = tokenize(lx, !last);
+    if (!last) {
+        // a backslash right before the last newline continues the line after end
+        size_t i = end;
+        if (i > start && lx->code[i - 1] == '\n') i--;
+        while (i > start && lx->code[i - 1] == '\r') i--;
+        complete = complete && lx->depth == 0 && (i == end || i == start || lx->code[i - 1] != '\\');
+        close_blocks(lx);
     }
 
-    if (fstrings.size > 0) {
-        fstring optBack = fstrings_pop(&fstrings);
-        raise_error_t(optBack.tok, "SyntaxError: unterminated string literal");
-    }
+    lx->code_len = len;
+    tokens_shrink(&lx->tokens);
+    index_tokens(lx);
+    return complete;
+}
 
-    fstrings_clear(&fstrings);
+// Moves the offsets of a paused tokenize along with the stream buffer when its first n bytes are dropped.
+static void stream_shift(pyc_lexer* lx, size_t n) {
+    for (size_t i = 0; i < lx->stream_held.size; i++) {
+        lx->stream_held.data[i].start -= n;
+        lx->stream_held.data[i].end -= n;
+    }
+    for (size_t i = 0; i < lx->stream_fstrings.size; i++) {
+        lx->stream_fstrings.data[i].tok.start -= n;
+        lx->stream_fstrings.data[i].tok.end -= n;
+    }
+    if (lx->stream_string.open) {
+        lx->stream_string.tok_start -= n;
+        lx->stream_string.start -= n;
+    }
+    lx->stream_resume -= n;
+}
 
-    tokens_shrink(&pyc_tokens);
-    pyc_tok_count = pyc_tokens.size;
+void pyc_lex_stream_init(pyc_lexer* lx) {
+    lx->streaming = true;
+    char_list_clear(&lx->stream_buffer);
+    lx->stream_base = 0;
+    lx->stream_consumed = 0;
+    lx->stream_checked = 0;
+    lx->stream_tokens = 0;
+    stream_unpause(lx);
+    reset_indents(lx);
+    lx->code = NULL;
+    lx->code_len = 0;
+    lx->ci = 0;
+    tokens_clear(&lx->tokens);
+    tokens_init(&lx->tokens);
 }
 
-void get_index_pos(size_t index, size_t* l, size_t* c) {
-    size_t line = 0;
-    size_t column = 0;
-    for (size_t i = 0; i < index; i++) {
-        char ch = pyc_code[i];
-        if (ch == '\n') {
-            line++;
-            column = 0;
-        } else if (ch == '\r') { column = 0; } else column++;
+size_t pyc_lex_feed(pyc_lexer* lx, char* chunk, size_t len, bool final) {
+    char_list* buf = &lx->stream_buffer;
+
+    // drop what the previous call tokenized, its tokens are handed out and invalidated now
+    if (lx->stream_consumed > 0) {
+        memmove(buf->data, buf->data + lx->stream_consumed, buf->size - lx->stream_consumed);
+        buf->size -= lx->stream_consumed;
+        lx->stream_base += lx->stream_consumed;
+        lx->stream_checked -= lx->stream_consumed;
+        if (lx->stream_paused) stream_shift(lx, lx->stream_consumed);
+        lx->stream_consumed = 0;
     }
+    lx->stream_tokens += lx->tokens.size;
+    lx->tokens.size = 0;
+
+    // grows geometrically, a string that spans many chunks stays in the buffer until it ends
+    if (buf->size + len + 1 > buf->capacity) {
+        char_list_reserve(buf, buf->size + len + 1 > buf->capacity * 2 ? buf->size + len + 1 : buf->capacity * 2);
+    }
+    if (len > 0) memcpy(buf->data + buf->size, chunk, len);
+    buf->size += len;
+    buf->data[buf->size] = '\0';
+
+    // only complete lines are looked at until the last chunk, so a token can never be cut in half
+    size_t limit = buf->size;
+    if (!final) {
+        // the lines up to stream_checked were looked at already
+        char* nl = memrchr(buf->data + lx->stream_checked, '\n', buf->size - lx->stream_checked);
+        if (nl == NULL) return 0;
+        limit = nl - buf->data + 1;
+    }
+
+    lx->code = buf->data;
+    lx->code_len = limit;
+    lx->ci = 0;
+    lx->lines.size = 0;
+    if (limit > TOKEN_MAX_OFFSET) pyc_lex_error(lx, 0, "OverflowError: logical line is larger than 4 GiB", false);
+    // limit is right after a '\n' or at the end, so no character is cut in half
+    validate_utf8(lx, lx->stream_checked);
+    lx->stream_checked = limit;
+    bool complete = tokenize(lx, !final);
+    lx->stream_consumed = complete ? limit : lx->ci;
+    index_tokens(lx);
+    return lx->tokens.size;
+}
+
+void pyc_lex_stream_free(pyc_lexer* lx) {
+    char_list_clear(&lx->stream_buffer);
+    lx->streaming = false;
+}
+
+void pyc_tokenize() {
+    pyc_lex_tokenize(&pyc_global_lexer);
+}
+
+void pyc_stream_init() {
+    pyc_lex_stream_init(&pyc_global_lexer);
+}
+
+size_t pyc_feed(char* chunk, size_t len, bool final) {
+    return pyc_lex_feed(&pyc_global_lexer, chunk, len, final);
+}
+
+size_t pyc_stream_offset() { return pyc_global_lexer.stream_base; }
+
+void pyc_stream_free() { pyc_lex_stream_free(&pyc_global_lexer); }
+
+// '\r' only resets the column, it doesn't start a new line
+void pyc_lex_index_pos(pyc_lexer* lx, size_t index, size_t* l, size_t* c) {
+    size_t line = line_of(lx, index);
+    size_t start = lx->lines.data[line];
+    char* cr = index > start ? memrchr(lx->code + start, '\r', index - start) : NULL;
+    if (cr != NULL) start = cr - lx->code + 1;
 
     *l = line;
-    *c = column;
+    *c = index - start;
 }
 
-void get_line_bound(size_t index, size_t* s, size_t* e) {
-    size_t start = 0;
+void pyc_lex_line_bound(pyc_lexer* lx, size_t index, size_t* s, size_t* e) {
     size_t st_index = index == 0 ? 0 : index - 1;
-    if (pyc_code[index] == '\n' || pyc_code[index] == '\r') {
+    if (lx->code[index] == '\n' || lx->code[index] == '\r') {
         char c2;
-        while (st_index > 0 && ((c2 = pyc_code[st_index]) == '\n' || c2 == '\r')) st_index--;
+        while (st_index > 0 && ((c2 = lx->code[st_index]) == '\n' || c2 == '\r')) st_index--;
     }
 
-    for (size_t i = st_index; i-- > 0;) {
-        char c = pyc_code[i];
-        if (c == '\n' || c == '\r') {
-            start = i + 1;
-            *s = start;
-            break;
-        }
-    }
+    size_t start = lx->lines.data[line_of(lx, st_index)];
+    char* cr = st_index > start ? memrchr(lx->code + start, '\r', st_index - start) : NULL;
+    *s = cr != NULL ? cr - lx->code + 1 : start;
 
-    if (start == 0) *s = 0;
+    size_t line = line_of(lx, index);
+    size_t end = line + 1 < lx->lines.size ? lx->lines.data[line + 1] - 1 : lx->code_len;
+    cr = end > index ? memchr(lx->code + index, '\r', end - index) : NULL;
+    *e = cr != NULL ? cr - lx->code : end;
+}
 
-    for (size_t i = index; i < pyc_code_len; i++) {
-        char c = pyc_code[i];
-        if (c == '\n' || c == '\r') {
-            *e = i;
-            return;
-        }
-    }
+void get_index_pos(size_t index, size_t* l, size_t* c) { pyc_lex_index_pos(&pyc_global_lexer, index, l, c); }
 
-    *e = pyc_code_len;
-}
+void get_line_bound(size_t index, size_t* s, size_t* e) { pyc_lex_line_bound(&pyc_global_lexer, index, s, e); }
 
 inline void token_free(token _) {
 }
@@ -589,7 +1457,7 @@ inline void token_p_free(token* _) {
 void print_readable(char* code, size_t start, size_t end) {
     for (size_t i = start; i < end; i++) {
         char c = code[i];
-        if (isprint(c)) { putchar(c); } else if (c == '\n') { printf("\\n"); } else { printf("\\x%02x", c); }
+        if (c >= ' ' && c < 0x7F) { putchar(c); } else if (c == '\n') { printf("\\n"); } else { printf("\\x%02x", c); }
     }
 }
 
@@ -622,15 +1490,22 @@ void token_p_print(token* tok, int indent) {
 
 #endif
 
-__THROWNL __attribute__((noreturn)) void raise_error_i(size_t i, char* err, bool has_line) {
-    if (i >= pyc_code_len) i = pyc_code_len == 0 ? 0 : pyc_code_len - 1;
+__THROWNL __attribute__((noreturn)) void pyc_lex_error(pyc_lexer* lx, size_t i, char* err, bool has_line) {
+    if (pyc_lex_recover != NULL) {
+        pyc_lex_recover->pos = i;
+        snprintf(pyc_lex_recover->message, sizeof(pyc_lex_recover->message), "%s", err);
+        longjmp(pyc_lex_recover->env, 1);
+    }
+    if (i >= lx->code_len) i = lx->code_len == 0 ? 0 : lx->code_len - 1;
     size_t line, column;
-    get_index_pos(i, &line, &column);
+    pyc_lex_index_pos(lx, i, &line, &column);
     size_t start, end;
-    get_line_bound(i, &start, &end);
-    printf("%.*s", (int)(end - start), pyc_code + start);
+    pyc_lex_line_bound(lx, i, &start, &end);
+    printf("%.*s", (int)(end - start), lx->code + start);
     putchar('\n');
 
+    // the caret goes under the character, continuation bytes of the ones before it take no column
+    for (size_t k = i - column; k < i; k++) column -= ((unsigned char) lx->code[k] & 0xC0) == 0x80;
     print_spaces(column);
     printf("^\n");
 
@@ -639,4 +1514,8 @@ __THROWNL __attribute__((noreturn)) void raise_error_i(size_t i, char* err, bool
     fail();
 }
 
+__THROWNL __attribute__((noreturn)) void raise_error_i(size_t i, char* err, bool has_line) {
+    pyc_lex_error(&pyc_global_lexer, i, err, has_line);
+}
+
 // ReSharper restore CppParameterNamesMismatch
@@ -1,7 +1,9 @@
 #ifndef PYC_LEXER_H
 #define PYC_LEXER_H
 
+#include "intern.h"
 #include "utils.h"
+#include <setjmp.h>
 
 #define TOKEN_KEYWORD 0x0
 #define TOKEN_KEYWORD_IF 0x010
@@ -99,9 +101,12 @@
 #define TOKEN_LINE_BREAK 0x5
 #define TOKEN_LINE_BREAK_NEWLINE 0x05
 #define TOKEN_LINE_BREAK_SEMICOLON 0x15
+// right before the first token of a line that opens a block, or one for every block the line closes
+#define TOKEN_LINE_BREAK_INDENT 0x25
+#define TOKEN_LINE_BREAK_DEDENT 0x35
 
 // ((x >> 4) & 0b111)   =>    0: '', 1: 'f', 2: 'r', 3: 'b', 4: 'rb', 5: 'rf'
-// (x >> 7)             =>    57 bits free for the string value index
+// (x >> 7)             =>    25 bits for the index in the string pool
 #define TOKEN_STRING 0x6
 #define TOKEN_STRING_F  0x16
 #define TOKEN_STRING_R  0x26
@@ -110,71 +115,70 @@
 #define TOKEN_STRING_RF 0x56
 
 // ((x >> 4) & 1)  =>  either has 'r' or not
-// x >> 5          =>  59 bits free for the string value index
+// x >> 5          =>  27 bits for the index in the string pool, only the first 2^25 are used
 #define TOKEN_FSTRING_START 0x7
 #define TOKEN_FSTRING_START_R  0x17
 
-// x >> 4   =>  60 bits free for the string value index
+// x >> 4   =>  28 bits for the index in the string pool, only the first 2^25 are used
 #define TOKEN_FSTRING_MIDDLE 0x8
 #define TOKEN_FSTRING_END 0x9
 
-// x >> 4   =>  60 bits free for the content substr index
+// x >> 4   =>  28 bits for the content substr index
 #define TOKEN_IDENTIFIER 0xA
 
-// x >> 4   =>  60 bits free for the integer/float value index
+// x >> 4   =>  28 bits for the integer/float value index
 #define TOKEN_INTEGER 0xB
 #define TOKEN_FLOAT 0xC
 
 #define TOKEN_NONE 0xD
 
-static char *keyword_names[] = {
-    "if", "else", "elif", "for", "while", "def", "return", "type", "import", "from", "as",
-    "with", "try", "except", "finally", "raise", "pass", "break", "continue", "lambda",
-    "yield", "global", "nonlocal", "assert", "del", "async", "await", "match", "case"
-};
-static size_t keywords_count = sizeof(keyword_names) / sizeof(keyword_names[0]);
-
-static char *symbols[] = {
-    "==",
-
-    "=", "**=", "+=", "-=", "*=", "/=", "//=", "%=", "&=", "|=",
-    "^=", "~=", "<<=", ">>=", "@=",
-
-    "**", "+", "-", "*", "/", "//", "%", "&", "|", "^",
-    "~", "<<", ">>", "@", "!=", ">=", "<=", ">", "<", ":=",
-
-    "(", ")", "[", "]", "{", "}", ":", ",", ".", "!"
-};
-
-static char *word_operators[] = {
-    "in", "is", "not", "and", "or"
-};
-static size_t word_operators_count = sizeof(word_operators) / sizeof(word_operators[0]);
-#define WORD_OPERATOR_IN_INDEX 0
-#define WORD_OPERATOR_NOT_INDEX 2
-
-#define SYMBOLS_SET_OPERATOR 15
-#define SYMBOLS_OPERATOR 35
-
-static size_t symbols_count = sizeof(symbols) / sizeof(symbols[0]);
+// x >> 4   =>  28 bits for the index of the literal in the big integer pool
+#define TOKEN_BIG_INTEGER 0xE
 
 static char *token_type_str[] = {
     "keyword", "boolean", "operator", "set_operator", "symbol", "line_break",
-    "identifier", "integer", "float", "string", "fstring_start", "fstring_middle",
-    "fstring_end", "none"
+    "string", "fstring_start", "fstring_middle", "fstring_end", "identifier",
+    "integer", "float", "none", "big_integer"
 };
 
+// Offsets are 32-bit, so a source can be at most 4 GiB and every payload index has to fit in the bits left of type.
 typedef struct token {
-    size_t type;
-    size_t start;
-    size_t end;
+    uint32_t type;
+    uint32_t start;
+    uint32_t end;
 } token;
 
+#define TOKEN_MAX_OFFSET UINT32_MAX
+#define TOKEN_MAX_PAYLOAD (1u << 28)
+#define TOKEN_MAX_STRING_PAYLOAD (1u << 25)
+
+// The type of a token without its payload index, this is what the kind array of a lexer holds.
+static inline uint16_t token_kind(uint32_t type) {
+    uint32_t t = type & 0xf;
+    return (t >= TOKEN_STRING && t <= TOKEN_FLOAT) || t == TOKEN_BIG_INTEGER ? t : type;
+}
+
+// Tokens that end every lookahead of the parser, however deep in brackets they are. A newline or a colon can too,
+// depending on what the parser looks for.
+static inline bool token_kind_is_stop(uint16_t kind) {
+    uint16_t t = kind & 0xf;
+    return t == TOKEN_KEYWORD || t == TOKEN_SET_OPERATOR || t == TOKEN_FSTRING_MIDDLE || t == TOKEN_FSTRING_END ||
+           (t == TOKEN_LINE_BREAK && kind != TOKEN_LINE_BREAK_NEWLINE) || kind == TOKEN_SYMBOL_EXC;
+}
+
+static inline bool token_kind_is_open(uint16_t kind) {
+    return kind == TOKEN_SYMBOL_LPAREN || kind == TOKEN_SYMBOL_LBRACKET || kind == TOKEN_SYMBOL_LBRACE;
+}
+
+static inline bool token_kind_is_close(uint16_t kind) {
+    return kind == TOKEN_SYMBOL_RPAREN || kind == TOKEN_SYMBOL_RBRACKET || kind == TOKEN_SYMBOL_RBRACE;
+}
+
 vec_define_pyc(token, tokens, token)
 
 void token_p_free(token *obj);
 
-vec_define(token*, tokens_p);
+vec_define_alloc(token*, tokens_p, pyc_ast);
 
 void token_p_print(token *obj, int indent);
 
@@ -188,17 +192,194 @@ typedef struct {
 
 vec_define(code_substr, code_substrs);
 
-extern char *pyc_code;
-extern size_t pyc_ci;
-extern size_t pyc_code_len;
-extern tokens pyc_tokens;
-extern size_t pyc_tok_count;
-extern size_t pyc_ti;
-extern tokens pyc_temp_tokens;
-extern code_substrs pyc_temp_identifiers;
-extern code_substrs pyc_temp_strings;
-extern u64_list pyc_temp_ints;
-extern f64_list pyc_temp_floats;
+// Indentation of an open block. col counts a tab up to the next multiple of 8 and alt_col counts it as one column,
+// the indentation is only consistent if both of them compare the same way.
+typedef struct {
+    size_t col;
+    size_t alt_col;
+} indent_level;
+
+vec_define(indent_level, indent_levels);
+
+// CPython's limit, also keeps the recursion of the parser in check
+#define PYC_MAX_INDENT 100
+
+// An f-string whose replacement fields are being lexed, open counts the unclosed '{' of the current one.
+typedef struct {
+    bool is_triple;
+    bool is_raw;
+    char quote;
+    token tok;
+    int open;
+} fstring;
+
+vec_define_pyc(fstring, fstrings, fstring)
+
+// A string literal the input ran out in, continued marks the part of an f-string after a replacement field. start is
+// at its opening quote (at the '}' if continued) and slash is set if the scan stopped right after a backslash.
+typedef struct {
+    bool open;
+    bool continued;
+    bool is_triple;
+    bool is_raw;
+    bool is_binary;
+    bool is_fstring;
+    bool slash;
+    char quote;
+    size_t tok_start;
+    size_t start;
+} pyc_open_string;
+
+// All state of one tokenization. Lexers don't share anything, so any number of them can run on different threads.
+// The token types index into the pools of the lexer that produced them.
+typedef struct {
+    char *code;
+    size_t ci;
+    size_t code_len;
+    tokens tokens;
+    // token_kind of every token, next to each other so that scanning ahead doesn't drag whole tokens into cache
+    u16_list kinds;
+    // Lookahead tables, all of them have an extra entry for the token count at the end.
+    // groups: for an opening bracket the index of its closing one, for any other token the index of the closing
+    // bracket of the innermost pair around it. The token count if there is none.
+    // next_stop, next_newline, next_colon: the first token at or after each one that is a stop
+    // (token_kind_is_stop), a newline or a colon.
+    u32_list groups;
+    u32_list next_stop;
+    u32_list next_newline;
+    u32_list next_colon;
+
+    // start offset of every line, filled by pyc_lex_tokenize or by the first position lookup
+    size_list lines;
+
+    // the open blocks, the first level is the column 0 of the top level
+    indent_levels indents;
+    // open brackets, lines inside of them are not indented
+    size_t depth;
+    // set at a newline until the first token of the next line is lexed
+    bool line_start;
+
+    code_substrs identifiers;
+    hash_index identifiers_index;
+    // Set before tokenizing to share identifiers between lexers, the identifier tokens then carry the symbol ids of
+    // this interner instead of indices into identifiers. identifiers stays a per-lexer cache in front of it and
+    // identifier_symbols has the id of each of its entries.
+    pyc_interner *interner;
+    u32_list identifier_symbols;
+    // decoded string literal bodies, either in place in code or copied to the string arena
+    code_substrs strings;
+    u64_list string_hashes;
+    hash_index strings_index;
+    pyc_arena string_arena;
+    u64_list ints;
+    hash_index ints_index;
+    f64_list floats;
+    hash_index floats_index;
+    // integer literals that don't fit in 64 bits, as written in the source
+    code_substrs big_ints;
+
+    // live-streaming state, see pyc_lex_feed
+    bool streaming;
+    char_list stream_buffer;
+    size_t stream_base;
+    size_t stream_consumed;
+    size_t stream_checked;
+    size_t stream_tokens;
+    // Set when a feed ended in a string or an f-string. Its tokens after the last complete line are held back here
+    // with the open f-strings and the string being scanned, and the next feed goes on from stream_resume instead of
+    // lexing the line again, so a long string is scanned once however many chunks it arrives in.
+    bool stream_paused;
+    tokens stream_held;
+    // the f-strings open in tokenize, also while it isn't paused
+    fstrings stream_fstrings;
+    pyc_open_string stream_string;
+    size_t stream_resume;
+} pyc_lexer;
+
+// code doesn't have to be NUL terminated, it is never written to.
+void pyc_lex_init(pyc_lexer *lx, char *code, size_t len);
+
+// The constant pools of a lexer, the payload of a token is its index into the one of its type.
+// Every value is in there once and keeps its index for the lifetime of the lexer.
+typedef struct {
+    const uint64_t *ints;
+    size_t int_count;
+    const double *floats;
+    size_t float_count;
+    const code_substr *big_ints;
+    size_t big_int_count;
+    const code_substr *identifiers;
+    size_t identifier_count;
+    // NULL unless the lexer has an interner, see pyc_lexer.interner
+    const uint32_t *identifier_symbols;
+    const code_substr *strings;
+    const uint64_t *string_hashes;
+    size_t string_count;
+} pyc_constants;
+
+// Borrows the pools, the pointers are valid until the lexer tokenizes again or is freed.
+pyc_constants pyc_lex_constants(pyc_lexer *lx);
+
+// Fills the pools of a lexer that has none yet with copies of the given ones, so the payloads of tokens that were
+// made with them can be used with this lexer. Identifier symbols are not taken, the lexer must not have an interner.
+void pyc_lex_load_constants(pyc_lexer *lx, pyc_constants c);
+
+void pyc_lex_tokenize(pyc_lexer *lx);
+
+// Tokenizes code[start, end) as if it was all of the source, but with the offsets it has in code. start has to be at
+// the beginning of a line that isn't inside of brackets or a string. Like for a stream the pools keep copies, so the
+// tokens stay valid when code changes. Returns false if the source goes on past end in the middle of a string,
+// brackets or a continued line, the tokens are only the complete lines then.
+bool pyc_lex_tokenize_range(pyc_lexer *lx, size_t start, size_t end);
+
+void pyc_lex_free(pyc_lexer *lx);
+
+// Live-streaming mode: the source is fed in chunks of any size and tokenized as it arrives.
+// Every pyc_lex_feed call replaces lx->tokens with the tokens of the newly completed logical lines. Their offsets
+// are relative to lx->code, which points to an internal buffer that is only valid until the next call, add
+// lx->stream_base to get offsets into the whole source. An unfinished string, f-string or continued line
+// is kept in the buffer and its tokens are handed out once the rest arrives. The last chunk has to be passed with final set, it
+// also gets the DEDENT tokens of the blocks that are still open.
+void pyc_lex_stream_init(pyc_lexer *lx);
+
+size_t pyc_lex_feed(pyc_lexer *lx, char *chunk, size_t len, bool final);
+
+void pyc_lex_stream_free(pyc_lexer *lx);
+
+void pyc_lex_index_pos(pyc_lexer *lx, size_t index, size_t *line, size_t *column);
+
+void pyc_lex_line_bound(pyc_lexer *lx, size_t index, size_t *start, size_t *end);
+
+bool pyc_lex_str_eq(pyc_lexer *lx, size_t start, size_t end, char *target);
+
+// Set by a caller that can go on after a syntax error, like pyc_doc_edit. pyc_lex_error, and with it every error of the
+// parser, then doesn't print and exit but copies the error here and longjmps to env. Per thread.
+typedef struct {
+    jmp_buf env;
+    size_t pos;
+    // some errors are formatted on the stack of the function that raises them, so they are copied
+    char message[128];
+} pyc_lex_recovery;
+
+extern _Thread_local pyc_lex_recovery *pyc_lex_recover;
+
+__THROWNL __attribute__((noreturn)) void pyc_lex_error(pyc_lexer *lx, size_t i, char *err, bool has_line);
+
+// The lexer behind the interface below that works on one file at a time, the printers use it too.
+extern pyc_lexer pyc_global_lexer;
+
+#define pyc_code (pyc_global_lexer.code)
+#define pyc_ci (pyc_global_lexer.ci)
+#define pyc_code_len (pyc_global_lexer.code_len)
+#define pyc_tokens (pyc_global_lexer.tokens)
+#define pyc_token_kinds (pyc_global_lexer.kinds.data)
+#define pyc_token_groups (pyc_global_lexer.groups.data)
+#define pyc_temp_identifiers (pyc_global_lexer.identifiers)
+#define pyc_temp_strings (pyc_global_lexer.strings)
+#define pyc_temp_ints (pyc_global_lexer.ints)
+#define pyc_temp_floats (pyc_global_lexer.floats)
+#define pyc_temp_big_ints (pyc_global_lexer.big_ints)
+#define pyc_streaming (pyc_global_lexer.streaming)
 
 void print_readable(char *code, size_t start, size_t end);
 
@@ -208,15 +389,20 @@ void get_line_bound(size_t index, size_t *start, size_t *end);
 
 void pyc_tokenize();
 
+// pyc_lex_stream_init and friends on the global lexer.
+void pyc_stream_init();
+
+size_t pyc_feed(char *chunk, size_t len, bool final);
+
+size_t pyc_stream_offset();
+
+void pyc_stream_free();
+
 void pyc_lexer_init(char *code);
 
-void pyc_load(char *code, tokens tokens);
+void pyc_lexer_init_len(char *code, size_t len);
 
-#define p_tok_val_eq(t, target) str_ind_eq(t->start, t->end, target)
-#define tok_val_eq(t, target) str_ind_eq(t.start, t.end, target)
-#define tok_peek_eq(peek, target) tok_val_eq(token_peek(peek), target)
-#define tok_peek_teq(peek, target) (token_peek(peek).type == target)
-#define tok_now_teq(target) tok_peek_teq(0, target)
+void pyc_load(char *code, tokens tokens);
 
 bool str_ind_eq(size_t start, size_t end, char *target);
 
@@ -224,21 +410,6 @@ char *str_ind_dup(size_t start, size_t end);
 
 char *str_tok_dup(token t);
 
-#define syntax_error() raise_error("SyntaxError: invalid syntax")
-#define syntax_error_t(t) raise_error_t((t), "SyntaxError: invalid syntax")
-#define tab_error()                                                            \
-    raise_error("TabError: inconsistent use of tabs and spaces in "            \
-                "indentation")
-#define indentation_error()                                                    \
-    raise_error("IndentationError: expected an indented block after function " \
-                "definition")
-#define not_implemented() raise_error("NotImplementedError: not implemented")
-#define raise_error_t(t, err) raise_error_t_ln(t, err, false)
-#define raise_error_t_ln(t, err, ln) raise_error_i((t).start, err, ln)
-#define raise_error(err) raise_error_ln(err, false)
-#define raise_error_ln(err, ln)      raise_error_i(tokens_over() ? pyc_code_len - 1 : token_peek(0).start,   err, ln)
-#define raise_error_n(n, err) raise_error_t(*get_node_token(n), err)
-
 static inline void print_line(size_t i) {
     if (i >= pyc_code_len) i = pyc_code_len - 1;
     size_t line, column;
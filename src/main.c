@@ -1,25 +1,50 @@
 #include "compiler.h"
+#include "dump.h"
+
+#include <unistd.h>
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        printf("Usage: pyc <filename>\n");
+    pyc_dump_format format = PYC_DUMP_TEXT;
+    char *filename = argv[argc - 1];
+    bool usage = argc != 2 && argc != 3;
+    if (argc == 3)
+        usage = strncmp(argv[1], "--dump=", 7) != 0 || !pyc_dump_format_parse(argv[1] + 7, &format);
+    if (usage) {
+        printf("Usage: pyc [--dump=text|json|bin] <filename>\n");
         return 1;
     }
 
-    char *code = read_file(argv[1]);
-    if (!code) return 1;
-
-    pyc_lexer_init(code);
-    pyc_tokenize();
-
-    node *prog = parse_file(NULL, argv[1], code);
-
-    node_print(prog, 0);
+    source_map src;
+    if (!source_map_open(&src, filename)) return 1;
+    char *code = src.data;
+
+    pyc_lexer_init_len(code, src.len);
+    // with a cache the file is only tokenized if it has no entry yet
+    char *cache_dir = getenv("PYC_CACHE_DIR");
+    if (cache_dir == NULL) pyc_tokenize();
+
+    // the whole tree goes away with the arena
+    pyc_arena ast = pyc_arena(PYC_ARENA_HUGE_PAGE);
+    pyc_ast_arena = &ast;
+    pyc_parser ps;
+    pyc_parser_init(&ps, &pyc_global_lexer);
+    ps.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    ps.cache_dir = cache_dir;
+    node *prog = parse_file(&ps, NULL, filename);
+
+    pyc_writer out;
+    pyc_writer_init(&out, STDOUT_FILENO);
+    bool ok = pyc_dump(&out, format, &pyc_global_lexer, prog);
+    if (!pyc_writer_close(&out)) {
+        perror("Error writing the dump");
+        ok = false;
+    }
 
-    node_free(prog);
+    pyc_ast_arena = NULL;
+    pyc_arena_free(&ast);
 
     tokens_clear(&pyc_tokens);
 
-    free(code);
-    return 0;
+    source_map_close(&src);
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,147 @@
+#include "number.h"
+#include "pow5.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline unsigned digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return 255;
+}
+
+bool pyc_parse_uint(const char *s, size_t len, int base, uint64_t *out) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '_') continue;
+        if (__builtin_mul_overflow(v, (uint64_t) base, &v)) return false;
+        if (__builtin_add_overflow(v, (uint64_t) digit_value(s[i]), &v)) return false;
+    }
+
+    *out = v;
+    return true;
+}
+
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Eisel-Lemire: rounds w * 10^q using the 128-bit approximation of 5^q. Returns false when the product is too close
+// to a halfway point to decide, or the result would be subnormal or out of range.
+static bool eisel_lemire(uint64_t w, int64_t q, double *out) {
+    if (q < PYC_POW5_MIN || q > PYC_POW5_MAX) return false;
+    const uint64_t *p = pyc_pow5_128[q - PYC_POW5_MIN];
+
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+    unsigned __int128 product = (unsigned __int128) w * p[0];
+    uint64_t upper = product >> 64;
+    uint64_t lower = (uint64_t) product;
+
+    // the high half alone may be off by one in the bits that decide the rounding, take the low half in too
+    if ((upper & 0x1FF) == 0x1FF && lower + w < lower) {
+        product = (unsigned __int128) w * p[1];
+        uint64_t low = (uint64_t) product;
+        uint64_t middle = lower + (uint64_t) (product >> 64);
+        if (middle < lower) upper++;
+        if (middle + 1 == 0 && (upper & 0x1FF) == 0x1FF && low + w < low) return false;
+        lower = middle;
+    }
+
+    uint64_t upper_bit = upper >> 63;
+    uint64_t mantissa = upper >> (upper_bit + 9);
+    lz += (int) (1 ^ upper_bit);
+
+    // exactly halfway, the truncated approximation can't tell which way to round
+    if (lower == 0 && (upper & 0x1FF) == 0 && (mantissa & 3) == 1) return false;
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= 1ull << 53) {
+        mantissa = 1ull << 52;
+        lz--;
+    }
+    mantissa &= ~(1ull << 52);
+
+    int64_t exponent = ((217706 * q) >> 16) + 1024 + 63 - lz;
+    if (exponent < 1 || exponent > 2046) return false;
+
+    uint64_t bits = mantissa | (uint64_t) exponent << 52;
+    memcpy(out, &bits, sizeof(bits));
+    return true;
+}
+
+static double parse_float_slow(const char *s, size_t len) {
+    char stack[128];
+    char *buf = len < sizeof(stack) ? stack : malloc(len + 1);
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] != '_') buf[n++] = s[i];
+    }
+    buf[n] = '\0';
+
+    double d = strtod(buf, NULL);
+    if (buf != stack) free(buf);
+    return d;
+}
+
+double pyc_parse_float(const char *s, size_t len) {
+    uint64_t w = 0;
+    int64_t exp10 = 0;
+    size_t digits = 0;
+    bool dot = false;
+    bool truncated = false;
+    size_t i = 0;
+
+    for (; i < len; i++) {
+        char c = s[i];
+        if (c == '_') continue;
+        if (c == '.') {
+            dot = true;
+            continue;
+        }
+        if (c < '0' || c > '9') break;
+
+        if (w == 0 && c == '0') {
+            if (dot) exp10--;
+            continue;
+        }
+
+        // only the first 19 significant digits fit, the rest just scale the value
+        if (digits < 19) {
+            w = w * 10 + (c - '0');
+            digits++;
+            if (dot) exp10--;
+        } else {
+            if (c != '0') truncated = true;
+            if (!dot) exp10++;
+        }
+    }
+
+    if (i < len) {
+        i++;
+        bool negative = false;
+        if (s[i] == '+' || s[i] == '-') negative = s[i++] == '-';
+
+        int64_t e = 0;
+        for (; i < len; i++) {
+            if (s[i] != '_' && e < 100000) e = e * 10 + (s[i] - '0');
+        }
+        exp10 += negative ? -e : e;
+    }
+
+    if (w == 0) return 0.0;
+
+    // Clinger: both operands are exact doubles, so the IEEE operation rounds correctly on its own
+    if (!truncated && w <= 1ull << 53 && exp10 >= -22 && exp10 <= 22) {
+        return exp10 < 0 ? (double) w / exact_pow10[-exp10] : (double) w * exact_pow10[exp10];
+    }
+
+    // with dropped digits the value is between w and w + 1, fine as long as both round the same way
+    double d, d_up;
+    if (eisel_lemire(w, exp10, &d) && (!truncated || (eisel_lemire(w + 1, exp10, &d_up) && d == d_up))) return d;
+
+    return parse_float_slow(s, len);
+}
@@ -0,0 +1,17 @@
+#ifndef PYC_NUMBER_H
+#define PYC_NUMBER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Parsers for numeric literals that were already validated by the lexer. Both work on the source bytes in place
+// and skip the '_' separators.
+
+// Parses digits of the given base (2, 8, 10 or 16) without prefix. Returns false if the value doesn't fit in 64 bits.
+bool pyc_parse_uint(const char *s, size_t len, int base, uint64_t *out);
+
+// Parses a decimal float literal with the correctly rounded (round half to even) result.
+double pyc_parse_float(const char *s, size_t len);
+
+#endif // PYC_NUMBER_H
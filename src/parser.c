@@ -1,104 +1,103 @@
 #include "parser.h"
+#include "cache.h"
+#include "dump.h"
 #include "lexer.h"
+#include "walk.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "misc-no-recursion"
 // ReSharper disable CppParameterNamesMismatch
-static bool paren = false;
-
-size_t count_indent(size_t index) {
-    size_t spaces = 0;
-
-    for (size_t i = index - 1; i-- > 0;) {
-        char ch = pyc_code[i];
-        if (ch == ' ' || ch == '\t') spaces++;
-        else break;
-    }
 
-    return spaces;
+void pyc_parser_init(pyc_parser *ps, pyc_lexer *lx) {
+    *ps = (pyc_parser){
+        .lx = lx,
+        .tokens = lx->tokens.data,
+        .kinds = lx->kinds.data,
+        .tok_count = lx->tokens.size,
+    };
 }
 
-node *parse_file(node *parent, char *filename, char *code) {
+node *parse_file(pyc_parser *ps, node *parent, char *filename) {
+    pyc_lexer *lx = ps->lx;
     node *mod = ast_node_create(parent);
     mod->type = NODE_MODULE;
     mod->module.filename = filename;
-    mod->module.code = code;
-    mod->module.tokens = pyc_tokens;
-    mod->module.code_len = pyc_code_len;
-    node *parsed = ast_node_create(mod);
-    parse_statements(parsed); // pls do this after processing: node_clear(&parsed);
+    mod->module.code = lx->code;
+    mod->module.code_len = lx->code_len;
+
+    node *parsed = ps->cache_dir != NULL ? pyc_cache_load(ps->cache_dir, lx, mod) : NULL;
+    if (parsed == NULL) {
+        if (ps->cache_dir != NULL && lx->tokens.size == 0) {
+            pyc_lex_tokenize(lx);
+            ps->tokens = lx->tokens.data;
+            ps->kinds = lx->kinds.data;
+            ps->tok_count = lx->tokens.size;
+        }
+        parsed = ast_node_create(mod);
+        parse_statements(ps, parsed); // pls do this after processing: node_clear(&parsed);
+        if (ps->cache_dir != NULL && !ps->lazy_bodies)
+            pyc_cache_store(ps->cache_dir, lx, parsed);
+    }
+    mod->module.tokens = lx->tokens;
     return parsed;
 }
 
-size_t get_node_tok_index(size_t expect, bool care_colon, bool care_comma, bool anyways) {
-    int p1 = 0, p2 = 0, p3 = 0;
-
-    for (size_t i = pyc_ti; i < pyc_tok_count; i++) {
-        token tok = pyc_tokens.data[i];
-        size_t tok_type = tok.type;
-        size_t tok_type_t = tok_type & 0xf;
-        if (p1 == 0 && p2 == 0 && p3 == 0 && tok.type == expect) {
-            return i;
-        }
-
-        if (tok_type_t == TOKEN_KEYWORD || tok_type_t == TOKEN_SET_OPERATOR ||
-            tok_type_t == TOKEN_FSTRING_MIDDLE ||
-            tok_type_t == TOKEN_FSTRING_END ||
-            tok_type == TOKEN_LINE_BREAK_SEMICOLON ||
-            (!paren && tok_type == TOKEN_LINE_BREAK_NEWLINE) ||
-            (care_colon && tok_type == TOKEN_SYMBOL_COLON) ||
-            (care_comma && tok_type == TOKEN_SYMBOL_COMMA) ||
-            tok_type == TOKEN_SYMBOL_EXC) {
-            return anyways ? i : -1;
-        }
-
-        switch (tok_type) {
-            case TOKEN_SYMBOL_LPAREN:
-                p1++;
-                break;
-            case TOKEN_SYMBOL_LBRACKET:
-                p2++;
-                break;
-            case TOKEN_SYMBOL_LBRACE:
-                p3++;
-                break;
-            case TOKEN_SYMBOL_RPAREN:
-                if (p1 == 0) {
-                    if (anyways)
-                        continue;
-                    return -1;
-                }
-                p1--;
-                break;
-            case TOKEN_SYMBOL_RBRACKET:
-                if (p2 == 0) {
-                    if (anyways)
-                        continue;
-                    return -1;
-                }
-                p2--;
-                break;
-            case TOKEN_SYMBOL_RBRACE:
-                if (p3 == 0) {
-                    if (anyways)
-                        continue;
-                    return -1;
-                }
-                p3--;
-                break;
-            default:
-                break;
+// Finds the token of the expected kind that is not inside of brackets opened after ps->ti. The search ends at the
+// closing bracket of the pair around ps->ti, or at a stop (see token_kind_is_stop) at any depth, which includes
+// newlines outside of parens and colons if care_colon is set. Returns -1 if it isn't found, or with anyways set
+// the index of the stop (the end of the tokens if there is none) and closing brackets don't end the search.
+// The lexer's tables make this a few lookups, only kinds that aren't stops themselves (like in) are searched for
+// by walking over the tokens at depth 0, skipping over the bracket pairs.
+size_t get_node_tok_index(pyc_parser *ps, size_t expect, bool care_colon, bool anyways) {
+    pyc_lexer *lx = ps->lx;
+    uint16_t *kinds = ps->kinds;
+    uint32_t *groups = lx->groups.data;
+    size_t end = ps->tok_count;
+    if (ps->ti >= end)
+        return anyways ? end : -1;
+
+    size_t stop = lx->next_stop.data[ps->ti];
+    if (!ps->paren && lx->next_newline.data[ps->ti] < stop)
+        stop = lx->next_newline.data[ps->ti];
+    if (care_colon && lx->next_colon.data[ps->ti] < stop)
+        stop = lx->next_colon.data[ps->ti];
+    if (stop > end)
+        stop = end;
+
+    // the closing bracket of the pair around ps->ti
+    uint16_t kind = kinds[ps->ti];
+    size_t group_end = token_kind_is_close(kind) ? ps->ti
+                       : token_kind_is_open(kind) ? groups[groups[ps->ti]]
+                       : groups[ps->ti];
+
+    bool expect_stops = token_kind_is_stop(expect) ||
+                        (!ps->paren && expect == TOKEN_LINE_BREAK_NEWLINE) ||
+                        (care_colon && expect == TOKEN_SYMBOL_COLON);
+    if (!expect_stops) {
+        size_t limit = anyways || stop < group_end ? stop : group_end;
+        for (size_t i = ps->ti; i < limit; i++) {
+            if (kinds[i] == expect)
+                return i;
+            if (token_kind_is_open(kinds[i]))
+                i = groups[i];
         }
     }
 
-    return anyways ? pyc_tok_count : -1;
+    if (stop < end && kinds[stop] == expect && (anyways || groups[stop] == group_end))
+        return stop;
+
+    return anyways ? stop : -1;
 }
 
 node *simplify_group(node *ex) {
     nodes grp;
     while (ex->type == NODE_GROUP && (grp = ex->group.v).size == 1) {
         ex = grp.data[0];
-        free(grp.data);
+        pyc_ast_free(grp.data);
     }
     return ex;
 }
@@ -107,7 +106,7 @@ node *simplify_group(node *ex) {
 bool trim_group(node *ex) {
     if (ex->group.v.size == 1) {
         node *el = ex->group.v.data[0];
-        free(ex->group.v.data);
+        pyc_ast_free(ex->group.v.data);
         *ex = *el;
         return true;
     }
@@ -123,19 +122,12 @@ bool trim_group(node *ex) {
      tok_type == TOKEN_SYMBOL_RBRACKET || tok_type == TOKEN_SYMBOL_RBRACE ||   \
      tok_type == TOKEN_SYMBOL_EXC)
 
-void parser_ignore_type() {
-    size_t end_ind = get_node_tok_index(TOKEN_SET_OPERATOR_EQ, true, false, true);
+void parser_ignore_type(pyc_parser *ps) {
+    size_t end_ind = get_node_tok_index(ps, TOKEN_SET_OPERATOR_EQ, true, true);
     if (end_ind != -1)
-        pyc_ti = end_ind;
+        ps->ti = end_ind;
 }
 
-nodes pratt_tokens;
-size_t pratt_tok_count;
-size_t pratt_pos;
-bool pratt_free; // basically frees operators if true
-
-#define pratt_tokens_over() (pratt_pos >= pratt_tok_count)
-
 static inline size_t pratt_lbp(size_t tok_type) {
     switch (tok_type) {
         case TOKEN_OPERATOR_WALRUS:
@@ -144,8 +136,6 @@ static inline size_t pratt_lbp(size_t tok_type) {
             return 2;
         case TOKEN_OPERATOR_AND:
             return 3;
-        case TOKEN_OPERATOR_NOT:
-            return 4;
         case TOKEN_OPERATOR_IN:
         case TOKEN_OPERATOR_IS:
         case TOKEN_OPERATOR_NOT_IN:
@@ -182,207 +172,172 @@ static inline size_t pratt_lbp(size_t tok_type) {
     }
 }
 
-node *parse_pratt_iter(size_t rbp) {
-    node *nd = pratt_tokens.data[pratt_pos++];
-    node *left = nd;
-    if (nd->type == EXPR_OPERATOR) {
-        token *tok = nd->operator;
-        size_t tok_type = tok->type;
-        if (tok_type == TOKEN_OPERATOR_ADD || tok_type == TOKEN_OPERATOR_SUB || tok_type == TOKEN_OPERATOR_BIT_NOT ||
-            tok_type == TOKEN_OPERATOR_NOT) {
-            left = ast_node_create(nd->parent);
-            left->type = EXPR_UNARY_OPERATION;
-            left->unary_op.op = tok;
-            left->unary_op.expr = parse_pratt_iter(100);
-            if (pratt_free) node_free(nd);
-        }
+// The binding power of the operand of a prefix operator, 0 if the operator can't start an expression.
+// The starred forms (*args, **kwargs) take a bitwise or expression like in the grammar.
+static inline size_t pratt_prefix_rbp(size_t tok_type) {
+    switch (tok_type) {
+        case TOKEN_OPERATOR_NOT:
+            return 4;
+        case TOKEN_OPERATOR_MUL:
+        case TOKEN_OPERATOR_POW:
+            return 5;
+        case TOKEN_OPERATOR_ADD:
+        case TOKEN_OPERATOR_SUB:
+        case TOKEN_OPERATOR_BIT_NOT:
+            return 11;
+        default:
+            return 0;
     }
+}
 
-    while (!pratt_tokens_over()) {
-        node *now = pratt_tokens.data[pratt_pos];
-        if (now->type != EXPR_OPERATOR) break;
+// newlines don't end an expression inside of brackets
+static inline void skip_paren_newlines(pyc_parser *ps) {
+    while (ps->paren && !tokens_over() && tok_now_teq(TOKEN_LINE_BREAK_NEWLINE))
+        ps->ti++;
+}
 
-        token *tok = now->operator;
-        size_t tok_type = tok->type;
-        if (pratt_lbp(tok->type) <= rbp) break;
-        pratt_pos++;
+// An atom followed by its trailers (attributes, calls and indexes).
+static node *parse_operand(pyc_parser *ps, node *parent) {
+    node *ex = ast_node_create(parent);
+    parse_expression_next(ps, ex);
+    ex = simplify_group(ex);
 
-        node *new_left = ast_node_create(now->parent);
-        switch (tok_type) {
-            case TOKEN_OPERATOR_WALRUS:
-                new_left->type = EXPR_BINARY_OPERATION;
-                new_left->bin_op.left = left;
-                new_left->bin_op.right = parse_pratt_iter(pratt_lbp(tok_type));
-                break;
-            case TOKEN_OPERATOR_LT:
-            case TOKEN_OPERATOR_GT:
-            case TOKEN_OPERATOR_LTE:
-            case TOKEN_OPERATOR_GTE:
-            case TOKEN_OPERATOR_EQ:
-            case TOKEN_OPERATOR_NEQ:
-            case TOKEN_OPERATOR_IN:
-            case TOKEN_OPERATOR_NOT:
-            case TOKEN_OPERATOR_IS:
-            case TOKEN_OPERATOR_IS_NOT:
-            case TOKEN_OPERATOR_NOT_IN:
-                new_left->type = EXPR_CMP_OPERATION;
-                tokens_p *cmp_ops = &new_left->cmp_op.op;
-                nodes *cmp_ex = &new_left->cmp_op.ex;
-                tokens_p_init(cmp_ops);
-                nodes_init(cmp_ex);
-                cmp_ex->data[0] = left;
-                cmp_ex->size = 1;
-                nodes_push(cmp_ex, parse_pratt_iter(5));
-
-                while (!pratt_tokens_over()) {
-                    node *new_nd = pratt_tokens.data[pratt_pos];
-                    if (new_nd->type != EXPR_OPERATOR) {
-                        nodes_print(pratt_tokens);
-                        raise_error("SyntaxError: expected an operator");
-                    }
+    while (true) {
+        skip_paren_newlines(ps);
+        if (tokens_over())
+            return ex;
 
-                    token *new_tok = new_nd->operator;
-                    size_t new_tok_type = new_tok->type;
-                    if (new_tok_type == TOKEN_OPERATOR_LT || new_tok_type == TOKEN_OPERATOR_GT ||
-                        new_tok_type == TOKEN_OPERATOR_LTE || new_tok_type == TOKEN_OPERATOR_GTE ||
-                        new_tok_type == TOKEN_OPERATOR_EQ || new_tok_type == TOKEN_OPERATOR_NEQ ||
-                        new_tok_type == TOKEN_OPERATOR_IN || new_tok_type == TOKEN_OPERATOR_NOT ||
-                        new_tok_type == TOKEN_OPERATOR_IS || new_tok_type == TOKEN_OPERATOR_IS_NOT ||
-                        new_tok_type == TOKEN_OPERATOR_NOT_IN) {
-                        tokens_p_push(cmp_ops, new_tok);
-                        if (pratt_free) node_free(new_nd);
-                        pratt_pos++;
-                        nodes_push(cmp_ex, parse_pratt_iter(5));
-                    } else break;
-                }
-                break;
-            default:
-                new_left->type = EXPR_BINARY_OPERATION;
-                new_left->bin_op.left = left;
-                new_left->bin_op.op = tok;
-                new_left->bin_op.right = parse_pratt_iter(
-                    pratt_lbp(tok_type) - (tok_type == TOKEN_OPERATOR_POW ? 1 : 0));
-                break;
-        }
+        size_t tok_type = token_peek(0).type;
+        if (tok_type != TOKEN_SYMBOL_DOT && tok_type != TOKEN_SYMBOL_LPAREN &&
+            tok_type != TOKEN_SYMBOL_LBRACKET)
+            return ex;
 
-        left = new_left;
+        node *trailer = ast_node_create(parent);
+        parse_expression_trailer(ps, trailer, ex);
+        ex = trailer;
     }
-
-    return left;
 }
 
-node *parse_pratt(nodes t) {
-    pratt_tokens = t;
-    pratt_tok_count = t.size;
-    pratt_pos = 0;
-    pratt_free = true;
-
-    if (pratt_tokens.size == 0) {
+// Precedence climbing over the tokens, parses the operators that bind stronger than rbp.
+static node *parse_pratt(pyc_parser *ps, node *parent, size_t rbp) {
+    skip_paren_newlines(ps);
+    if (tokens_over())
         raise_error("SyntaxError: expected an expression");
-    }
-
-    return parse_pratt_iter(0);
-}
 
-void parse_expression_group(node *ex) {
-    ex->type = NODE_GROUP;
-    nodes *group = &ex->group.v;
-    nodes_init(group);
-    size_t start = pyc_ti;
-    bool trim = ex->parent == NULL || ex->parent->type != STMT_FUNCTION_DEF;
+    node *left;
+    token *tok_p = &token_peek(0);
+    if ((tok_p->type & 0xf) == TOKEN_OPERATOR) {
+        size_t prefix_rbp = pratt_prefix_rbp(tok_p->type);
+        if (prefix_rbp == 0)
+            syntax_error();
+        ps->ti++;
 
-    while (!tokens_over()) {
-        token tok = token_peek(0);
-        size_t tok_type = tok.type;
-        size_t tok_type_t = tok_type & 0xf;
+        left = ast_node_create(parent);
+        left->type = EXPR_UNARY_OPERATION;
+        left->unary_op.op = tok_p;
+        left->unary_op.expr = parse_pratt(ps, parent, prefix_rbp);
+    } else {
+        left = parse_operand(ps, parent);
+    }
 
-        if (tok_type == TOKEN_LINE_BREAK_NEWLINE && paren) {
-            pyc_ti++;
-            continue;
-        }
+    while (true) {
+        skip_paren_newlines(ps);
+        if (tokens_over())
+            break;
 
-        if (tok_type != TOKEN_KEYWORD_LAMBDA &&
-            expression_ends(tok, tok_type)) {
-            if (start == pyc_ti) {
-                syntax_error();
+        tok_p = &token_peek(0);
+        size_t tok_type = tok_p->type;
+        size_t lbp = pratt_lbp(tok_type);
+        if (lbp <= rbp)
+            break;
+        ps->ti++;
+
+        node *new_left = ast_node_create(parent);
+        if (lbp == 5) {
+            new_left->type = EXPR_CMP_OPERATION;
+            tokens_p *cmp_ops = &new_left->cmp_op.op;
+            nodes *cmp_ex = &new_left->cmp_op.ex;
+            tokens_p_init(cmp_ops);
+            nodes_init(cmp_ex);
+            nodes_push(cmp_ex, left);
+            tokens_p_push(cmp_ops, tok_p);
+            nodes_push(cmp_ex, parse_pratt(ps, parent, 5));
+
+            // a < b < c is a single comparison
+            while (!tokens_over() && pratt_lbp(token_peek(0).type) == 5) {
+                tokens_p_push(cmp_ops, &token_peek(0));
+                ps->ti++;
+                nodes_push(cmp_ex, parse_pratt(ps, parent, 5));
             }
-
-            break;
+        } else {
+            new_left->type = EXPR_BINARY_OPERATION;
+            new_left->bin_op.left = left;
+            new_left->bin_op.op = tok_p;
+            // ** and := are right associative
+            new_left->bin_op.right = parse_pratt(
+                ps, parent, lbp - (tok_type == TOKEN_OPERATOR_POW || tok_type == TOKEN_OPERATOR_WALRUS ? 1 : 0));
         }
 
-        if (start != pyc_ti &&
-            (tok_type == TOKEN_KEYWORD_FOR || tok_type == TOKEN_KEYWORD_ASYNC ||
-             tok_type == TOKEN_KEYWORD_IF))
-            break;
-
-        node *child = ast_node_create(ex);
-        parse_expression_next(child);
-        child = simplify_group(child);
-        nodes_push(group, child);
+        left = new_left;
     }
 
-    if (ex->group.v.size == 0) {
-        syntax_error();
-    }
+    return left;
+}
+
+void parse_expression_group(pyc_parser *ps, node *ex) {
+    ex->type = NODE_GROUP;
+    node *parent = ex->parent;
+    bool trim = parent == NULL || parent->type != STMT_FUNCTION_DEF;
+
+    node *res = parse_pratt(ps, ex, 0);
 
     if (!tokens_over()) {
-        if (tok_now_teq(TOKEN_KEYWORD_IF)) {
+        token tok = token_peek(0);
+        size_t tok_type = tok.type;
+        size_t tok_type_t = tok_type & 0xf;
+
+        if (tok_type == TOKEN_KEYWORD_IF) {
             node *ch = ast_node_create(ex);
             ch->type = EXPR_IF_EXP;
-            node *if_expr = ast_node_create(ex);
-            if_expr->group = ex->group;
-            if (!trim_group(if_expr))
-                if_expr->type = NODE_GROUP;
-            ch->if_else_expr.if_expr = if_expr;
+            ch->if_else_expr.if_expr = res;
 
-            pyc_ti++;
-            ch->if_else_expr.condition = parse_expression_group_child(ch);
+            ps->ti++;
+            ch->if_else_expr.condition = parse_expression_group_child(ps, ch);
 
             assert_tokenP(TOKEN_KEYWORD_ELSE);
 
-            ch->if_else_expr.else_expr = parse_expression_group_child(ch);
-
-            nodes_init(&ex->group.v); // re-initialize it because we're using it
-            // in the if_expr
-            ex->group.v.data[0] = ch;
-            ex->group.v.size = 1;
-        } else if (tok_now_teq(TOKEN_KEYWORD_FOR) ||
-                   tok_now_teq(TOKEN_KEYWORD_ASYNC)) {
+            ch->if_else_expr.else_expr = parse_expression_group_child(ps, ch);
+            res = ch;
+        } else if (tok_type == TOKEN_KEYWORD_FOR || tok_type == TOKEN_KEYWORD_ASYNC) {
             node *ch = ast_node_create(ex);
             ch->type = EXPR_GENERATOR;
             node *val_expr = ast_node_create(ex);
             val_expr->type = NODE_GROUP;
-            val_expr->group = ex->group;
+            nodes_init(&val_expr->group.v);
+            nodes_push(&val_expr->group.v, res);
             ch->generator.value = val_expr;
             comprehensions_init(&ch->generator.comp);
 
-            parse_comprehensions_post(ex, &ch->generator.comp);
-
-            nodes_init(&ex->group.v); // re-initialize it because we're using it
-            // in the if_expr
-            ex->group.v.data[0] = ch;
-            ex->group.v.size = 1;
+            parse_comprehensions_post(ps, ex, &ch->generator.comp);
+            res = ch;
+        } else if (tok_type == TOKEN_KEYWORD_LAMBDA || !expression_ends(tok, tok_type)) {
+            syntax_error();
         }
     }
 
-    if (ex->group.v.size > 1) {
-        node *res = parse_pratt(ex->group.v);
-        if (trim) {
-            free(ex->group.v.data);
-            *ex = *res;
-            free(res);
-        } else {
-            ex->group.v.data[0] = res;
-            ex->group.v.size = 1;
-            nodes_shrink(&ex->group.v);
-        }
-    } else if (!trim || !trim_group(ex)) {
-        nodes_shrink(group);
+    if (trim) {
+        *ex = *res;
+        ex->parent = parent;
+        pyc_ast_free(res);
+    } else {
+        nodes_init(&ex->group.v);
+        nodes_push(&ex->group.v, res);
+        nodes_shrink(&ex->group.v);
     }
 }
 
-void parse_expression(node *ex) {
-    parse_expression_tuple(ex);
+void parse_expression(pyc_parser *ps, node *ex) {
+    parse_expression_tuple(ps, ex);
 
     if (ex->tuple.v.size == 1 && char_peek(-1) != ',') {
         _Static_assert(sizeof(ex->group) == sizeof(ex->tuple) &&
@@ -390,32 +345,32 @@ void parse_expression(node *ex) {
                        "Group and tuple do not match in size (and equal to 32 or `nodes+token*`).");
         if (!trim_group(ex))
             ex->type = NODE_GROUP;
-    } else if (!paren && ex->tuple.v.size == 0) {
+    } else if (!ps->paren && ex->tuple.v.size == 0) {
         raise_error("SyntaxError: expected an expression");
     }
 }
 
-node *parse_expression_group_child(node *parent) {
+node *parse_expression_group_child(pyc_parser *ps, node *parent) {
     node *expr = ast_node_create(parent);
-    parse_expression_group(expr);
+    parse_expression_group(ps, expr);
     return simplify_group(expr);
 }
 
-node *parse_expression_tuple_child(node *parent) {
+node *parse_expression_tuple_child(pyc_parser *ps, node *parent) {
     node *expr = ast_node_create(parent);
-    parse_expression_tuple(expr);
+    parse_expression_tuple(ps, expr);
     return simplify_group(expr);
 }
 
-node *parse_expression_child(node *parent) {
+node *parse_expression_child(pyc_parser *ps, node *parent) {
     node *expr = ast_node_create(parent);
-    parse_expression(expr);
+    parse_expression(ps, expr);
     return expr;
 }
 
-void parse_expression_lambda(node *ex) {
+void parse_expression_lambda(pyc_parser *ps, node *ex) {
     ex->lambda.tok = &token_peek(0);
-    pyc_ti++;
+    ps->ti++;
     ex->type = EXPR_LAMBDA;
     tokens_p *args = &ex->lambda.args;
     tokens_p_init(args);
@@ -425,7 +380,7 @@ void parse_expression_lambda(node *ex) {
         token tok = *tok_p;
 
         if (tok.type == TOKEN_SYMBOL_COLON) {
-            pyc_ti++;
+            ps->ti++;
             break;
         }
 
@@ -442,10 +397,10 @@ void parse_expression_lambda(node *ex) {
         }
 
         tokens_p_push(args, tok_p);
-        pyc_ti++;
+        ps->ti++;
 
         token t = token_peek(0);
-        pyc_ti++;
+        ps->ti++;
 
         if (t.type == TOKEN_SYMBOL_COLON) {
             break;
@@ -456,28 +411,58 @@ void parse_expression_lambda(node *ex) {
         }
     }
 
-    ex->lambda.body = parse_expression_group_child(ex);
+    ex->lambda.body = parse_expression_group_child(ps, ex);
 }
 
-void parse_expression_fstring(node *ex) {
+// The format spec after the ':' is text, only the replacement fields nested in it (like {width}) are expressions.
+static void parse_fstring_spec(pyc_parser *ps, node *spec, token *colon) {
+    spec->type = NODE_GROUP;
+    spec->group.tok = colon;
+    nodes_init(&spec->group.v);
+
+    while (!tokens_over()) {
+        token tok = token_peek(0);
+        size_t tok_type_t = tok.type & 0xf;
+        if (tok_type_t == TOKEN_FSTRING_MIDDLE || tok_type_t == TOKEN_FSTRING_END)
+            break;
+
+        ps->ti++;
+        if (tok.type == TOKEN_SYMBOL_LBRACE) {
+            bool p = ps->paren;
+            ps->paren = true;
+            nodes_push(&spec->group.v, parse_expression_child(ps, spec));
+            assert_tokenP(TOKEN_SYMBOL_RBRACE);
+            ps->paren = p;
+        }
+    }
+
+    nodes_shrink(&spec->group.v);
+}
+
+void parse_expression_fstring(pyc_parser *ps, node *ex) {
     ex->type = EXPR_FORMAT_STRING;
     ex->fstring.start_string = &token_peek(0);
     nodes_init(&ex->fstring.values);
+    nodes_init(&ex->fstring.extras);
     tokens_p_init(&ex->fstring.strings);
-    pyc_ti++;
+    ps->ti++;
 
     while (!tokens_over()) {
-        node *childExpr = parse_expression_child(ex);
+        node *childExpr = parse_expression_child(ps, ex);
         nodes_push(&ex->fstring.values, childExpr);
 
         token tk = token_peek(0);
 
         if (tk.type == TOKEN_SYMBOL_EXC || tk.type == TOKEN_SYMBOL_COLON) {
-            pyc_ti++;
+            token *sep = &token_peek(0);
+            ps->ti++;
             if (tokens_over())
                 syntax_error();
             node *t = ast_node_create(ex);
-            parse_expression(t);
+            if (tk.type == TOKEN_SYMBOL_COLON)
+                parse_fstring_spec(ps, t, sep);
+            else
+                parse_expression(ps, t);
             nodes_push(&ex->fstring.extras, t);
         } else
             nodes_push(&ex->fstring.extras, NULL);
@@ -493,7 +478,7 @@ void parse_expression_fstring(node *ex) {
 
         tokens_p_push(&ex->fstring.strings, tok_p);
 
-        pyc_ti++;
+        ps->ti++;
 
         if (tok_type_t == TOKEN_FSTRING_END) {
             break;
@@ -504,7 +489,7 @@ void parse_expression_fstring(node *ex) {
     tokens_p_shrink(&ex->fstring.strings);
 }
 
-void accumulate_tuple_expression(node *parent, nodes *tuple) {
+void accumulate_tuple_expression(pyc_parser *ps, node *parent, nodes *tuple) {
     bool found_named_arg = false;
     bool last_comma = false;
 
@@ -513,8 +498,8 @@ void accumulate_tuple_expression(node *parent, nodes *tuple) {
         size_t tok_type = tok.type;
         size_t tok_type_t = tok_type & 0xf;
 
-        if (tok_type == TOKEN_LINE_BREAK_NEWLINE && paren) {
-            pyc_ti++;
+        if (tok_type == TOKEN_LINE_BREAK_NEWLINE && ps->paren) {
+            ps->ti++;
             continue;
         }
 
@@ -522,7 +507,7 @@ void accumulate_tuple_expression(node *parent, nodes *tuple) {
             if (last_comma)
                 syntax_error();
             last_comma = true;
-            pyc_ti++;
+            ps->ti++;
             continue;
         }
 
@@ -530,7 +515,7 @@ void accumulate_tuple_expression(node *parent, nodes *tuple) {
             break;
 
         last_comma = false;
-        nodes_push(tuple, parse_expression_group_child(parent));
+        nodes_push(tuple, parse_expression_group_child(ps, parent));
 
         if (tokens_over())
             break;
@@ -539,7 +524,7 @@ void accumulate_tuple_expression(node *parent, nodes *tuple) {
     nodes_shrink(tuple);
 }
 
-void accumulate_call_arguments(node *parent) {
+void accumulate_call_arguments(pyc_parser *ps, node *parent) {
     bool found_named_arg = false;
     bool last_comma = false;
     nodes *args = &parent->call.args;
@@ -557,7 +542,7 @@ void accumulate_call_arguments(node *parent) {
             break;
 
         if (tok_type == TOKEN_LINE_BREAK_NEWLINE) {
-            pyc_ti++;
+            ps->ti++;
             continue;
         }
 
@@ -565,19 +550,19 @@ void accumulate_call_arguments(node *parent) {
             if (last_comma)
                 syntax_error();
             last_comma = true;
-            pyc_ti++;
+            ps->ti++;
             continue;
         }
 
         last_comma = false;
 
-        if (tok_type_t == TOKEN_IDENTIFIER && pyc_ti + 1 < pyc_tok_count &&
+        if (tok_type_t == TOKEN_IDENTIFIER && ps->ti + 1 < ps->tok_count &&
             token_peek(1).type == TOKEN_SET_OPERATOR_EQ) {
             found_named_arg = true;
-            pyc_ti += 2;
+            ps->ti += 2;
             if (tokens_over())
                 syntax_error();
-            keyword kw = {.name = tok_p, .value = parse_expression_group_child(parent)};
+            keyword kw = {.name = tok_p, .value = parse_expression_group_child(ps, parent)};
             keywords_push(kws, kw);
             continue;
         } else if (found_named_arg && !tok_val_eq(tok, "**") &&
@@ -585,7 +570,7 @@ void accumulate_call_arguments(node *parent) {
             syntax_error();
         }
 
-        node *ch = parse_expression_group_child(parent);
+        node *ch = parse_expression_group_child(ps, parent);
         nodes_push(args, ch);
 
         if (tokens_over())
@@ -595,36 +580,36 @@ void accumulate_call_arguments(node *parent) {
     nodes_shrink(args);
 }
 
-void parse_expression_tuple(node *ex) {
+void parse_expression_tuple(pyc_parser *ps, node *ex) {
     ex->type = EXPR_TUPLE;
     nodes_init(&ex->tuple.v);
-    accumulate_tuple_expression(ex, &ex->tuple.v);
+    accumulate_tuple_expression(ps, ex, &ex->tuple.v);
 }
 
-void parse_expression_list(node *ex) {
+void parse_expression_list(pyc_parser *ps, node *ex) {
     ex->type = EXPR_LIST;
     ex->list.tok = &token_peek(-1);
     nodes_init(&ex->list.v);
-    accumulate_tuple_expression(ex, &ex->list.v);
+    accumulate_tuple_expression(ps, ex, &ex->list.v);
 }
 
-void parse_expression_set(node *ex) {
+void parse_expression_set(pyc_parser *ps, node *ex) {
     ex->type = EXPR_SET;
     ex->set.tok = &token_peek(-1);
     nodes_init(&ex->set.v);
-    accumulate_tuple_expression(ex, &ex->set.v);
+    accumulate_tuple_expression(ps, ex, &ex->set.v);
 }
 
-void parse_expression_dict(node *ex) {
+void parse_expression_dict(pyc_parser *ps, node *ex) {
     ex->type = EXPR_DICT;
     nodes_init(&ex->dict.keys);
     nodes_init(&ex->dict.values);
-    size_t start = pyc_ti;
+    size_t start = ps->ti;
     nodes *keys = &ex->dict.keys;
     nodes *values = &ex->dict.values;
 
     while (!tokens_over()) {
-        token *tok_p = &pyc_tokens.data[pyc_ti];
+        token *tok_p = &token_peek(0);
         token tok = *tok_p;
         size_t tok_type = tok.type;
         size_t tok_type_t = tok_type & 0xf;
@@ -633,7 +618,7 @@ void parse_expression_dict(node *ex) {
             break;
 
         if (tok_type == TOKEN_LINE_BREAK_NEWLINE) {
-            pyc_ti++;
+            ps->ti++;
             continue;
         }
 
@@ -641,16 +626,16 @@ void parse_expression_dict(node *ex) {
             tok_type_t == TOKEN_SET_OPERATOR ||
             tok_type_t == TOKEN_FSTRING_MIDDLE ||
             tok_type_t == TOKEN_FSTRING_END) {
-            if (start == pyc_ti) {
+            if (start == ps->ti) {
                 syntax_error();
             }
 
             break;
         }
 
-        nodes_push(keys, parse_expression_group_child(ex));
+        nodes_push(keys, parse_expression_group_child(ps, ex));
         assert_tokenP(TOKEN_SYMBOL_COLON);
-        nodes_push(values, parse_expression_group_child(ex));
+        nodes_push(values, parse_expression_group_child(ps, ex));
 
         if (token_peek(0).type == TOKEN_SYMBOL_RBRACE)
             break;
@@ -662,46 +647,47 @@ void parse_expression_dict(node *ex) {
     nodes_shrink(values);
 }
 
-void parse_comprehensions_post(node *parent, comprehensions *list) {
+void parse_comprehensions_post(pyc_parser *ps, node *parent, comprehensions *list) {
     while (!tokens_over()) {
         bool is_async = tok_now_teq(TOKEN_KEYWORD_ASYNC);
         if (is_async)
-            pyc_ti++;
+            ps->ti++;
 
         if (!tok_now_teq(TOKEN_KEYWORD_FOR))
             break;
-        pyc_ti++;
+        ps->ti++;
 
         comprehension comp;
         comp.is_async = is_async;
         nodes_init(&comp.ifs);
 
-        size_t in_token = get_node_tok_index(TOKEN_OPERATOR_IN, true, false, false);
+        size_t in_token = get_node_tok_index(ps, TOKEN_OPERATOR_IN, true, false);
         if (in_token == -1) {
             syntax_error();
         }
 
-        pyc_tok_count = in_token;
-        comp.target = parse_expression_child(parent);
-        pyc_tok_count = pyc_tokens.size;
+        size_t count = ps->tok_count;
+        ps->tok_count = in_token;
+        comp.target = parse_expression_child(ps, parent);
+        ps->tok_count = count;
         assert_tokenP(TOKEN_OPERATOR_IN);
 
-        size_t if_token = get_node_tok_index(TOKEN_KEYWORD_IF, true, false, false);
+        size_t if_token = get_node_tok_index(ps, TOKEN_KEYWORD_IF, true, false);
         if (if_token != -1)
-            pyc_tok_count = if_token;
-        comp.iter = parse_expression_child(parent);
-        pyc_tok_count = pyc_tokens.size;
+            ps->tok_count = if_token;
+        comp.iter = parse_expression_child(ps, parent);
+        ps->tok_count = count;
 
-        size_t else_token = get_node_tok_index(TOKEN_KEYWORD_ELSE, true, false, false);
+        size_t else_token = get_node_tok_index(ps, TOKEN_KEYWORD_ELSE, true, false);
 
         if (else_token != -1) {
-            raise_error_t(pyc_tokens.data[else_token],
+            raise_error_t(ps->tokens[else_token],
                           "SyntaxError: invalid syntax");
         }
 
         while (!tokens_over() && tok_now_teq(TOKEN_KEYWORD_IF)) {
-            pyc_ti++;
-            nodes_push(&comp.ifs, parse_expression_group_child(parent));
+            ps->ti++;
+            nodes_push(&comp.ifs, parse_expression_group_child(ps, parent));
         }
 
         nodes_shrink(&comp.ifs);
@@ -712,20 +698,20 @@ void parse_comprehensions_post(node *parent, comprehensions *list) {
     comprehensions_shrink(list);
 }
 
-void parse_comprehensions(node *valueExpr, comprehensions *list) {
+void parse_comprehensions(pyc_parser *ps, node *valueExpr, comprehensions *list) {
     node *parent = valueExpr->parent;
     if (parent == NULL)
         fail();
 
-    parse_expression(valueExpr);
+    parse_expression(ps, valueExpr);
 
-    parse_comprehensions_post(parent, list);
+    parse_comprehensions_post(ps, parent, list);
 }
 
-void parse_expression_list_comp(node *ex) {
+void parse_expression_list_comp(pyc_parser *ps, node *ex) {
     ex->type = EXPR_LIST_COMP;
 
-    node *gen = parse_expression_child(ex);
+    node *gen = parse_expression_child(ps, ex);
     if (gen->type != EXPR_GENERATOR) {
         syntax_error();
     }
@@ -733,13 +719,13 @@ void parse_expression_list_comp(node *ex) {
     ex->list_comp.value = gen->generator.value;
     ex->list_comp.comp = gen->generator.comp;
 
-    free(gen);
+    pyc_ast_free(gen);
 }
 
-void parse_expression_set_comp(node *ex) {
+void parse_expression_set_comp(pyc_parser *ps, node *ex) {
     ex->type = EXPR_SET_COMP;
 
-    node *gen = parse_expression_child(ex);
+    node *gen = parse_expression_child(ps, ex);
     if (gen->type != EXPR_GENERATOR) {
         syntax_error();
     }
@@ -747,12 +733,12 @@ void parse_expression_set_comp(node *ex) {
     ex->set_comp.value = gen->generator.value;
     ex->set_comp.comp = gen->generator.comp;
 
-    free(gen);
+    pyc_ast_free(gen);
 }
 
-void parse_expression_dict_comp(node *ex) {
+void parse_expression_dict_comp(pyc_parser *ps, node *ex) {
     ex->type = EXPR_DICT_COMP;
-    ex->dict_comp.key = parse_expression_group_child(ex);
+    ex->dict_comp.key = parse_expression_group_child(ps, ex);
 
     assert_tokenP(TOKEN_SYMBOL_COLON);
 
@@ -760,291 +746,268 @@ void parse_expression_dict_comp(node *ex) {
     comprehensions *comp = &ex->dict_comp.comp;
     comprehensions_init(comp);
 
-    parse_comprehensions(valueExpr, comp);
+    parse_comprehensions(ps, valueExpr, comp);
 }
 
-void parse_expression_await(node *ex) {
-    pyc_ti++;
+void parse_expression_await(pyc_parser *ps, node *ex) {
+    ps->ti++;
     ex->type = EXPR_AWAIT;
-    ex->await = parse_expression_group_child(ex);
+    ex->await = parse_expression_group_child(ps, ex);
 }
 
-void parse_expression_yield(node *ex) {
-    pyc_ti++;
+void parse_expression_yield(pyc_parser *ps, node *ex) {
+    ps->ti++;
 
     if (tokens_over())
         syntax_error();
 
     if (tok_peek_teq(1, TOKEN_KEYWORD_FROM)) {
-        pyc_ti++;
+        ps->ti++;
         ex->type = EXPR_YIELD_FROM;
-        ex->yield_from = parse_expression_group_child(ex);
+        ex->yield_from = parse_expression_group_child(ps, ex);
     } else {
         ex->type = EXPR_YIELD;
-        ex->yield = parse_expression_group_child(ex);
+        ex->yield = parse_expression_group_child(ps, ex);
     }
 }
 
-void parse_expression_next(node *ex) {
+void parse_expression_next(pyc_parser *ps, node *ex) {
     token *tok_p = &token_peek(0);
     token tok = *tok_p;
     size_t tok_type = tok.type;
     size_t tok_type_t = tok_type & 0xf;
 
     if (tok_type == TOKEN_KEYWORD_LAMBDA)
-        return parse_expression_lambda(ex);
+        return parse_expression_lambda(ps, ex);
     else if (tok_type == TOKEN_KEYWORD_AWAIT)
-        return parse_expression_await(ex);
+        return parse_expression_await(ps, ex);
     else if (tok_type == TOKEN_KEYWORD_YIELD)
-        return parse_expression_yield(ex);
+        return parse_expression_yield(ps, ex);
 
-    if (tok_type_t == TOKEN_INTEGER || tok_type_t == TOKEN_FLOAT ||
+    if (tok_type_t == TOKEN_INTEGER || tok_type_t == TOKEN_BIG_INTEGER || tok_type_t == TOKEN_FLOAT ||
         tok_type_t == TOKEN_BOOLEAN || tok_type_t == TOKEN_STRING ||
         tok_type_t == TOKEN_NONE) {
         ex->type = EXPR_CONSTANT;
         ex->constant = tok_p;
-        pyc_ti++;
+        ps->ti++;
         return;
     }
 
     if (tok_type_t == TOKEN_FSTRING_START) {
-        parse_expression_fstring(ex);
+        parse_expression_fstring(ps, ex);
         return;
     }
 
     if (tok_type_t == TOKEN_IDENTIFIER) {
         ex->type = EXPR_IDENTIFIER;
         ex->identifier = tok_p;
-        pyc_ti++;
-        return;
-    }
-
-    if (tok_type_t == TOKEN_OPERATOR) {
-        ex->type = EXPR_OPERATOR;
-        ex->operator = tok_p;
-        pyc_ti++;
+        ps->ti++;
         return;
     }
 
     if (tok_type_t == TOKEN_SYMBOL) {
-        node *parent = ex->parent;
-        bool p = paren;
+        bool p = ps->paren;
         switch (tok_type) {
-            case TOKEN_SYMBOL_DOT:
-                pyc_ti++;
-                token *tok2_p = &token_peek(0);
-                token tok2 = *tok2_p;
-                if ((tok2.type & 0xf) != TOKEN_IDENTIFIER &&
-                    tok2.type != TOKEN_KEYWORD_MATCH) {
-                    syntax_error();
-                }
-                pyc_ti++;
-
-                if (parent == NULL || parent->type != NODE_GROUP ||
-                    parent->group.v.size == 0)
-                    syntax_error();
-
-                node *base = nodes_pop(&parent->group.v);
-
-                base->parent = ex;
-                ex->type = EXPR_ATTRIBUTE;
-                ex->attribute.base = base;
-                ex->attribute.key = tok2_p;
-                break;
             case TOKEN_SYMBOL_LPAREN:
-                pyc_ti++;
-                paren = true;
-                if (parent && parent->type == NODE_GROUP &&
-                    parent->group.v.size >= 1) {
-                    node *back = *nodes_back(parent->group.v);
-                    if (back->type != EXPR_OPERATOR &&
-                        back->type != EXPR_CONSTANT) {
-                        nodes_pop(&parent->group.v);
-                        ex->type = EXPR_CALL;
-                        back->parent = ex;
-                        ex->call.base = back;
-                        if (token_peek(0).type == TOKEN_SYMBOL_RPAREN) {
-                            pyc_ti++;
-                            nodes_init(&ex->call.args);
-                            keywords_init(&ex->call.kws);
-                            paren = p;
-                            return;
-                        } else {
-                            accumulate_call_arguments(ex);
-                        }
-
-                        assert_tokenP(TOKEN_SYMBOL_RPAREN);
-                        paren = p;
-                        return;
-                    }
-                }
-
-                parse_expression(ex);
+                ps->ti++;
+                ps->paren = true;
+                parse_expression(ps, ex);
                 if (ex->type == NODE_GROUP) {
                     ex->group.tok = tok_p;
                 }
 
                 assert_tokenP(TOKEN_SYMBOL_RPAREN);
-                paren = p;
-                break;
+                ps->paren = p;
+                return;
             case TOKEN_SYMBOL_LBRACKET:
-                pyc_ti++;
-                paren = true;
-
-                if (parent && parent->type == NODE_GROUP &&
-                    parent->group.v.size >= 1) {
-                    node *back = nodes_pop(&parent->group.v);
-                    ex->type = EXPR_INDEX;
-                    back->parent = ex;
-                    ex->index.base = back;
-                    ex->index.slices[0] = NULL;
-                    ex->index.slices[1] = NULL;
-                    ex->index.slices[2] = NULL;
-                    token t2;
-                    for (int i = 0; i < 3; i++) {
-                        t2 = token_peek(0);
-
-                        if (t2.type == TOKEN_SYMBOL_RBRACKET)
-                            break;
-
-                        if (t2.type == TOKEN_SYMBOL_COLON) {
-                            pyc_ti++;
-                        } else {
-                            node *sl = parse_expression_child(ex);
-                            ex->index.slices[i] = sl;
-                            if (tokens_over() ||
-                                ((t2 = token_peek(0)).type != TOKEN_SYMBOL_COLON &&
-                                 t2.type != TOKEN_SYMBOL_RBRACKET))
-                                syntax_error();
-                            if (i == 2)
-                                break;
-                            if (t2.type == TOKEN_SYMBOL_COLON) {
-                                pyc_ti++;
-                            }
-                        }
-                    }
-
-                    if (t2.type != TOKEN_SYMBOL_RBRACKET)
-                        syntax_error();
-                    pyc_ti++;
-                    paren = p;
-                    return;
-                }
-
-                size_t for_index = get_node_tok_index(TOKEN_KEYWORD_FOR, true, false, false);
+                ps->ti++;
+                ps->paren = true;
+                size_t for_index = get_node_tok_index(ps, TOKEN_KEYWORD_FOR, true, false);
 
                 if (for_index != -1) {
-                    parse_expression_list_comp(ex);
+                    parse_expression_list_comp(ps, ex);
                 } else {
-                    parse_expression_list(ex);
+                    parse_expression_list(ps, ex);
                 }
 
                 assert_tokenP(TOKEN_SYMBOL_RBRACKET);
-                paren = p;
-                break;
+                ps->paren = p;
+                return;
             case TOKEN_SYMBOL_LBRACE:
-                pyc_ti++;
-                paren = true;
-                size_t for_ind = get_node_tok_index(TOKEN_KEYWORD_FOR, false, false, false);
-                size_t colon_ind = get_node_tok_index(TOKEN_SYMBOL_COLON, true, false, false);
+                ps->ti++;
+                ps->paren = true;
+                size_t for_ind = get_node_tok_index(ps, TOKEN_KEYWORD_FOR, false, false);
+                size_t colon_ind = get_node_tok_index(ps, TOKEN_SYMBOL_COLON, true, false);
 
                 if (for_ind != -1) {
                     if (colon_ind != -1) {
                         comprehensions_init(&ex->dict_comp.comp);
-                        parse_expression_dict_comp(ex);
+                        parse_expression_dict_comp(ps, ex);
                     } else {
                         comprehensions_init(&ex->set_comp.comp);
-                        parse_expression_set_comp(ex);
+                        parse_expression_set_comp(ps, ex);
                     }
                 } else if (colon_ind != -1)
-                    parse_expression_dict(ex);
+                    parse_expression_dict(ps, ex);
                 else
-                    parse_expression_set(ex);
+                    parse_expression_set(ps, ex);
                 assert_tokenP(TOKEN_SYMBOL_RBRACE);
-                paren = p;
-                break;
+                ps->paren = p;
+                return;
             default:
                 break;
         }
-        return;
     }
 
     syntax_error();
 }
 
-// does the indentation check etc. used 3 times in the content so might as well...
-#define indent_group_macro_thing(tok_type, tok, spaces, spaces_parent, found)  \
-    if (tok_type == TOKEN_LINE_BREAK_NEWLINE) {                                \
-        pyc_ti++;                                                              \
-        while (!tokens_over() && token_type_peek_t(0) == TOKEN_LINE_BREAK)     \
-            pyc_ti++;                                                          \
-        if (tokens_over())                                                     \
-            break;                                                             \
-        tok = token_peek(0);                                                   \
-        int s = count_indent(tok.start);                                       \
-                                                                               \
-        if (found) {                                                           \
-            if (s < spaces) {                                                  \
-                if (pyc_ti != 0)                                               \
-                    pyc_ti--;                                                  \
-                break;                                                         \
-            } else if (s > spaces)                                             \
-                tab_error();                                                   \
-        } else {                                                               \
-            if (spaces_parent != 0 && s <= spaces_parent) {                    \
-                if (pyc_ti != 0)                                               \
-                    pyc_ti--;                                                  \
-                break;                                                         \
-            }                                                                  \
-                                                                               \
-            found = true;                                                      \
-            spaces = s;                                                        \
-        }                                                                      \
-    }
-
-#define equal_indent_group_macro_thing(tok_type, tok, spaces)                  \
-    if (tok_type == TOKEN_LINE_BREAK_NEWLINE) {                                \
-        pyc_ti++;                                                              \
-        while (!tokens_over() && token_type_peek_t(0) == TOKEN_LINE_BREAK)     \
-            pyc_ti++;                                                          \
-        if (tokens_over())                                                     \
-            break;                                                             \
-        tok = token_peek(0);                                                   \
-        int s = count_indent(tok.start);                                       \
-        if (spaces_parent != 0 && s != spaces_parent) {                        \
-            if (pyc_ti != 0)                                                   \
-                pyc_ti--;                                                      \
-            break;                                                             \
-        }                                                                      \
-        tok_type = tok.type;                                                   \
+// Parses the attribute, call or index at ps->ti that is applied to base.
+void parse_expression_trailer(pyc_parser *ps, node *ex, node *base) {
+    token tok = token_peek(0);
+    bool p = ps->paren;
+    base->parent = ex;
+    ps->ti++;
+
+    switch (tok.type) {
+        case TOKEN_SYMBOL_DOT:
+            if (tokens_over())
+                syntax_error();
+            token *key_p = &token_peek(0);
+            if ((key_p->type & 0xf) != TOKEN_IDENTIFIER &&
+                key_p->type != TOKEN_KEYWORD_MATCH) {
+                syntax_error();
+            }
+            ps->ti++;
+
+            ex->type = EXPR_ATTRIBUTE;
+            ex->attribute.base = base;
+            ex->attribute.key = key_p;
+            break;
+        case TOKEN_SYMBOL_LPAREN:
+            ps->paren = true;
+            ex->type = EXPR_CALL;
+            ex->call.base = base;
+            if (token_peek(0).type == TOKEN_SYMBOL_RPAREN) {
+                ps->ti++;
+                nodes_init(&ex->call.args);
+                keywords_init(&ex->call.kws);
+                ps->paren = p;
+                return;
+            }
+
+            accumulate_call_arguments(ps, ex);
+            assert_tokenP(TOKEN_SYMBOL_RPAREN);
+            ps->paren = p;
+            break;
+        case TOKEN_SYMBOL_LBRACKET:
+            ps->paren = true;
+            ex->type = EXPR_INDEX;
+            ex->index.base = base;
+            ex->index.slices[0] = NULL;
+            ex->index.slices[1] = NULL;
+            ex->index.slices[2] = NULL;
+            token t2;
+            for (int i = 0; i < 3; i++) {
+                t2 = token_peek(0);
+
+                if (t2.type == TOKEN_SYMBOL_RBRACKET)
+                    break;
+
+                if (t2.type == TOKEN_SYMBOL_COLON) {
+                    ps->ti++;
+                } else {
+                    node *sl = parse_expression_child(ps, ex);
+                    ex->index.slices[i] = sl;
+                    if (tokens_over() ||
+                        ((t2 = token_peek(0)).type != TOKEN_SYMBOL_COLON &&
+                         t2.type != TOKEN_SYMBOL_RBRACKET))
+                        syntax_error();
+                    if (i == 2)
+                        break;
+                    if (t2.type == TOKEN_SYMBOL_COLON) {
+                        ps->ti++;
+                    }
+                }
+            }
+
+            if (t2.type != TOKEN_SYMBOL_RBRACKET)
+                syntax_error();
+            ps->ti++;
+            ps->paren = p;
+            break;
+        default:
+            syntax_error();
     }
+}
+
+// The clauses that continue a compound statement (elif, else, except, ...) are on the line after the end of its
+// last body, that is right after the DEDENT of an indented body or after the newline of an inline one.
+// Moves to the clause if it is the given one.
+static bool clause_next(pyc_parser *ps, uint16_t kind) {
+    size_t i = ps->ti;
+    while (i < ps->tok_count && ps->kinds[i] == TOKEN_LINE_BREAK_NEWLINE)
+        i++;
+    if (i >= ps->tok_count || ps->kinds[i] != kind)
+        return false;
+
+    ps->ti = i;
+    return true;
+}
+
+// Moves into the indented block after a ':' and a newline, blank lines leave newline tokens in front of the INDENT.
+static void enter_block(pyc_parser *ps) {
+    while (!tokens_over() && tok_now_teq(TOKEN_LINE_BREAK_NEWLINE))
+        ps->ti++;
+    if (tokens_over() || !tok_now_teq(TOKEN_LINE_BREAK_INDENT))
+        indentation_error();
+    ps->ti++;
+}
 
 // def test():
-//            ^ this function is run right here. right after the ':'. allowing
-//            the use of semicolons
-void parse_statement_group(node *st, int spaces_parent) {
+//            ^ this function is run right here. right after the ':'. the
+//            body is either the rest of the line or the indented block below.
+// The top level is a block without indentation that ends with the source.
+void parse_statement_group(pyc_parser *ps, node *st, bool top_level) {
     st->type = NODE_GROUP;
     node *parent = st->parent;
     bool class_def = parent != NULL && parent->type == STMT_CLASS_DEF;
-    bool match_def = parent != NULL && parent->type == STMT_MATCH;
-    if (!class_def && !match_def) nodes_init(&st->group.v);
-    else if (st->parent == NULL)
-        fail();
-    int spaces = spaces_parent;
-    bool found = false;
+    if (!class_def) nodes_init(&st->group.v);
     bool added_any = false;
     if (tokens_over())
         raise_error("expected a statement");
+
+    bool inline_body = !top_level && !tok_now_teq(TOKEN_LINE_BREAK_NEWLINE);
+    if (!top_level && !inline_body)
+        enter_block(ps);
     token start = token_peek(0);
 
     while (!tokens_over()) {
         token tok = token_peek(0);
-        size_t tok_type = tok.type;
+        uint16_t kind = token_kind_peek(0);
+
+        if (kind == TOKEN_LINE_BREAK_SEMICOLON ||
+            (kind == TOKEN_LINE_BREAK_NEWLINE && !inline_body)) {
+            ps->ti++;
+            continue;
+        }
 
-        indent_group_macro_thing(tok_type, tok, spaces, spaces_parent, found)
+        // an inline body ends with its line, the DEDENT of an enclosing block
+        // is left to that block
+        if (inline_body && (kind & 0xf) == TOKEN_LINE_BREAK)
+            break;
+
+        if (kind == TOKEN_LINE_BREAK_DEDENT) {
+            ps->ti++;
+            break;
+        }
+
+        // an INDENT spans the indentation, point at the token after it
+        if (kind == TOKEN_LINE_BREAK_INDENT)
+            pyc_lex_error(ps->lx, tok.end, "IndentationError: unexpected indent", false);
 
         node *childStmt = ast_node_create(st);
-        parse_statement_next(childStmt, spaces);
+        parse_statement_next(ps, childStmt);
 
         added_any = true;
 
@@ -1069,53 +1032,111 @@ void parse_statement_group(node *st, int spaces_parent) {
         nodes_shrink(&st->group.v);
 }
 
-node *parse_statement_group_child(node *parent, int spaces_parent) {
+node *parse_statement_group_child(pyc_parser *ps, node *parent) {
     node *st = ast_node_create(parent);
-    parse_statement_group(st, spaces_parent);
+    parse_statement_group(ps, st, false);
     return st;
 }
 
-void parse_statement_group_match_def(node *parent, int spaces_parent) {
+// Moves past the tokens parse_statement_group would take for a body, without parsing them. Returns false if they
+// don't look like a body, the parse has to report what is wrong then.
+static bool skip_statement_group(pyc_parser *ps) {
+    uint16_t *kinds = ps->kinds;
+    size_t i = ps->ti, end = ps->tok_count;
+    if (i >= end)
+        return false;
+
+    if (kinds[i] != TOKEN_LINE_BREAK_NEWLINE) {
+        // the rest of the line, brackets can go on over newlines
+        size_t depth = 0;
+        for (; i < end; i++) {
+            uint16_t kind = kinds[i];
+            if (depth == 0 && (kind & 0xf) == TOKEN_LINE_BREAK && kind != TOKEN_LINE_BREAK_SEMICOLON)
+                break;
+            if (token_kind_is_open(kind))
+                depth++;
+            else if (token_kind_is_close(kind) && depth > 0)
+                depth--;
+        }
+        if (i == ps->ti)
+            return false;
+    } else {
+        while (i < end && kinds[i] == TOKEN_LINE_BREAK_NEWLINE)
+            i++;
+        if (i >= end || kinds[i] != TOKEN_LINE_BREAK_INDENT)
+            return false;
+        // there is no INDENT or DEDENT inside brackets, the block ends with the DEDENT back to where it started
+        size_t indent = 0;
+        for (; i < end; i++) {
+            if (kinds[i] == TOKEN_LINE_BREAK_INDENT) {
+                indent++;
+            } else if (kinds[i] == TOKEN_LINE_BREAK_DEDENT && --indent == 0) {
+                i++;
+                break;
+            }
+        }
+    }
+
+    ps->ti = i;
+    return true;
+}
+
+void parse_lazy_group(node *st) {
+    pyc_parser ps;
+    pyc_parser_init(&ps, st->lazy.lx);
+    ps.ti = st->lazy.start;
+    ps.tok_count = st->lazy.end;
+    ps.lazy_bodies = true;
+    token *first = &ps.tokens[ps.ti];
+    parse_statement_group(&ps, st, false);
+    st->group.tok = first;
+}
+
+void parse_statement_group_match_def(pyc_parser *ps, node *parent) {
     match_cases_init(&parent->match.cases);
-    int spaces = spaces_parent;
-    bool found = false;
+    enter_block(ps);
 
     while (!tokens_over()) {
-        token tok = token_peek(0);
-        size_t tok_type = tok.type;
+        if (tok_now_teq(TOKEN_LINE_BREAK_NEWLINE)) {
+            ps->ti++;
+            continue;
+        }
 
-        indent_group_macro_thing(tok_type, tok, spaces, spaces_parent, found)
+        if (tok_now_teq(TOKEN_LINE_BREAK_DEDENT)) {
+            ps->ti++;
+            break;
+        }
 
         if (!tok_now_teq(TOKEN_KEYWORD_CASE))
             syntax_error();
-        pyc_ti++;
+        ps->ti++;
 
         match_case cas;
-        size_t if_index = get_node_tok_index(TOKEN_KEYWORD_IF, true, false, false);
-        size_t len = pyc_tok_count;
+        size_t if_index = get_node_tok_index(ps, TOKEN_KEYWORD_IF, true, false);
+        size_t len = ps->tok_count;
         if (if_index != -1)
-            pyc_tok_count = if_index;
-        cas.pattern = parse_expression_child(parent);
-        pyc_tok_count = len;
+            ps->tok_count = if_index;
+        cas.pattern = parse_expression_child(ps, parent);
+        ps->tok_count = len;
         if (tok_now_teq(TOKEN_KEYWORD_AS)) {
-            pyc_ti++;
+            ps->ti++;
             token *tok2 = &token_peek(0);
             if ((tok2->type & 0xf) != TOKEN_IDENTIFIER)
                 syntax_error();
             cas.as = tok2;
-            pyc_ti++;
+            ps->ti++;
         } else
             cas.as = NULL;
 
         if (tok_now_teq(TOKEN_KEYWORD_IF)) {
-            pyc_ti++;
-            cas.condition = parse_expression_group_child(parent);
+            ps->ti++;
+            cas.condition = parse_expression_group_child(ps, parent);
         } else
             cas.condition = NULL;
 
         assert_tokenP(TOKEN_SYMBOL_COLON);
 
-        cas.body = parse_statement_group_child(parent, spaces);
+        cas.body = parse_statement_group_child(ps, parent);
         match_cases_push(&parent->match.cases, cas);
     }
 
@@ -1125,26 +1146,21 @@ void parse_statement_group_match_def(node *parent, int spaces_parent) {
     match_cases_shrink(&parent->match.cases);
 }
 
-void parse_statement_group_try_catch(node *parent, int spaces_parent) {
+void parse_statement_group_try_catch(pyc_parser *ps, node *parent) {
     assert_tokenP(TOKEN_SYMBOL_COLON);
     except_handlers_init(&parent->try_catch.handlers);
     parent->try_catch.else_body = NULL;
     parent->try_catch.finally_body = NULL;
     parent->try_catch.is_star = false;
     parent->try_catch.try_body =
-            parse_statement_group_child(parent, spaces_parent);
+            parse_statement_group_child(ps, parent);
 
     while (!tokens_over()) {
-        token tok = token_peek(0);
-        size_t tok_type = tok.type;
-
-        equal_indent_group_macro_thing(tok_type, tok, spaces_parent)
-
-        if (tok_type == TOKEN_KEYWORD_EXCEPT) {
+        if (clause_next(ps, TOKEN_KEYWORD_EXCEPT)) {
             if (parent->try_catch.else_body != NULL ||
                 parent->try_catch.finally_body != NULL)
                 syntax_error();
-            pyc_ti++;
+            ps->ti++;
             if (tokens_over())
                 syntax_error();
             token t2 = token_peek(0);
@@ -1156,7 +1172,7 @@ void parse_statement_group_try_catch(node *parent, int spaces_parent) {
                     parent->try_catch.is_star = true;
                 }
 
-                pyc_ti++;
+                ps->ti++;
             } else {
                 if (parent->try_catch.is_star)
                     raise_error("Syntax Error: try statement cannot contain "
@@ -1164,40 +1180,40 @@ void parse_statement_group_try_catch(node *parent, int spaces_parent) {
             }
 
             except_handler handler;
-            handler.class = parse_expression_child(parent);
+            handler.class = parse_expression_child(ps, parent);
             if (tokens_over())
                 syntax_error();
 
             if (tok_now_teq(TOKEN_KEYWORD_AS)) {
-                pyc_ti++;
+                ps->ti++;
                 token *tok2;
                 if (tokens_over() ||
                     ((tok2 = &token_peek(0))->type & 0xf) != TOKEN_IDENTIFIER)
                     syntax_error();
                 handler.name = tok2;
-                pyc_ti++;
+                ps->ti++;
             } else {
                 handler.name = NULL;
             }
 
             assert_tokenP(TOKEN_SYMBOL_COLON);
-            handler.body = parse_statement_group_child(parent, spaces_parent);
+            handler.body = parse_statement_group_child(ps, parent);
             except_handlers_push(&parent->try_catch.handlers, handler);
-        } else if (tok_type == TOKEN_KEYWORD_ELSE) {
+        } else if (clause_next(ps, TOKEN_KEYWORD_ELSE)) {
             if (parent->try_catch.else_body != NULL ||
                 parent->try_catch.finally_body != NULL)
                 syntax_error();
-            pyc_ti++;
+            ps->ti++;
             assert_tokenP(TOKEN_SYMBOL_COLON);
             parent->try_catch.else_body =
-                    parse_statement_group_child(parent, spaces_parent);
-        } else if (tok_type == TOKEN_KEYWORD_FINALLY) {
+                    parse_statement_group_child(ps, parent);
+        } else if (clause_next(ps, TOKEN_KEYWORD_FINALLY)) {
             if (parent->try_catch.finally_body != NULL)
                 syntax_error();
-            pyc_ti++;
+            ps->ti++;
             assert_tokenP(TOKEN_SYMBOL_COLON);
             parent->try_catch.finally_body =
-                    parse_statement_group_child(parent, spaces_parent);
+                    parse_statement_group_child(ps, parent);
         } else break;
     }
 
@@ -1210,73 +1226,226 @@ void parse_statement_group_try_catch(node *parent, int spaces_parent) {
     except_handlers_shrink(&parent->try_catch.handlers);
 }
 
-void parse_statements(node *st) {
-    if (pyc_tok_count == 0) {
+size_t parse_top_level_end(pyc_parser *ps, size_t i, bool *decorated) {
+    uint16_t *kinds = ps->kinds;
+    size_t start = i, end = ps->tok_count, indent = 0, depth = 0;
+    bool line_start = true, statement_start = true, after_decorator = false;
+
+    for (; i < end; i++) {
+        uint16_t kind = kinds[i];
+        if (kind == TOKEN_LINE_BREAK_INDENT) {
+            indent++;
+            continue;
+        }
+        if (kind == TOKEN_LINE_BREAK_DEDENT) {
+            indent--;
+            continue;
+        }
+        // a decorator after a semicolon counts too, like parse_statement_group takes it
+        if (kind == TOKEN_LINE_BREAK_NEWLINE || kind == TOKEN_LINE_BREAK_SEMICOLON) {
+            line_start |= depth == 0 && kind == TOKEN_LINE_BREAK_NEWLINE;
+            statement_start |= depth == 0;
+            continue;
+        }
+
+        if (statement_start && indent == 0) {
+            bool clause = kind == TOKEN_KEYWORD_ELSE || kind == TOKEN_KEYWORD_ELIF ||
+                          kind == TOKEN_KEYWORD_EXCEPT || kind == TOKEN_KEYWORD_FINALLY;
+            if (line_start && i > start && !clause && !after_decorator)
+                break;
+            after_decorator = kind == TOKEN_OPERATOR_MAT_MUL;
+        }
+
+        line_start = statement_start = false;
+        if (token_kind_is_open(kind))
+            depth++;
+        else if (token_kind_is_close(kind))
+            depth--;
+    }
+
+    if (decorated != NULL)
+        *decorated = after_decorator;
+    return i;
+}
+
+// A file is only parsed on several threads if each of them gets at least this many tokens.
+#define PYC_PARALLEL_MIN_TOKENS (1 << 14)
+
+// Splits the tokens into up to count chunks of whole top level statements, each one starts at the first statement
+// at or after its share of the tokens. Fills in count + 1 bounds and returns the number of chunks.
+static size_t split_top_level(pyc_parser *ps, size_t *bounds, size_t count) {
+    size_t start = ps->ti, end = ps->tok_count, chunks = 1;
+    bounds[0] = start;
+
+    for (size_t i = start; i < end && chunks < count;) {
+        i = parse_top_level_end(ps, i, NULL);
+        if (i < end && i >= start + (end - start) / count * chunks)
+            bounds[chunks++] = i;
+    }
+
+    bounds[chunks] = end;
+    return chunks;
+}
+
+typedef struct {
+    pyc_parser *ps;
+    node *st;
+    // chunk i is the tokens from bounds[i] up to bounds[i + 1], groups[i] gets its statements
+    size_t *bounds;
+    node **groups;
+    size_t count;
+    atomic_size_t next;
+} parallel_parse;
+
+typedef struct {
+    parallel_parse *job;
+    pyc_arena arena;
+    bool use_arena;
+} parse_worker;
+
+static void parse_chunks(parallel_parse *job) {
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        pyc_parser ps = *job->ps;
+        ps.ti = job->bounds[i];
+        ps.tok_count = job->bounds[i + 1];
+        ps.threads = 0;
+        node *group = ast_node_create(job->st);
+        parse_statement_group(&ps, group, true);
+        job->groups[i] = group;
+    }
+}
+
+static void *parse_worker_run(void *arg) {
+    parse_worker *worker = arg;
+    if (worker->use_arena)
+        pyc_ast_arena = &worker->arena;
+    parse_chunks(worker->job);
+    pyc_ast_arena = NULL;
+    return NULL;
+}
+
+// The calling thread parses chunks too, with its own pyc_ast_arena.
+static void parse_statements_parallel(pyc_parser *ps, node *st) {
+    size_t count = ps->threads * 4;
+    size_t most = (ps->tok_count - ps->ti) / PYC_PARALLEL_MIN_TOKENS;
+    if (count > most)
+        count = most;
+
+    size_t *bounds = malloc((count + 1) * sizeof(size_t));
+    node **groups = malloc(count * sizeof(node *));
+    parallel_parse job = {.ps = ps, .st = st, .bounds = bounds, .groups = groups};
+    job.count = split_top_level(ps, bounds, count);
+    atomic_init(&job.next, 0);
+
+    size_t helpers = (ps->threads < job.count ? ps->threads : job.count) - 1;
+    parse_worker *workers = malloc(helpers * sizeof(parse_worker));
+    pthread_t *threads = malloc(helpers * sizeof(pthread_t));
+    size_t started = 0;
+    for (; started < helpers; started++) {
+        workers[started] = (parse_worker){
+            .job = &job,
+            .arena = pyc_arena(pyc_ast_arena != NULL ? pyc_ast_arena->chunk_size : 0),
+            .use_arena = pyc_ast_arena != NULL,
+        };
+        if (pthread_create(&threads[started], NULL, parse_worker_run, &workers[started]) != 0)
+            break;
+    }
+
+    parse_chunks(&job);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        if (workers[i].use_arena)
+            pyc_arena_adopt(pyc_ast_arena, &workers[i].arena);
+    }
+
+    st->type = NODE_GROUP;
+    nodes_init(&st->group.v);
+    for (size_t i = 0; i < job.count; i++) {
+        nodes statements = groups[i]->group.v;
+        for (size_t j = 0; j < statements.size; j++) {
+            statements.data[j]->parent = st;
+            nodes_push(&st->group.v, statements.data[j]);
+        }
+        pyc_ast_free(statements.data);
+        pyc_ast_free(groups[i]);
+    }
+    nodes_shrink(&st->group.v);
+    ps->ti = ps->tok_count;
+
+    free(threads);
+    free(workers);
+    free(groups);
+    free(bounds);
+}
+
+void parse_statements(pyc_parser *ps, node *st) {
+    if (ps->tok_count == 0) {
         st->type = NODE_GROUP;
         nodes_init(&st->group.v);
         return;
     }
 
-    parse_statement_group(st, 0);
+    if (ps->threads > 1 && ps->tok_count - ps->ti >= ps->threads * PYC_PARALLEL_MIN_TOKENS) {
+        parse_statements_parallel(ps, st);
+        return;
+    }
+
+    parse_statement_group(ps, st, true);
 }
 
-void parse_statement_for(node *st, int spaces_parent) {
+void parse_statement_for(pyc_parser *ps, node *st) {
     bool is_async = tok_now_teq(TOKEN_KEYWORD_ASYNC);
-    pyc_ti++;
+    ps->ti++;
     if (is_async) {
         if (tokens_over() || !tok_now_teq(TOKEN_KEYWORD_FOR))
             syntax_error();
-        pyc_ti++;
+        ps->ti++;
     } else if (!tok_peek_teq(-1, TOKEN_KEYWORD_FOR))
         syntax_error();
 
     st->type = STMT_FOR;
     st->for_loop.is_async = is_async;
 
-    size_t in_token = get_node_tok_index(TOKEN_OPERATOR_IN, true, false, false);
+    size_t in_token = get_node_tok_index(ps, TOKEN_OPERATOR_IN, true, false);
     if (in_token == -1) {
         syntax_error();
     }
 
-    pyc_tok_count = in_token;
-    st->for_loop.value = parse_expression_child(st);
-    pyc_tok_count = pyc_tokens.size;
+    size_t count = ps->tok_count;
+    ps->tok_count = in_token;
+    st->for_loop.value = parse_expression_child(ps, st);
+    ps->tok_count = count;
     assert_tokenP(TOKEN_OPERATOR_IN);
-    st->for_loop.iter = parse_expression_child(st);
+    st->for_loop.iter = parse_expression_child(ps, st);
     assert_tokenP(TOKEN_SYMBOL_COLON);
-    st->for_loop.body = parse_statement_group_child(st, spaces_parent);
+    st->for_loop.body = parse_statement_group_child(ps, st);
 
-    token tok = token_peek(0);
-    size_t tok_type = tok.type;
-    do {
-        equal_indent_group_macro_thing(tok_type, tok, spaces_parent)
-    } while (0);
-
-    if (tok_type == TOKEN_KEYWORD_ELSE) {
-        pyc_ti++;
+    if (clause_next(ps, TOKEN_KEYWORD_ELSE)) {
+        ps->ti++;
         assert_tokenP(TOKEN_SYMBOL_COLON);
         st->for_loop.else_body =
-                parse_statement_group_child(st, spaces_parent);
+                parse_statement_group_child(ps, st);
     } else {
         st->for_loop.else_body = NULL;
     }
 }
 
-void parse_statement_while(node *st, int spaces_parent) {
+void parse_statement_while(pyc_parser *ps, node *st) {
     st->type = STMT_WHILE;
-    pyc_ti++;
-    st->while_loop.cond = parse_expression_group_child(st);
+    ps->ti++;
+    st->while_loop.cond = parse_expression_group_child(ps, st);
     assert_tokenP(TOKEN_SYMBOL_COLON);
-    st->while_loop.body = parse_statement_group_child(st, spaces_parent);
+    st->while_loop.body = parse_statement_group_child(ps, st);
 }
 
-void parse_statement_with(node *st, int spaces_parent) {
+void parse_statement_with(pyc_parser *ps, node *st) {
     bool is_async = tok_now_teq(TOKEN_KEYWORD_ASYNC);
-    pyc_ti++;
+    ps->ti++;
     if (is_async) {
         if (tokens_over() || !tok_now_teq(TOKEN_KEYWORD_WITH))
             syntax_error();
-        pyc_ti++;
+        ps->ti++;
     } else if (!tok_peek_teq(-1, TOKEN_KEYWORD_WITH))
         syntax_error();
 
@@ -1286,7 +1455,7 @@ void parse_statement_with(node *st, int spaces_parent) {
     nodes_init(&st->with.contexts);
 
     while (!tokens_over()) {
-        node *context = parse_expression_child(st);
+        node *context = parse_expression_child(ps, st);
         nodes_push(&st->with.contexts, context);
         if (tokens_over())
             syntax_error();
@@ -1294,14 +1463,14 @@ void parse_statement_with(node *st, int spaces_parent) {
         if (t.type == TOKEN_SYMBOL_COLON)
             break;
         if (t.type == TOKEN_SYMBOL_COMMA) {
-            pyc_ti++;
+            ps->ti++;
             tokens_p_push(&st->with.vars, NULL);
             continue;
         }
 
         if (!tok_now_teq(TOKEN_KEYWORD_AS))
             syntax_error();
-        pyc_ti++;
+        ps->ti++;
 
         token *tok_p = &token_peek(0);
         token tok = *tok_p;
@@ -1313,43 +1482,38 @@ void parse_statement_with(node *st, int spaces_parent) {
     if (tokens_over() || token_peek(0).type != TOKEN_SYMBOL_COLON ||
         st->with.contexts.size == 0)
         syntax_error();
-    pyc_ti++;
-    st->with.body = parse_statement_group_child(st, spaces_parent);
+    ps->ti++;
+    st->with.body = parse_statement_group_child(ps, st);
 
     nodes_shrink(&st->with.contexts);
     tokens_p_shrink(&st->with.vars);
 }
 
-void parse_statement_if(node *st, int spaces_parent) {
+void parse_statement_if(pyc_parser *ps, node *st) {
     st->type = STMT_IF;
-    pyc_ti++;
+    ps->ti++;
     nodes_init(&st->if_stmt.conditions);
     nodes_init(&st->if_stmt.bodies);
 
-    nodes_push(&st->if_stmt.conditions, parse_expression_child(st));
+    nodes_push(&st->if_stmt.conditions, parse_expression_child(ps, st));
     assert_tokenP(TOKEN_SYMBOL_COLON);
-    nodes_push(&st->if_stmt.bodies, parse_statement_group_child(st, spaces_parent));
+    nodes_push(&st->if_stmt.bodies, parse_statement_group_child(ps, st));
 
     while (!tokens_over()) {
-        token tok = token_peek(0);
-        size_t tok_type = tok.type;
-
-        equal_indent_group_macro_thing(tok_type, tok, spaces_parent)
-
-        if (tok_type == TOKEN_KEYWORD_ELIF) {
-            pyc_ti++;
-            nodes_push(&st->if_stmt.conditions, parse_expression_child(st));
+        if (clause_next(ps, TOKEN_KEYWORD_ELIF)) {
+            ps->ti++;
+            nodes_push(&st->if_stmt.conditions, parse_expression_child(ps, st));
             assert_tokenP(TOKEN_SYMBOL_COLON);
             nodes_push(&st->if_stmt.bodies,
-                       parse_statement_group_child(st, spaces_parent));
+                       parse_statement_group_child(ps, st));
             continue;
         }
 
-        if (tok_type == TOKEN_KEYWORD_ELSE) {
-            pyc_ti++;
+        if (clause_next(ps, TOKEN_KEYWORD_ELSE)) {
+            ps->ti++;
             assert_tokenP(TOKEN_SYMBOL_COLON);
             nodes_push(&st->if_stmt.conditions, NULL);
-            nodes_push(&st->if_stmt.bodies, parse_statement_group_child(st, spaces_parent));
+            nodes_push(&st->if_stmt.bodies, parse_statement_group_child(ps, st));
             break;
         }
 
@@ -1360,13 +1524,13 @@ void parse_statement_if(node *st, int spaces_parent) {
     nodes_shrink(&st->if_stmt.bodies);
 }
 
-void parse_statement_function_def(node *st, int spaces_parent) {
+void parse_statement_function_def(pyc_parser *ps, node *st) {
     bool is_async = tok_now_teq(TOKEN_KEYWORD_ASYNC);
-    pyc_ti++;
+    ps->ti++;
     if (is_async) {
         if (tokens_over() || !tok_now_teq(TOKEN_KEYWORD_DEF))
             syntax_error();
-        pyc_ti++;
+        ps->ti++;
     } else if (!tok_peek_teq(-1, TOKEN_KEYWORD_DEF))
         syntax_error();
 
@@ -1382,10 +1546,10 @@ void parse_statement_function_def(node *st, int spaces_parent) {
     if ((namePtr->type & 0xf) != TOKEN_IDENTIFIER)
         syntax_error();
     st->function_def.name = namePtr;
-    pyc_ti++;
+    ps->ti++;
 
-    bool p = paren;
-    paren = true;
+    bool p = ps->paren;
+    ps->paren = true;
 
     assert_tokenP(TOKEN_SYMBOL_LPAREN);
 
@@ -1411,13 +1575,13 @@ void parse_statement_function_def(node *st, int spaces_parent) {
         bool is_kw = tok2_type == TOKEN_OPERATOR_POW;
 
         if (is_ls) {
-            pyc_ti++;
+            ps->ti++;
             if (tokens_over() || st->function_def.ls_args != NULL)
                 syntax_error();
             st->function_def.ls_args = &token_peek(0);
             continue;
         } else if (is_kw) {
-            pyc_ti++;
+            ps->ti++;
             if (tokens_over() || st->function_def.kw_args != NULL)
                 syntax_error();
             st->function_def.kw_args = &token_peek(0);
@@ -1425,7 +1589,7 @@ void parse_statement_function_def(node *st, int spaces_parent) {
         }
 
         if (tok2.type == TOKEN_LINE_BREAK_NEWLINE) {
-            pyc_ti++;
+            ps->ti++;
             continue;
         }
 
@@ -1440,22 +1604,22 @@ void parse_statement_function_def(node *st, int spaces_parent) {
 
         tokens_p_push(args, tok2_p);
 
-        pyc_ti++;
+        ps->ti++;
 
         if (tokens_over())
             syntax_error();
 
         if (token_peek(0).type == TOKEN_SYMBOL_COLON) {
-            pyc_ti++;
-            parser_ignore_type();
+            ps->ti++;
+            parser_ignore_type(ps);
         }
 
         if (tokens_over())
             syntax_error();
 
         if (token_peek(0).type == TOKEN_SET_OPERATOR_EQ) {
-            pyc_ti++;
-            nodes_push(defaults, parse_expression_group_child(st));
+            ps->ti++;
+            nodes_push(defaults, parse_expression_group_child(ps, st));
         } else
             nodes_push(defaults, NULL);
 
@@ -1466,20 +1630,20 @@ void parse_statement_function_def(node *st, int spaces_parent) {
 
         if (t2.type == TOKEN_SYMBOL_RPAREN)
             break;
-        pyc_ti++;
+        ps->ti++;
     }
 
     assert_tokenP(TOKEN_SYMBOL_RPAREN);
 
-    paren = p;
+    ps->paren = p;
 
     token t2 = token_peek(0);
     if (t2.type == TOKEN_OPERATOR_SUB) {
-        pyc_ti++;
+        ps->ti++;
         if (tokens_over() || token_peek(0).type != TOKEN_OPERATOR_GT)
             syntax_error();
-        pyc_ti++;
-        node *ex = parse_expression_group_child(st);
+        ps->ti++;
+        node *ex = parse_expression_group_child(ps, st);
         node_free(ex);
         if (tokens_over())
             syntax_error();
@@ -1488,12 +1652,22 @@ void parse_statement_function_def(node *st, int spaces_parent) {
 
     if (t2.type != TOKEN_SYMBOL_COLON)
         syntax_error();
-    pyc_ti++;
-
-    st->function_def.body = parse_statement_group_child(st, spaces_parent);
+    ps->ti++;
+
+    size_t body_start = ps->ti;
+    if (ps->lazy_bodies && skip_statement_group(ps)) {
+        node *body = ast_node_create(st);
+        body->type = NODE_LAZY_GROUP;
+        body->lazy.lx = ps->lx;
+        body->lazy.start = body_start;
+        body->lazy.end = ps->ti;
+        st->function_def.body = body;
+        return;
+    }
+    st->function_def.body = parse_statement_group_child(ps, st);
 }
 
-void parse_statement_class(node *st, int spaces) {
+void parse_statement_class(pyc_parser *ps, node *st) {
     st->type = STMT_CLASS_DEF;
 
     nodes *dec = &st->class_def.decorators;
@@ -1501,13 +1675,13 @@ void parse_statement_class(node *st, int spaces) {
     dec->capacity = 0;
     dec->data = NULL;
 
-    pyc_ti++;
+    ps->ti++;
     if (tokens_over())
         syntax_error();
     token *tokName = &token_peek(0);
     if ((tokName->type & 0xf) != TOKEN_IDENTIFIER)
         syntax_error();
-    pyc_ti++;
+    ps->ti++;
     st->class_def.name = tokName;
 
     tokens_p *extends = &st->class_def.extends;
@@ -1515,13 +1689,13 @@ void parse_statement_class(node *st, int spaces) {
     nodes_init(&st->class_def.methods);
     nodes_init(&st->class_def.properties);
 
-    bool p = paren;
-    paren = true;
+    bool p = ps->paren;
+    ps->paren = true;
 
     if (tokens_over())
         syntax_error();
     if (token_peek(0).type == TOKEN_SYMBOL_LPAREN) {
-        pyc_ti++;
+        ps->ti++;
         while (!tokens_over()) {
             token *tok2_p = &token_peek(0);
             token tok2 = *tok2_p;
@@ -1530,7 +1704,7 @@ void parse_statement_class(node *st, int spaces) {
                 break;
 
             if (tok2.type == TOKEN_LINE_BREAK_NEWLINE) {
-                pyc_ti++;
+                ps->ti++;
                 continue;
             }
 
@@ -1539,7 +1713,7 @@ void parse_statement_class(node *st, int spaces) {
 
             tokens_p_push(extends, tok2_p);
 
-            pyc_ti++;
+            ps->ti++;
 
             if (tokens_over())
                 syntax_error();
@@ -1552,35 +1726,35 @@ void parse_statement_class(node *st, int spaces) {
 
             if (t2.type == TOKEN_SYMBOL_RPAREN)
                 break;
-            pyc_ti++;
+            ps->ti++;
         }
 
         assert_tokenP(TOKEN_SYMBOL_RPAREN);
     }
 
-    paren = p;
+    ps->paren = p;
 
     assert_tokenP(TOKEN_SYMBOL_COLON);
 
     // no need to allocate a node because we are in a class_def
     node temp = {.parent = st};
-    parse_statement_group(&temp, spaces);
+    parse_statement_group(ps, &temp, false);
     nodes_shrink(&st->class_def.methods);
     nodes_shrink(&st->class_def.properties);
     tokens_p_shrink(extends);
 }
 
-int parse_import_level() {
+int parse_import_level(pyc_parser *ps) {
     int level = 0;
     while (!tokens_over() && token_peek(0).type == TOKEN_SYMBOL_DOT) {
         level++;
-        pyc_ti++;
+        ps->ti++;
     }
 
     return level;
 }
 
-void parse_import_path(tokens_p *ls) {
+void parse_import_path(pyc_parser *ps, tokens_p *ls) {
     tokens_p_init(ls);
     while (!tokens_over()) {
         token *tok_p = &token_peek(0);
@@ -1590,14 +1764,14 @@ void parse_import_path(tokens_p *ls) {
             break;
 
         tokens_p_push(ls, tok_p);
-        pyc_ti++;
+        ps->ti++;
 
         if (tokens_over())
             break;
 
         token t = token_peek(0);
         if (t.type == TOKEN_SYMBOL_DOT) {
-            pyc_ti++;
+            ps->ti++;
             continue;
         }
 
@@ -1610,12 +1784,12 @@ void parse_import_path(tokens_p *ls) {
     }
 }
 
-void parse_import_aliases(import_aliases *imports) {
+void parse_import_aliases(pyc_parser *ps, import_aliases *imports) {
     import_aliases_init(imports);
 
     bool par = tok_now_teq(TOKEN_SYMBOL_LPAREN);
     if (par)
-        pyc_ti++;
+        ps->ti++;
 
     while (!tokens_over()) {
         import_alias alias;
@@ -1623,7 +1797,7 @@ void parse_import_aliases(import_aliases *imports) {
 
         if (par) {
             if (tok_p->type == TOKEN_LINE_BREAK_NEWLINE) {
-                pyc_ti++;
+                ps->ti++;
                 continue;
             } else if (tok_p->type == TOKEN_SYMBOL_RPAREN) {
                 break;
@@ -1634,19 +1808,19 @@ void parse_import_aliases(import_aliases *imports) {
             syntax_error();
         }
 
-        pyc_ti++;
+        ps->ti++;
 
         alias.tok = tok_p;
 
         if (!tokens_over() && tok_now_teq(TOKEN_KEYWORD_AS)) {
-            pyc_ti++;
+            ps->ti++;
             if (tokens_over())
                 syntax_error();
             tok_p = &token_peek(0);
             if ((tok_p->type & 0xf) != TOKEN_IDENTIFIER)
                 syntax_error();
             alias.as = tok_p;
-            pyc_ti++;
+            ps->ti++;
         } else {
             alias.as = NULL;
         }
@@ -1661,7 +1835,7 @@ void parse_import_aliases(import_aliases *imports) {
             break;
 
         if (tok.type == TOKEN_SYMBOL_COMMA) {
-            pyc_ti++;
+            ps->ti++;
             continue;
         }
     }
@@ -1671,22 +1845,22 @@ void parse_import_aliases(import_aliases *imports) {
     }
 }
 
-void parse_import_libs(import_libs *imports) {
+void parse_import_libs(pyc_parser *ps, import_libs *imports) {
     import_libs_init(imports);
 
     while (!tokens_over()) {
         import_lib alias;
-        parse_import_path(&alias.tok);
+        parse_import_path(ps, &alias.tok);
 
         if (!tokens_over() && tok_now_teq(TOKEN_KEYWORD_AS)) {
-            pyc_ti++;
+            ps->ti++;
             if (tokens_over())
                 syntax_error();
             token *tok_p = &token_peek(0);
             if ((tok_p->type & 0xf) != TOKEN_IDENTIFIER)
                 syntax_error();
             alias.as = tok_p;
-            pyc_ti++;
+            ps->ti++;
         } else {
             alias.as = NULL;
         }
@@ -1697,32 +1871,32 @@ void parse_import_libs(import_libs *imports) {
             break;
 
         if (token_peek(0).type == TOKEN_SYMBOL_COMMA) {
-            pyc_ti++;
+            ps->ti++;
             continue;
         }
     }
 }
 
-void parse_statement_import(node *st, int spaces) {
+void parse_statement_import(pyc_parser *ps, node *st) {
     st->type = STMT_IMPORT;
-    pyc_ti++;
-    parse_import_libs(&st->imports.v);
+    ps->ti++;
+    parse_import_libs(ps, &st->imports.v);
 }
 
-void parse_statement_import_from(node *st, int spaces) {
+void parse_statement_import_from(pyc_parser *ps, node *st) {
     st->type = STMT_IMPORT_FROM;
-    pyc_ti++;
-    st->import_from.level = parse_import_level();
-    parse_import_path(&st->import_from.lib);
+    ps->ti++;
+    st->import_from.level = parse_import_level(ps);
+    parse_import_path(ps, &st->import_from.lib);
     assert_tokenP(TOKEN_KEYWORD_IMPORT);
     if (tokens_over())
         syntax_error();
-    parse_import_aliases(&st->import_from.imports);
+    parse_import_aliases(ps, &st->import_from.imports);
 }
 
-void parse_statement_raise(node *st, int spaces) {
+void parse_statement_raise(pyc_parser *ps, node *st) {
     st->type = STMT_RAISE;
-    pyc_ti++;
+    ps->ti++;
 
     if (tokens_over() || token_type_peek_t(0) == TOKEN_LINE_BREAK) {
         st->raise.exception = NULL;
@@ -1731,25 +1905,25 @@ void parse_statement_raise(node *st, int spaces) {
     }
 
     if (!tok_now_teq(TOKEN_KEYWORD_FROM))
-        st->raise.exception = parse_expression_child(st);
+        st->raise.exception = parse_expression_child(ps, st);
 
     if (tokens_over() || !tok_now_teq(TOKEN_KEYWORD_FROM)) {
         st->raise.cause = NULL;
         return;
     }
 
-    pyc_ti++;
-    st->raise.cause = parse_expression_child(st);
+    ps->ti++;
+    st->raise.cause = parse_expression_child(ps, st);
 
     if (!tokens_over())
         assert_token_type_t(TOKEN_LINE_BREAK);
 }
 
 // handles both
-void parse_statement_global_nonlocal(node *st, int spaces) {
+void parse_statement_global_nonlocal(pyc_parser *ps, node *st) {
     bool is_global = tok_now_teq(TOKEN_KEYWORD_GLOBAL);
     st->type = is_global ? STMT_GLOBAL : STMT_NONLOCAL;
-    pyc_ti++;
+    ps->ti++;
     tokens_p *ls = is_global ? &st->global : &st->nonlocal;
     tokens_p_init(ls);
     while (!tokens_over()) {
@@ -1757,11 +1931,11 @@ void parse_statement_global_nonlocal(node *st, int spaces) {
         if ((tok2->type & 0xf) != TOKEN_IDENTIFIER)
             syntax_error();
         tokens_p_push(ls, tok2);
-        pyc_ti++;
+        ps->ti++;
         if (tokens_over())
             break;
         if (token_peek(0).type == TOKEN_SYMBOL_COMMA) {
-            pyc_ti++;
+            ps->ti++;
             if (tokens_over())
                 syntax_error();
             continue;
@@ -1775,20 +1949,20 @@ void parse_statement_global_nonlocal(node *st, int spaces) {
         assert_token_type_t(TOKEN_LINE_BREAK);
 }
 
-void parse_statement_assert(node *st, int spaces) {
+void parse_statement_assert(pyc_parser *ps, node *st) {
     st->type = STMT_ASSERT;
-    pyc_ti++;
-    st->assert.condition = parse_expression_group_child(st);
+    ps->ti++;
+    st->assert.condition = parse_expression_group_child(ps, st);
     if (tokens_over()) {
         st->assert.message = NULL;
         return;
     }
 
     if (token_peek(0).type == TOKEN_SYMBOL_COMMA) {
-        pyc_ti++;
+        ps->ti++;
         if (tokens_over())
             syntax_error();
-        st->assert.message = parse_expression_group_child(st);
+        st->assert.message = parse_expression_group_child(ps, st);
     } else {
         st->assert.message = NULL;
     }
@@ -1796,41 +1970,38 @@ void parse_statement_assert(node *st, int spaces) {
     assert_token_type_t(TOKEN_LINE_BREAK);
 }
 
-void parse_statement_match(node *st, int spaces) {
+void parse_statement_match(pyc_parser *ps, node *st) {
     st->type = STMT_MATCH;
-    pyc_ti++;
-    st->match.subject = parse_expression_child(st);
+    ps->ti++;
+    st->match.subject = parse_expression_child(ps, st);
     assert_tokenP(TOKEN_SYMBOL_COLON);
-    parse_statement_group_match_def(st, spaces);
+    parse_statement_group_match_def(ps, st);
 }
 
-void parse_statement_try(node *st, int spaces) {
+void parse_statement_try(pyc_parser *ps, node *st) {
     st->type = STMT_TRY_CATCH;
-    pyc_ti++;
+    ps->ti++;
     if (tokens_over())
         syntax_error();
-    parse_statement_group_try_catch(st, spaces);
+    parse_statement_group_try_catch(ps, st);
 }
 
-void parse_decorators(node *parent, int spaces_parent) {
+void parse_decorators(pyc_parser *ps, node *parent) {
     nodes decorators;
     nodes_init(&decorators);
 
-    while (!tokens_over()) {
-        token tok = token_peek(0);
-        size_t tok_type = tok.type;
-
-        equal_indent_group_macro_thing(tok_type, tok, spaces_parent)
-
-        if (tok_type != TOKEN_OPERATOR_MAT_MUL) break;
-
-        pyc_ti++;
-        nodes_push(&decorators, parse_expression_group_child(parent));
+    while (!tokens_over() && tok_now_teq(TOKEN_OPERATOR_MAT_MUL)) {
+        ps->ti++;
+        nodes_push(&decorators, parse_expression_group_child(ps, parent));
+        while (!tokens_over() && tok_now_teq(TOKEN_LINE_BREAK_NEWLINE))
+            ps->ti++;
     }
 
     nodes_shrink(&decorators);
+    if (tokens_over())
+        syntax_error();
 
-    parse_statement_next(parent, spaces_parent);
+    parse_statement_next(ps, parent);
     if (parent->type == STMT_CLASS_DEF)
         parent->class_def.decorators = decorators;
     else if (parent->type == STMT_FUNCTION_DEF)
@@ -1841,51 +2012,51 @@ void parse_decorators(node *parent, int spaces_parent) {
     }
 }
 
-void parse_statement_next(node *st, int spaces) {
+void parse_statement_next(pyc_parser *ps, node *st) {
     token *tok_p = &token_peek(0);
     token tok = *tok_p;
     size_t tok_type = tok.type;
     size_t tok_type_t = tok_type & 0xf;
 
     if (tok.type == TOKEN_OPERATOR_MAT_MUL) {
-        parse_decorators(st, spaces);
+        parse_decorators(ps, st);
         return;
     }
 
     if (tok_type == TOKEN_KEYWORD_RETURN) {
-        pyc_ti++;
+        ps->ti++;
         st->type = STMT_RETURN;
         if (tokens_over() || token_type_peek_t(0) == TOKEN_LINE_BREAK) {
             st->ret.v = NULL;
             return;
         }
 
-        st->ret.v = parse_expression_child(st);
+        st->ret.v = parse_expression_child(ps, st);
         if (!tokens_over() && token_type_peek_t(0) != TOKEN_LINE_BREAK)
             syntax_error();
         return;
     } else if (tok_type == TOKEN_KEYWORD_BREAK) {
-        pyc_ti++;
+        ps->ti++;
         st->type = STMT_BREAK;
         if (!tokens_over() && token_type_peek_t(0) != TOKEN_LINE_BREAK)
             syntax_error();
         return;
     } else if (tok_type == TOKEN_KEYWORD_CONTINUE) {
-        pyc_ti++;
+        ps->ti++;
         st->type = STMT_CONTINUE;
         if (!tokens_over() && token_type_peek_t(0) != TOKEN_LINE_BREAK)
             syntax_error();
         return;
     } else if (tok_type == TOKEN_KEYWORD_PASS) {
-        pyc_ti++;
+        ps->ti++;
         st->type = STMT_PASS;
         if (!tokens_over() && token_type_peek_t(0) != TOKEN_LINE_BREAK)
             syntax_error();
         return;
     } else if (tok_type == TOKEN_KEYWORD_DEL) {
-        pyc_ti++;
+        ps->ti++;
         st->type = STMT_DELETE;
-        node *del = st->del = parse_expression_child(st);
+        node *del = st->del = parse_expression_child(ps, st);
         if (del->type != EXPR_INDEX && del->type != EXPR_ATTRIBUTE &&
             del->type != EXPR_IDENTIFIER)
             syntax_error();
@@ -1894,49 +2065,56 @@ void parse_statement_next(node *st, int spaces) {
                tok_type == TOKEN_KEYWORD_DEF || tok_type == TOKEN_KEYWORD_FOR ||
                tok_type == TOKEN_KEYWORD_WITH) {
         if (tok_type == TOKEN_KEYWORD_DEF) {
-            parse_statement_function_def(st, spaces);
+            parse_statement_function_def(ps, st);
         } else if (tok_type == TOKEN_KEYWORD_FOR) {
-            parse_statement_for(st, spaces);
+            parse_statement_for(ps, st);
         } else if (tok_type == TOKEN_KEYWORD_WITH) {
-            parse_statement_with(st, spaces);
+            parse_statement_with(ps, st);
         } else {
             syntax_error();
         }
         return;
     } else if (tok_type == TOKEN_KEYWORD_WHILE) {
-        parse_statement_while(st, spaces);
+        parse_statement_while(ps, st);
         return;
     } else if (tok_type == TOKEN_KEYWORD_IF) {
-        parse_statement_if(st, spaces);
+        parse_statement_if(ps, st);
         return;
     } else if (tok_type == TOKEN_KEYWORD_CLASS) {
-        parse_statement_class(st, spaces);
+        parse_statement_class(ps, st);
         return;
     } else if (tok_type == TOKEN_KEYWORD_FROM) {
-        parse_statement_import_from(st, spaces);
+        parse_statement_import_from(ps, st);
         return;
     } else if (tok_type == TOKEN_KEYWORD_IMPORT) {
-        parse_statement_import(st, spaces);
+        parse_statement_import(ps, st);
         return;
     } else if (tok_type == TOKEN_KEYWORD_ASSERT) {
-        parse_statement_assert(st, spaces);
+        parse_statement_assert(ps, st);
         return;
     } else if (tok_type == TOKEN_KEYWORD_GLOBAL ||
                tok_type == TOKEN_KEYWORD_NONLOCAL) {
-        parse_statement_global_nonlocal(st, spaces);
+        parse_statement_global_nonlocal(ps, st);
         return;
     } else if (tok_type == TOKEN_KEYWORD_RAISE) {
-        parse_statement_raise(st, spaces);
+        parse_statement_raise(ps, st);
         return;
     } else if (tok_type == TOKEN_KEYWORD_MATCH) {
-        parse_statement_match(st, spaces);
+        parse_statement_match(ps, st);
         return;
     } else if (tok_type == TOKEN_KEYWORD_TRY) {
-        parse_statement_try(st, spaces);
+        parse_statement_try(ps, st);
         return;
     }
 
-    node *expr = parse_expression_child(st);
+    node *expr = parse_expression_child(ps, st);
+
+    // a broken statement can take every token
+    if (tokens_over()) {
+        st->type = STMT_EXPR;
+        st->stmt_expr = expr;
+        return;
+    }
 
     tok_p = &token_peek(0);
     tok = *tok_p;
@@ -1947,8 +2125,8 @@ void parse_statement_next(node *st, int spaces) {
         st->assign.var = expr;
 
         if (tok_type == TOKEN_SYMBOL_COLON) {
-            pyc_ti++;
-            parser_ignore_type();
+            ps->ti++;
+            parser_ignore_type(ps);
 
             tok_p = &token_peek(0);
             tok = *tok_p;
@@ -1959,17 +2137,17 @@ void parse_statement_next(node *st, int spaces) {
                 return;
             }
 
-            pyc_ti++;
+            ps->ti++;
         } else {
-            pyc_ti++;
-            size_t second_eq = get_node_tok_index(TOKEN_SET_OPERATOR_EQ, true, false, false);
+            ps->ti++;
+            size_t second_eq = get_node_tok_index(ps, TOKEN_SET_OPERATOR_EQ, true, false);
             if (second_eq != -1) {
                 st->type = STMT_ASSIGN_MULT;
                 nodes_init(&st->assign_mult.targets);
                 nodes_push(&st->assign_mult.targets, expr);
 
                 while (!tokens_over()) {
-                    expr = parse_expression_child(st);
+                    expr = parse_expression_child(ps, st);
                     if (tokens_over() ||
                         token_peek(0).type != TOKEN_SET_OPERATOR_EQ) {
                         st->assign_mult.val = expr;
@@ -1977,14 +2155,14 @@ void parse_statement_next(node *st, int spaces) {
                     }
 
                     nodes_push(&st->assign_mult.targets, expr);
-                    pyc_ti++;
+                    ps->ti++;
                 }
                 return;
             }
         }
 
         st->assign.set_op = tok_p;
-        st->assign.val = parse_expression_child(st);
+        st->assign.val = parse_expression_child(ps, st);
         return;
     }
 
@@ -1993,107 +2171,126 @@ void parse_statement_next(node *st, int spaces) {
 }
 
 token *get_node_token(node *node) {
-    if (node == NULL) return NULL;
-    switch (node->type) {
-        case NODE_MODULE:
-            return NULL;
-        case NODE_GROUP:
-            return node->group.tok;
-        case EXPR_IDENTIFIER:
-            return node->identifier;
-            break;
-        case EXPR_CONSTANT:
-            return node->constant;
-            break;
-        case EXPR_FORMAT_STRING:
-            return node->fstring.start_string;
-        case EXPR_OPERATOR:
-            return node->operator;
-        case EXPR_BINARY_OPERATION:
-            return get_node_token(node->bin_op.left);
-        case EXPR_UNARY_OPERATION:
-            return get_node_token(node->unary_op.expr);
-        case EXPR_CMP_OPERATION:
-            return get_node_token(node->cmp_op.ex.data[0]);
-        case EXPR_WALRUS_OPERATION:
-            return get_node_token(node->walrus_op.left);
-        case EXPR_LIST_COMP:
-            return node->list_comp.tok;
-        case EXPR_LIST:
-            return node->list.tok;
-        case EXPR_DICT_COMP:
-            return node->dict_comp.tok;
-        case EXPR_DICT:
-            return node->dict.tok;
-        case EXPR_SET_COMP:
-            return node->set_comp.tok;
-        case EXPR_SET:
-            return node->set.tok;
-        case EXPR_TUPLE:
-            return node->tuple.tok;
-        case EXPR_LAMBDA:
-            return node->lambda.tok;
-            break;
-        case EXPR_IF_EXP:
-            return get_node_token(node->if_else_expr.condition);
-        case EXPR_GENERATOR:
-            return get_node_token(node->generator.value);
-        case EXPR_AWAIT:
-            return get_node_token(node->await);
-        case EXPR_YIELD:
-            return get_node_token(node->yield);
-        case EXPR_YIELD_FROM:
-            return get_node_token(node->yield_from);
-        case EXPR_CALL:
-            return get_node_token(node->call.base);
-        case EXPR_ATTRIBUTE:
-            return get_node_token(node->attribute.base);
-        case EXPR_INDEX:
-            return get_node_token(node->index.base);
-        case STMT_FUNCTION_DEF:
-            return node->function_def.name;
-        case STMT_CLASS_DEF:
-            return node->class_def.name;
-        case STMT_RETURN:
-            return node->ret.tok;
-        case STMT_DELETE:
-            return get_node_token(node->del);
-        case STMT_ASSIGN:
-            return get_node_token(node->assign.var);
-        case STMT_ASSIGN_MULT:
-            return get_node_token(node->assign_mult.targets.data[0]);
-        case STMT_FOR:
-            return node->for_loop.tok;
-        case STMT_WHILE:
-            return node->while_loop.tok;
-        case STMT_IF:
-            return node->if_stmt.tok;
-        case STMT_WITH:
-            return node->with.tok;
-        case STMT_MATCH:
-            return node->match.tok;
-        case STMT_RAISE:
-            return node->raise.tok;
-        case STMT_TRY_CATCH:
-            return node->try_catch.tok;
-        case STMT_ASSERT:
-            return node->assert.tok;
-        case STMT_IMPORT:
-            return node->imports.tok;
-        case STMT_IMPORT_FROM:
-            return node->import_from.tok;
-        case STMT_GLOBAL:
-            return node->global.data[0];
-        case STMT_NONLOCAL:
-            return node->nonlocal.data[0];
-        case STMT_EXPR:
-            return get_node_token(node->stmt_expr);
-        case STMT_PASS:
-            return node->pass;
-        case STMT_BREAK:
-            return node->break_st;
-        case STMT_CONTINUE:
-            return node->continue_st;
+    // the token of an operation is the one of its leftmost operand, so this descends instead of recursing
+    while (node != NULL) {
+        switch (node->type) {
+            case NODE_MODULE:
+                return NULL;
+            case NODE_GROUP:
+                return node->group.tok;
+            case EXPR_IDENTIFIER:
+                return node->identifier;
+                break;
+            case EXPR_CONSTANT:
+                return node->constant;
+                break;
+            case EXPR_FORMAT_STRING:
+                return node->fstring.start_string;
+            case EXPR_BINARY_OPERATION:
+                node = node->bin_op.left;
+                continue;
+            case EXPR_UNARY_OPERATION:
+                node = node->unary_op.expr;
+                continue;
+            case EXPR_CMP_OPERATION:
+                node = node->cmp_op.ex.data[0];
+                continue;
+            case EXPR_WALRUS_OPERATION:
+                node = node->walrus_op.left;
+                continue;
+            case EXPR_LIST_COMP:
+                return node->list_comp.tok;
+            case EXPR_LIST:
+                return node->list.tok;
+            case EXPR_DICT_COMP:
+                return node->dict_comp.tok;
+            case EXPR_DICT:
+                return node->dict.tok;
+            case EXPR_SET_COMP:
+                return node->set_comp.tok;
+            case EXPR_SET:
+                return node->set.tok;
+            case EXPR_TUPLE:
+                return node->tuple.tok;
+            case EXPR_LAMBDA:
+                return node->lambda.tok;
+                break;
+            case EXPR_IF_EXP:
+                node = node->if_else_expr.condition;
+                continue;
+            case EXPR_GENERATOR:
+                node = node->generator.value;
+                continue;
+            case EXPR_AWAIT:
+                node = node->await;
+                continue;
+            case EXPR_YIELD:
+                node = node->yield;
+                continue;
+            case EXPR_YIELD_FROM:
+                node = node->yield_from;
+                continue;
+            case EXPR_CALL:
+                node = node->call.base;
+                continue;
+            case EXPR_ATTRIBUTE:
+                node = node->attribute.base;
+                continue;
+            case EXPR_INDEX:
+                node = node->index.base;
+                continue;
+            case STMT_FUNCTION_DEF:
+                return node->function_def.name;
+            case STMT_CLASS_DEF:
+                return node->class_def.name;
+            case STMT_RETURN:
+                return node->ret.tok;
+            case STMT_DELETE:
+                node = node->del;
+                continue;
+            case STMT_ASSIGN:
+                node = node->assign.var;
+                continue;
+            case STMT_ASSIGN_MULT:
+                node = node->assign_mult.targets.data[0];
+                continue;
+            case STMT_FOR:
+                return node->for_loop.tok;
+            case STMT_WHILE:
+                return node->while_loop.tok;
+            case STMT_IF:
+                return node->if_stmt.tok;
+            case STMT_WITH:
+                return node->with.tok;
+            case STMT_MATCH:
+                return node->match.tok;
+            case STMT_RAISE:
+                return node->raise.tok;
+            case STMT_TRY_CATCH:
+                return node->try_catch.tok;
+            case STMT_ASSERT:
+                return node->assert.tok;
+            case STMT_IMPORT:
+                return node->imports.tok;
+            case STMT_IMPORT_FROM:
+                return node->import_from.tok;
+            case STMT_GLOBAL:
+                return node->global.data[0];
+            case STMT_NONLOCAL:
+                return node->nonlocal.data[0];
+            case STMT_EXPR:
+                node = node->stmt_expr;
+                continue;
+            case STMT_PASS:
+                return node->pass;
+            case STMT_BREAK:
+                return node->break_st;
+            case STMT_CONTINUE:
+                return node->continue_st;
+            case NODE_LAZY_GROUP:
+                return &node->lazy.lx->tokens.data[node->lazy.start];
+        }
+        return NULL;
     }
 
     return NULL;
@@ -2102,557 +2299,50 @@ token *get_node_token(node *node) {
 #ifdef NEED_AST_PRINT
 
 void node_print(node *node, int indent) {
-    if (node == NULL) {
-        printf("node(NULL)");
-        return;
-    }
-
-    if (node->type == EXPR_IDENTIFIER) {
-        printf("I(");
-        token_p_print(node->identifier, indent + 1);
-        printf(")");
-        return;
-    }
-
-    printf("node(type=");
-
-    switch (node->type) {
-        case NODE_MODULE:
-            printf("module, filename=%s, code_len=%ld", node->module.filename, node->module.code_len);
-            break;
-        case NODE_GROUP:
-            printf("group, value=");
-            nodes_print_indent(node->group.v, indent + 1);
-            break;
-        case EXPR_IDENTIFIER:
-            printf("identifier, value=");
-            token_p_print(node->identifier, indent + 1);
-            break;
-        case EXPR_CONSTANT:
-            printf("constant, value=");
-            token_p_print(node->constant, indent + 1);
-            break;
-        case EXPR_OPERATOR:
-            printf("operator, value=");
-            token_p_print(node->operator, indent + 1);
-            break;
-        case EXPR_BINARY_OPERATION:
-            printf("binary_operation, operator");
-            token_p_print(node->bin_op.op, indent + 1);
-            printf(", left=");
-            node_print(node->bin_op.left, indent + 1);
-            printf(", right=");
-            node_print(node->bin_op.right, indent + 1);
-            break;
-        case EXPR_UNARY_OPERATION:
-            printf("unary_operation, operator=");
-            token_p_print(node->unary_op.op, indent + 1);
-            printf(", value=");
-            node_print(node->unary_op.expr, indent + 1);
-            break;
-        case EXPR_CMP_OPERATION:
-            printf("cmp_operation, operator=");
-            tokens_p_print_indent(node->cmp_op.op, indent + 1);
-            printf(", values=");
-            nodes_print_indent(node->cmp_op.ex, indent + 1);
-            break;
-        case EXPR_WALRUS_OPERATION:
-            printf("walrus_operation, left=");
-            node_print(node->walrus_op.left, indent + 1);
-            printf(", right=");
-            node_print(node->walrus_op.right, indent + 1);
-            break;
-        case EXPR_FORMAT_STRING:
-            printf("format_string, start_string=");
-            token_p_print(node->fstring.start_string, indent + 1);
-            printf(", values=");
-            nodes_print_indent(node->fstring.values, indent + 1);
-            printf(", strings=");
-            tokens_p_print_indent(node->fstring.strings, indent + 1);
-            printf(", extras=");
-            nodes_print_indent(node->fstring.extras, indent + 1);
-            break;
-        case EXPR_LIST_COMP:
-            printf("list_comp, value=");
-            node_print(node->list_comp.value, indent);
-            printf(", comp=");
-            comprehensions_print_indent(node->list_comp.comp, indent + 1);
-            break;
-        case EXPR_LIST:
-            printf("list, value=");
-            nodes_print_indent(node->list.v, indent + 1);
-            break;
-        case EXPR_DICT_COMP:
-            printf("dict_comp, key=");
-            node_print(node->dict_comp.key, indent);
-            printf(", value=");
-            node_print(node->dict_comp.value, indent);
-            printf(", comp=");
-            comprehensions_print_indent(node->dict_comp.comp, indent + 1);
-            break;
-        case EXPR_DICT:
-            printf("dict, keys=");
-            nodes_print_indent(node->dict.keys, indent + 1);
-            printf(", values=");
-            nodes_print_indent(node->dict.values, indent + 1);
-            break;
-        case EXPR_SET_COMP:
-            printf("set_comp, value=");
-            node_print(node->set_comp.value, indent);
-            printf(", comp=");
-            comprehensions_print_indent(node->set_comp.comp, indent + 1);
-            break;
-        case EXPR_SET:
-            printf("set, value=");
-            nodes_print_indent(node->set.v, indent + 1);
-            break;
-        case EXPR_TUPLE:
-            printf("tuple, value=");
-            nodes_print_indent(node->tuple.v, indent + 1);
-            break;
-        case EXPR_LAMBDA:
-            printf("lambda, args=");
-            tokens_p_print_indent(node->lambda.args, indent + 1);
-            printf(", body=");
-            node_print(node->lambda.body, indent);
-            break;
-        case EXPR_IF_EXP:
-            printf("if_exp, if_expr=");
-            node_print(node->if_else_expr.if_expr, indent);
-            printf(", condition=");
-            node_print(node->if_else_expr.condition, indent);
-            printf(", else_expr=");
-            node_print(node->if_else_expr.else_expr, indent);
-            break;
-        case EXPR_GENERATOR:
-            printf("generator, value=");
-            node_print(node->generator.value, indent);
-            printf(", comp=");
-            comprehensions_print_indent(node->generator.comp, indent + 1);
-            break;
-        case EXPR_AWAIT:
-            printf("await, value=");
-            node_print(node->await, indent);
-            break;
-        case EXPR_YIELD:
-            printf("yield, value=");
-            node_print(node->yield, indent);
-            break;
-        case EXPR_YIELD_FROM:
-            printf("yield_from, value=");
-            node_print(node->yield_from, indent);
-            break;
-        case EXPR_CALL:
-            printf("call, base=");
-            node_print(node->call.base, indent);
-            printf(", args=");
-            nodes_print_indent(node->call.args, indent + 1);
-            printf(", kws=");
-            keywords_print_indent(node->call.kws, indent + 1);
-            break;
-        case EXPR_ATTRIBUTE:
-            printf("attribute, base=");
-            node_print(node->attribute.base, indent);
-            printf(", key=");
-            token_p_print(node->attribute.key, indent + 1);
-            break;
-        case EXPR_INDEX:
-            printf("index, base=");
-            node_print(node->index.base, indent);
-            printf(", slices=[");
-            putchar('\n');
-            for (int i = 0; i < 3; i++) {
-                _VCINDENT(indent + 1);
-                node_print(node->index.slices[i], indent);
-                if (i != 2) {
-                    putchar(',');
-                }
-                putchar('\n');
-            }
-            _VCINDENT(indent);
-            putchar(']');
-            break;
-        case STMT_FUNCTION_DEF:
-            printf("function_def, name=");
-            token_p_print(node->function_def.name, indent + 1);
-            printf(", args=");
-            tokens_p_print_indent(node->function_def.args, indent + 1);
-            printf(", body=");
-            node_print(node->function_def.body, indent + 1);
-            printf(", is_async=%s",
-                   node->function_def.is_async ? "true" : "false");
-            printf(", decorators=");
-            nodes_print_indent(node->function_def.decorators, indent + 1);
-            break;
-        case STMT_CLASS_DEF:
-            printf("class_def, name=");
-            token_p_print(node->class_def.name, indent + 1);
-            printf(", extends=");
-            tokens_p_print_indent(node->class_def.extends, indent + 1);
-            printf(", methods=");
-            nodes_print_indent(node->class_def.methods, indent + 1);
-            printf(", properties=");
-            nodes_print_indent(node->class_def.properties, indent + 1);
-            printf(", decorators=");
-            nodes_print_indent(node->class_def.decorators, indent + 1);
-            break;
-        case STMT_RETURN:
-            printf("return, value=");
-            node_print(node->ret.v, indent);
-            break;
-        case STMT_DELETE:
-            printf("delete, value=");
-            node_print(node->del, indent);
-            break;
-        case STMT_ASSIGN:
-            printf("assign, var=");
-            node_print(node->assign.var, indent);
-            printf(", set_op=");
-            token_p_print(node->assign.set_op, indent + 1);
-            printf(", val=");
-            node_print(node->assign.val, indent);
-            break;
-        case STMT_ASSIGN_MULT:
-            printf("assign_multiple, var=");
-            nodes_print_indent(node->assign_mult.targets, indent + 1);
-            printf(", val=");
-            node_print(node->assign_mult.val, indent);
-            break;
-        case STMT_FOR:
-            printf("for, is_async=%s",
-                   node->for_loop.is_async ? "true" : "false");
-            printf(", value=");
-            node_print(node->for_loop.value, indent);
-            printf(", iter=");
-            node_print(node->for_loop.iter, indent);
-            printf(", body=");
-            node_print(node->for_loop.body, indent + 1);
-            break;
-        case STMT_WHILE:
-            printf("while, condition=");
-            node_print(node->while_loop.cond, indent);
-            printf(", body=");
-            node_print(node->while_loop.body, indent + 1);
-            break;
-        case STMT_IF:
-            printf("if, conditions=");
-            nodes_print_indent(node->if_stmt.conditions, indent + 1);
-            printf(", bodies=");
-            nodes_print_indent(node->if_stmt.bodies, indent + 1);
-            break;
-        case STMT_WITH:
-            printf("with, is_async=%s", node->with.is_async ? "true" : "false");
-            printf(", vars=");
-            tokens_p_print_indent(node->with.vars, indent + 1);
-            printf(", contexts=");
-            nodes_print_indent(node->with.contexts, indent + 1);
-            printf(", body=");
-            node_print(node->with.body, indent + 1);
-            break;
-        case STMT_MATCH:
-            printf("match, subject=");
-            node_print(node->match.subject, indent);
-            printf(", cases=");
-            match_cases_print_indent(node->match.cases, indent + 1);
-            break;
-        case STMT_RAISE:
-            printf("raise, exception=");
-            node_print(node->raise.exception, indent);
-            printf(", cause=");
-            node_print(node->raise.cause, indent);
-            break;
-        case STMT_TRY_CATCH:
-            printf("try_catch, is_star=%s, try=",
-                   node->try_catch.is_star ? "true" : "false");
-            node_print(node->try_catch.try_body, indent + 1);
-            printf(", excepts=");
-            except_handlers_print_indent(node->try_catch.handlers, indent + 1);
-            printf(", else=");
-            node_print(node->try_catch.else_body, indent);
-            printf(", finally=");
-            node_print(node->try_catch.finally_body, indent);
-            break;
-        case STMT_ASSERT:
-            printf("assert, condition=");
-            node_print(node->assert.condition, indent);
-            printf(", message=");
-            node_print(node->assert.message, indent);
-            break;
-        case STMT_IMPORT:
-            printf("import, imports=");
-            import_libs_print_indent(node->imports.v, indent + 1);
-            break;
-        case STMT_IMPORT_FROM:
-            printf("import_from, level=%d", node->import_from.level);
-            printf(", lib=");
-            tokens_p_print_indent(node->import_from.lib, indent + 1);
-            printf(", imports=");
-            import_aliases_print_indent(node->import_from.imports, indent + 1);
-            break;
-        case STMT_GLOBAL:
-            printf("global, names=");
-            tokens_p_print_indent(node->global, indent + 1);
-            break;
-        case STMT_NONLOCAL:
-            printf("nonlocal, names=");
-            tokens_p_print_indent(node->nonlocal, indent + 1);
-            break;
-        case STMT_EXPR:
-            printf("expr, value=");
-            node_print(node->stmt_expr, indent);
-            break;
-        case STMT_PASS:
-            printf("pass");
-            break;
-        case STMT_BREAK:
-            printf("break");
-            break;
-        case STMT_CONTINUE:
-            printf("continue");
-            break;
-    }
-
-    putchar(')');
-}
-
-void comprehension_print(comprehension comp, int indent) {
-    printf("comprehension(target=");
-    node_print(comp.target, indent);
-    printf(", iter=");
-    node_print(comp.iter, indent);
-    printf(", ifs=");
-    nodes_print_indent(comp.ifs, indent + 1);
-    printf(", is_async=%s)", comp.is_async ? "true" : "false");
-}
-
-void import_alias_print(import_alias al, int indent) {
-    printf("(val=");
-    token_p_print(al.tok, indent + 1);
-    printf(", as=");
-    token_p_print(al.as, indent + 1);
-    putchar(')');
+    // whatever was printed before has to come out first
+    fflush(stdout);
+    pyc_writer w;
+    pyc_writer_init(&w, STDOUT_FILENO);
+    pyc_dump_text(&w, pyc_code, node, indent);
+    pyc_writer_close(&w);
 }
 
-void import_lib_print(import_lib al, int indent) {
-    printf("(val=");
-    tokens_p_print_indent(al.tok, indent + 1);
-    printf(", as=");
-    token_p_print(al.as, indent + 1);
-    putchar(')');
-}
+#endif
 
-void keyword_print(keyword kws, int indent) {
-    printf("(key=");
-    token_p_print(kws.name, indent + 1);
-    printf(", value=");
-    node_print(kws.value, indent);
-    putchar(')');
-}
+// A tree built with pyc_ast_arena set is released by resetting the arena, nothing is freed here then.
+// The nodes in the vectors are done by the walk before their owner, only the vector data is left to free.
+static void free_fields(const pyc_schema *s, char *obj) {
+    for (size_t i = 0; i < s->count; i++) {
+        pyc_field_kind kind = s->fields[i].kind;
+        if (kind != FIELD_TOKENS && kind != FIELD_NODES && kind < FIELD_COMPREHENSIONS)
+            continue;
 
-void match_case_print(match_case cas, int indent) {
-    printf("(pattern=");
-    node_print(cas.pattern, indent);
-    printf(", as=");
-    token_p_print(cas.as, indent + 1);
-    printf(", condition=");
-    node_print(cas.condition, indent);
-    printf(", body=");
-    node_print(cas.body, indent + 1);
-    putchar(')');
+        pyc_raw_vec v;
+        memcpy(&v, obj + s->fields[i].offset, sizeof(v));
+        if (v.data != NULL && kind >= FIELD_COMPREHENSIONS) {
+            const pyc_schema *rec = &pyc_record_schemas[kind - FIELD_COMPREHENSIONS];
+            for (size_t j = 0; j < v.size; j++)
+                free_fields(rec, v.data + j * rec->size);
+        }
+        pyc_ast_free(v.data);
+    }
 }
 
-void except_handler_print(except_handler eh, int indent) {
-    printf("(type=");
-    node_print(eh.class, indent);
-    printf(", name=");
-    token_p_print(eh.name, indent + 1);
-    printf(", body=");
-    node_print(eh.body, indent + 1);
-    putchar(')');
+static pyc_walk_result free_node(node *obj, void *ctx) {
+    if (obj->type == NODE_MODULE) {
+        free(obj->module.filename);
+        free(obj->module.code);
+        tokens_clear(&obj->module.tokens);
+    }
+    free_fields(&pyc_node_schemas[obj->type], (char *) obj);
+    pyc_ast_free(obj);
+    return PYC_WALK_CONTINUE;
 }
 
-#endif
-
 void node_free(node *obj) {
-    if (!obj)
+    if (!obj || pyc_ast_arena != NULL)
         return;
-
-    switch (obj->type) {
-        case NODE_MODULE:
-            free(obj->module.filename);
-            free(obj->module.code);
-            tokens_clear(&obj->module.tokens);
-            break;
-        case EXPR_IDENTIFIER:
-        case EXPR_CONSTANT:
-        case EXPR_OPERATOR:
-        case STMT_PASS:
-        case STMT_BREAK:
-        case STMT_CONTINUE:
-            break;
-        case EXPR_BINARY_OPERATION:
-            node_free(obj->bin_op.left);
-            node_free(obj->bin_op.right);
-            break;
-        case EXPR_UNARY_OPERATION:
-            node_free(obj->unary_op.expr);
-            break;
-        case EXPR_CMP_OPERATION:
-            nodes_clear(&obj->cmp_op.ex);
-            break;
-        case EXPR_WALRUS_OPERATION:
-            node_free(obj->walrus_op.left);
-            node_free(obj->walrus_op.right);
-            break;
-        case EXPR_FORMAT_STRING:
-            nodes_clear(&obj->fstring.values);
-            free(obj->fstring.strings.data);
-            nodes_clear(&obj->fstring.extras);
-            break;
-        case NODE_GROUP:
-            nodes_clear(&obj->group.v);
-            break;
-        case EXPR_LIST_COMP:
-            node_free(obj->list_comp.value);
-            comprehensions_clear(&obj->list_comp.comp);
-            break;
-        case EXPR_LIST:
-            nodes_clear(&obj->list.v);
-            break;
-        case EXPR_DICT_COMP:
-            node_free(obj->dict_comp.key);
-            node_free(obj->dict_comp.value);
-            break;
-        case EXPR_DICT:
-            nodes_clear(&obj->dict.keys);
-            nodes_clear(&obj->dict.values);
-            break;
-        case EXPR_SET_COMP:
-            node_free(obj->set_comp.value);
-            comprehensions_clear(&obj->set_comp.comp);
-            break;
-        case EXPR_SET:
-            nodes_clear(&obj->set.v);
-            break;
-        case EXPR_TUPLE:
-            nodes_clear(&obj->tuple.v);
-            break;
-        case EXPR_LAMBDA:
-            free(obj->lambda.args.data);
-            node_free(obj->lambda.body);
-            break;
-        case EXPR_IF_EXP:
-            node_free(obj->if_else_expr.if_expr);
-            node_free(obj->if_else_expr.condition);
-            node_free(obj->if_else_expr.else_expr);
-            break;
-        case EXPR_GENERATOR:
-            node_free(obj->generator.value);
-            comprehensions_clear(&obj->generator.comp);
-            break;
-        case EXPR_AWAIT:
-            node_free(obj->await);
-            break;
-        case EXPR_YIELD:
-            node_free(obj->yield);
-            break;
-        case EXPR_YIELD_FROM:
-            node_free(obj->yield_from);
-            break;
-        case EXPR_CALL:
-            node_free(obj->call.base);
-            nodes_clear(&obj->call.args);
-            keywords_clear(&obj->call.kws);
-            break;
-        case EXPR_ATTRIBUTE:
-            node_free(obj->attribute.base);
-            break;
-        case EXPR_INDEX:
-            node_free(obj->index.base);
-            node_free(obj->index.slices[0]);
-            node_free(obj->index.slices[1]);
-            node_free(obj->index.slices[2]);
-            break;
-        case STMT_FUNCTION_DEF:
-            free(obj->function_def.args.data);
-            nodes_clear(&obj->function_def.decorators);
-            node_free(obj->function_def.body);
-            break;
-        case STMT_CLASS_DEF:
-            free(obj->class_def.extends.data);
-            nodes_clear(&obj->class_def.methods);
-            nodes_clear(&obj->class_def.properties);
-            nodes_clear(&obj->class_def.decorators);
-            break;
-        case STMT_RETURN:
-            node_free(obj->ret.v);
-            break;
-        case STMT_DELETE:
-            node_free(obj->del);
-            break;
-        case STMT_ASSIGN:
-            node_free(obj->assign.var);
-            node_free(obj->assign.val);
-            break;
-        case STMT_ASSIGN_MULT:
-            nodes_clear(&obj->assign_mult.targets);
-            node_free(obj->assign_mult.val);
-            break;
-        case STMT_FOR:
-            node_free(obj->for_loop.value);
-            node_free(obj->for_loop.iter);
-            node_free(obj->for_loop.body);
-            break;
-        case STMT_WHILE:
-            node_free(obj->while_loop.cond);
-            node_free(obj->while_loop.body);
-            break;
-        case STMT_IF:
-            nodes_clear(&obj->if_stmt.conditions);
-            nodes_clear(&obj->if_stmt.bodies);
-            break;
-        case STMT_WITH:
-            nodes_clear(&obj->with.contexts);
-            free(obj->with.vars.data);
-            node_free(obj->with.body);
-            break;
-        case STMT_MATCH:
-            match_cases_clear(&obj->match.cases);
-            node_free(obj->match.subject);
-            break;
-        case STMT_RAISE:
-            node_free(obj->raise.exception);
-            node_free(obj->raise.cause);
-            break;
-        case STMT_TRY_CATCH:
-            node_free(obj->try_catch.try_body);
-            except_handlers_clear(&obj->try_catch.handlers);
-            node_free(obj->try_catch.else_body);
-            node_free(obj->try_catch.finally_body);
-            break;
-        case STMT_ASSERT:
-            node_free(obj->assert.condition);
-            node_free(obj->assert.message);
-            break;
-        case STMT_IMPORT:
-            import_libs_clear(&obj->imports.v);
-            break;
-        case STMT_IMPORT_FROM:
-            import_aliases_clear(&obj->import_from.imports);
-            free(obj->import_from.lib.data);
-            break;
-        case STMT_GLOBAL:
-            free(obj->global.data);
-            break;
-        case STMT_NONLOCAL:
-            free(obj->nonlocal.data);
-            break;
-        case STMT_EXPR:
-            node_free(obj->stmt_expr);
-            break;
-    }
-
-    free(obj);
+    pyc_walk(obj, NULL, free_node, NULL);
 }
 
 void comprehension_free(comprehension comp) {
@@ -2665,7 +2355,7 @@ void import_alias_free(import_alias al) {
 }
 
 void import_lib_free(import_lib al) {
-    free(al.tok.data);
+    pyc_ast_free(al.tok.data);
 }
 
 void keyword_free(keyword kw) {
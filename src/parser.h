@@ -6,7 +6,7 @@
 
 typedef struct node node;
 
-vec_define_pyc(node, nodes, node *)
+vec_define_pyc_alloc(node, nodes, node *, pyc_ast)
 
 typedef struct comprehension {
     int is_async;
@@ -15,28 +15,28 @@ typedef struct comprehension {
     nodes ifs;
 } comprehension;
 
-vec_define_pyc(comprehension, comprehensions, comprehension)
+vec_define_pyc_alloc(comprehension, comprehensions, comprehension, pyc_ast)
 
 typedef struct keyword {
     token *name;
     node *value;
 } keyword;
 
-vec_define_pyc(keyword, keywords, keyword)
+vec_define_pyc_alloc(keyword, keywords, keyword, pyc_ast)
 
 typedef struct import_lib {
     tokens_p tok;
     token *as;
 } import_lib;
 
-vec_define_pyc(import_lib, import_libs, import_lib)
+vec_define_pyc_alloc(import_lib, import_libs, import_lib, pyc_ast)
 
 typedef struct import_alias {
     token *tok;
     token *as;
 } import_alias;
 
-vec_define_pyc(import_alias, import_aliases, import_alias)
+vec_define_pyc_alloc(import_alias, import_aliases, import_alias, pyc_ast)
 
 typedef struct except_handler {
     node *class;
@@ -44,7 +44,7 @@ typedef struct except_handler {
     node *body;
 } except_handler;
 
-vec_define_pyc(except_handler, except_handlers, except_handler)
+vec_define_pyc_alloc(except_handler, except_handlers, except_handler, pyc_ast)
 
 typedef struct match_case {
     node *pattern;
@@ -53,7 +53,7 @@ typedef struct match_case {
     node *body;
 } match_case;
 
-vec_define_pyc(match_case, match_cases, match_case)
+vec_define_pyc_alloc(match_case, match_cases, match_case, pyc_ast)
 
 typedef enum {
     EXPR_CTX_LOAD,
@@ -68,7 +68,6 @@ typedef enum {
     EXPR_IDENTIFIER,    // IDENTIFIER
     EXPR_CONSTANT,      // INT | FLOAT | STRING | BOOL | NONE
     EXPR_FORMAT_STRING, // f"text {some content} text etc."
-    EXPR_OPERATOR,      // SYMBOL(filter=operator)
     EXPR_BINARY_OPERATION, // EXPR BINARY_OPERATOR EXPR
     EXPR_UNARY_OPERATION, // UNARY_OPERATOR EXPR
     EXPR_CMP_OPERATION, // EXPR (CMP_OPERATOR EXPR)...
@@ -118,7 +117,9 @@ typedef enum {
     STMT_EXPR,     // EXPR
     STMT_PASS,     // pass
     STMT_BREAK,    // break
-    STMT_CONTINUE // continue
+    STMT_CONTINUE, // continue
+
+    NODE_LAZY_GROUP // a NODE_GROUP that isn't parsed yet, see parse_lazy_group
 } node_type;
 
 struct node {
@@ -139,7 +140,6 @@ struct node {
             nodes extras;
             tokens_p strings;
         } fstring;
-        token *operator;
         struct {
             node *left;
             token *op;
@@ -161,6 +161,11 @@ struct node {
             token *tok;
             nodes v;
         } group;
+        struct {
+            pyc_lexer *lx;
+            // the range of token indices the group is parsed from
+            size_t start, end;
+        } lazy;
         struct {
             token *tok;
             nodes v;
@@ -326,33 +331,63 @@ struct node {
 };
 
 static inline node *ast_node_create(node *parent) {
-    node *ex = (node *) malloc(sizeof(node));
-    if (ex == NULL) {
-        perror("malloc failed");
-        fail();
-    }
-
+    node *ex = (node *) pyc_ast_malloc(sizeof(node));
     ex->parent = parent;
     return ex;
 }
 
-#define token_peek(i) (pyc_tokens.data[pyc_ti + i])
-#define char_peek(i) (pyc_code[token_peek(i).start])
-#define str_peek(i) (pyc_code + token_peek(i).start)
-#define tokens_over() (pyc_ti >= pyc_tok_count)
-#define token_type_peek_t(i) (pyc_tokens.data[pyc_ti + i].type & 0xf)
+// All state of one parse, the parse functions take it as ps and the macros below work on it. Parsers don't share
+// anything, so files can be parsed on different threads at once with a lexer and an AST arena (see pyc_ast_arena)
+// for each of them.
+typedef struct {
+    pyc_lexer *lx;
+    token *tokens;
+    uint16_t *kinds;
+    // the parse stops here, narrowed down while parsing a part that ends before a known token
+    size_t tok_count;
+    // the current token
+    size_t ti;
+    // inside of brackets, newlines don't end anything there
+    bool paren;
+    // Parse the top level statements of a big file on this many threads, 0 or 1 parses on the calling one. The
+    // threads bump the tree from arenas of their own that are moved to pyc_ast_arena, if it is set, at the end.
+    // With more than one syntax error it is up to the threads which one is reported.
+    size_t threads;
+    // Directory of the AST cache (see cache.h) that parse_file looks in before it parses and stores the tree in after,
+    // NULL to go without. The lexer doesn't have to be tokenized then, parse_file only does it on a miss.
+    const char *cache_dir;
+    // Function bodies are only skipped over and left as NODE_LAZY_GROUP stubs, for when only the module level
+    // structure is needed (imports, signatures, ...). A syntax error in a body comes up when the body is parsed.
+    // The tree isn't cached then, a cached one is complete and is returned as it is.
+    bool lazy_bodies;
+} pyc_parser;
+
+// The lexer has to be done tokenizing.
+void pyc_parser_init(pyc_parser *ps, pyc_lexer *lx);
+
+#define token_peek(i) (ps->tokens[ps->ti + i])
+#define char_peek(i) (ps->lx->code[token_peek(i).start])
+#define str_peek(i) (ps->lx->code + token_peek(i).start)
+#define tokens_over() (ps->ti >= ps->tok_count)
+#define token_kind_peek(i) (ps->kinds[ps->ti + i])
+#define token_type_peek_t(i) (token_kind_peek(i) & 0xf)
+#define tok_peek_teq(peek, target) (token_kind_peek(peek) == target)
+#define tok_now_teq(target) tok_peek_teq(0, target)
+#define p_tok_val_eq(t, target) pyc_lex_str_eq(ps->lx, (t)->start, (t)->end, target)
+#define tok_val_eq(t, target) p_tok_val_eq(&(t), target)
+#define tok_peek_eq(peek, target) tok_val_eq(token_peek(peek), target)
 #define assert_token(ty)                                                       \
     do {                                                                       \
-        if (tokens_over() || token_peek(0).type != ty) {                       \
+        if (tokens_over() || token_kind_peek(0) != ty) {                       \
             raise_error("expected ");                                          \
         }                                                                      \
     } while (0)
 #define assert_tokenP(ty)                                                      \
     do {                                                                       \
-        if (tokens_over() || token_peek(0).type != ty) {                       \
+        if (tokens_over() || token_kind_peek(0) != ty) {                       \
             raise_error("expected ");                                          \
         }                                                                      \
-        pyc_ti++;                                                              \
+        ps->ti++;                                                              \
     } while (0)
 #define assert_token_type_t(type_)                                             \
     do {                                                                       \
@@ -361,37 +396,65 @@ static inline node *ast_node_create(node *parent) {
         }                                                                      \
     } while (0)
 
-node *parse_file(node *parent, char *filename, char *code);
+#define syntax_error() raise_error("SyntaxError: invalid syntax")
+#define syntax_error_t(t) raise_error_t((t), "SyntaxError: invalid syntax")
+#define indentation_error() raise_error("IndentationError: expected an indented block")
+#define not_implemented() raise_error("NotImplementedError: not implemented")
+#define raise_error_t(t, err) raise_error_t_ln(t, err, false)
+#define raise_error_t_ln(t, err, ln) pyc_lex_error(ps->lx, (t).start, err, ln)
+#define raise_error(err) raise_error_ln(err, false)
+#define raise_error_ln(err, ln)                                                \
+    pyc_lex_error(ps->lx, tokens_over() ? ps->lx->code_len - 1 : token_peek(0).start, err, ln)
+#define raise_error_n(n, err) raise_error_t(*get_node_token(n), err)
+
+node *parse_file(pyc_parser *ps, node *parent, char *filename);
 
-size_t count_indent(size_t index);
+// Returns the index of the first token after the top level statement that starts at token i. The clauses of a
+// compound statement (else, except, ...) and the definition after a decorator belong to it. Semicolons don't split
+// statements here. If the statement goes on to ps->tok_count, decorated tells if the tokens end with a decorator.
+size_t parse_top_level_end(pyc_parser *ps, size_t i, bool *decorated);
 
-void parse_expression_group(node *ex);
+void parse_expression_group(pyc_parser *ps, node *ex);
 
-node *parse_expression_group_child(node *parent);
+node *parse_expression_group_child(pyc_parser *ps, node *parent);
 
-void parse_expression_next(node *node);
+void parse_expression_next(pyc_parser *ps, node *node);
 
-void parse_expression_tuple(node *ex);
+void parse_expression_trailer(pyc_parser *ps, node *ex, node *base);
 
-void parse_expression_list(node *ex);
+void parse_expression_tuple(pyc_parser *ps, node *ex);
 
-void parse_expression_dict(node *node);
+void parse_expression_list(pyc_parser *ps, node *ex);
 
-void parse_expression_lambda(node *ex);
+void parse_expression_dict(pyc_parser *ps, node *node);
 
-void parse_expression_await(node *ex);
+void parse_expression_lambda(pyc_parser *ps, node *ex);
 
-void parse_expression_yield(node *ex);
+void parse_expression_await(pyc_parser *ps, node *ex);
 
-void parse_expression(node *ex);
+void parse_expression_yield(pyc_parser *ps, node *ex);
 
-void parse_comprehensions_post(node *parent, comprehensions *list);
+void parse_expression(pyc_parser *ps, node *ex);
 
-void parse_statements(node *st);
+void parse_comprehensions_post(pyc_parser *ps, node *parent, comprehensions *list);
 
-void parse_statement_next(node *st, int spaces);
+void parse_statements(pyc_parser *ps, node *st);
 
-void parse_statement_group(node *st, int spaces_parent);
+void parse_statement_next(pyc_parser *ps, node *st);
+
+void parse_statement_group(pyc_parser *ps, node *st, bool top_level);
+
+// Parses a NODE_LAZY_GROUP in place into the NODE_GROUP it stands for, with the bodies of the functions in it left
+// lazy again. Its lexer has to be alive still, the nodes go to pyc_ast_arena if that is set.
+void parse_lazy_group(node *st);
+
+// The body of a function definition, parsed on the first call if it was left lazy.
+static inline node *function_body(node *def) {
+    node *body = def->function_def.body;
+    if (body != NULL && body->type == NODE_LAZY_GROUP)
+        parse_lazy_group(body);
+    return body;
+}
 
 token *get_node_token(node *node);
 
@@ -0,0 +1,384 @@
+#include "simd.h"
+#include "unicode.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PYC_SIMD_X86
+#include <immintrin.h>
+#endif
+
+static inline bool is_identifier_byte(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static size_t scalar_line_end(const char *s, size_t i, size_t len) {
+    while (i < len && s[i] != '\n' && s[i] != '\0') i++;
+    return i;
+}
+
+static size_t scalar_blank(const char *s, size_t i, size_t len) {
+    while (i < len && (s[i] == ' ' || s[i] == '\t')) i++;
+    return i;
+}
+
+static size_t scalar_identifier(const char *s, size_t i, size_t len) {
+    while (i < len && is_identifier_byte(s[i])) i++;
+    return i;
+}
+
+static size_t scalar_string(const char *s, size_t i, size_t len, char quote, bool brace) {
+    for (; i < len; i++) {
+        char c = s[i];
+        if (c == quote || c == '\\' || c == '\n' || c == '\r' || c == '\0' || (brace && c == '{')) break;
+    }
+    return i;
+}
+
+static size_t scalar_newlines(const char *s, size_t len, size_t *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] != '\n') continue;
+        if (out) out[n] = i + 1;
+        n++;
+    }
+    return n;
+}
+
+static size_t scalar_utf8(const char *s, size_t i, size_t len) {
+    uint32_t cp;
+    while (i < len) {
+        if ((unsigned char) s[i] < 0x80) {
+            i++;
+            continue;
+        }
+        size_t n = pyc_utf8_decode(s + i, len - i, &cp);
+        if (n == 0) break;
+        i += n;
+    }
+    return i;
+}
+
+#ifdef PYC_SIMD_X86
+
+#define ctz(m) ((size_t) __builtin_ctz(m))
+
+__attribute__((target("sse2"))) static size_t sse2_line_end(const char *s, size_t i, size_t len) {
+    __m128i nl = _mm_set1_epi8('\n');
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        unsigned m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, zero)));
+        if (m) return i + ctz(m);
+    }
+    return scalar_line_end(s, i, len);
+}
+
+__attribute__((target("sse2"))) static size_t sse2_blank(const char *s, size_t i, size_t len) {
+    __m128i space = _mm_set1_epi8(' ');
+    __m128i tab = _mm_set1_epi8('\t');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab));
+        unsigned m = ~_mm_movemask_epi8(hit) & 0xFFFF;
+        if (m) return i + ctz(m);
+    }
+    return scalar_blank(s, i, len);
+}
+
+__attribute__((target("sse2"))) static size_t sse2_identifier(const char *s, size_t i, size_t len) {
+    __m128i case_bit = _mm_set1_epi8(0x20);
+    __m128i a = _mm_set1_epi8('a' - 1), z = _mm_set1_epi8('z' + 1);
+    __m128i d0 = _mm_set1_epi8('0' - 1), d9 = _mm_set1_epi8('9' + 1);
+    __m128i us = _mm_set1_epi8('_');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i lower = _mm_or_si128(v, case_bit);
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, a), _mm_cmplt_epi8(lower, z));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, d0), _mm_cmplt_epi8(v, d9));
+        __m128i hit = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, us));
+        unsigned m = ~_mm_movemask_epi8(hit) & 0xFFFF;
+        if (m) return i + ctz(m);
+    }
+    return scalar_identifier(s, i, len);
+}
+
+__attribute__((target("sse2"))) static size_t sse2_string(const char *s, size_t i, size_t len, char quote,
+                                                          bool brace) {
+    __m128i q = _mm_set1_epi8(quote);
+    __m128i bs = _mm_set1_epi8('\\');
+    __m128i nl = _mm_set1_epi8('\n');
+    __m128i cr = _mm_set1_epi8('\r');
+    // if brace is not set this compares against the quote a second time
+    __m128i br = _mm_set1_epi8(brace ? '{' : quote);
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, q), _mm_cmpeq_epi8(v, bs)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, br), _mm_cmpeq_epi8(v, zero)));
+        unsigned m = _mm_movemask_epi8(hit);
+        if (m) return i + ctz(m);
+    }
+    return scalar_string(s, i, len, quote, brace);
+}
+
+__attribute__((target("sse2,popcnt"))) static size_t sse2_newlines(const char *s, size_t len, size_t *out) {
+    __m128i nl = _mm_set1_epi8('\n');
+    size_t n = 0, i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (!out) {
+            n += __builtin_popcount(m);
+            continue;
+        }
+        for (; m; m &= m - 1) out[n++] = i + ctz(m) + 1;
+    }
+    for (; i < len; i++) {
+        if (s[i] != '\n') continue;
+        if (out) out[n] = i + 1;
+        n++;
+    }
+    return n;
+}
+
+__attribute__((target("sse2"))) static size_t sse2_utf8(const char *s, size_t i, size_t len) {
+    uint32_t cp;
+    while (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        if (_mm_movemask_epi8(v) == 0) {
+            i += 16;
+            continue;
+        }
+        // a character may run past the block, so this stops on the first boundary after it
+        for (size_t block_end = i + 16; i < block_end;) {
+            size_t n = pyc_utf8_decode(s + i, len - i, &cp);
+            if (n == 0) return i;
+            i += n;
+        }
+    }
+    return scalar_utf8(s, i, len);
+}
+
+__attribute__((target("avx2"))) static size_t avx2_line_end(const char *s, size_t i, size_t len) {
+    __m256i nl = _mm256_set1_epi8('\n');
+    __m256i zero = _mm256_setzero_si256();
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        unsigned m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, zero)));
+        if (m) return i + ctz(m);
+    }
+    return sse2_line_end(s, i, len);
+}
+
+__attribute__((target("avx2"))) static size_t avx2_blank(const char *s, size_t i, size_t len) {
+    __m256i space = _mm256_set1_epi8(' ');
+    __m256i tab = _mm256_set1_epi8('\t');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab));
+        unsigned m = ~(unsigned) _mm256_movemask_epi8(hit);
+        if (m) return i + ctz(m);
+    }
+    return sse2_blank(s, i, len);
+}
+
+__attribute__((target("avx2"))) static size_t avx2_identifier(const char *s, size_t i, size_t len) {
+    __m256i case_bit = _mm256_set1_epi8(0x20);
+    __m256i a = _mm256_set1_epi8('a' - 1), z = _mm256_set1_epi8('z' + 1);
+    __m256i d0 = _mm256_set1_epi8('0' - 1), d9 = _mm256_set1_epi8('9' + 1);
+    __m256i us = _mm256_set1_epi8('_');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i lower = _mm256_or_si256(v, case_bit);
+        __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, a), _mm256_cmpgt_epi8(z, lower));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, d0), _mm256_cmpgt_epi8(d9, v));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(alpha, digit), _mm256_cmpeq_epi8(v, us));
+        unsigned m = ~(unsigned) _mm256_movemask_epi8(hit);
+        if (m) return i + ctz(m);
+    }
+    return sse2_identifier(s, i, len);
+}
+
+__attribute__((target("avx2"))) static size_t avx2_string(const char *s, size_t i, size_t len, char quote,
+                                                          bool brace) {
+    __m256i q = _mm256_set1_epi8(quote);
+    __m256i bs = _mm256_set1_epi8('\\');
+    __m256i nl = _mm256_set1_epi8('\n');
+    __m256i cr = _mm256_set1_epi8('\r');
+    __m256i br = _mm256_set1_epi8(brace ? '{' : quote);
+    __m256i zero = _mm256_setzero_si256();
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, q), _mm256_cmpeq_epi8(v, bs)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+        hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(v, br), _mm256_cmpeq_epi8(v, zero)));
+        unsigned m = _mm256_movemask_epi8(hit);
+        if (m) return i + ctz(m);
+    }
+    return sse2_string(s, i, len, quote, brace);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t avx2_newlines(const char *s, size_t len, size_t *out) {
+    __m256i nl = _mm256_set1_epi8('\n');
+    size_t n = 0, i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (!out) {
+            n += __builtin_popcount(m);
+            continue;
+        }
+        for (; m; m &= m - 1) out[n++] = i + ctz(m) + 1;
+    }
+    for (; i < len; i++) {
+        if (s[i] != '\n') continue;
+        if (out) out[n] = i + 1;
+        n++;
+    }
+    return n;
+}
+
+// Keiser-Lemire validation: every byte is checked against the one, two and three bytes before it with nibble lookups,
+// each table row sets the bits of the errors that byte pattern could be part of and a pair is invalid when a bit
+// survives all three.
+#define UTF8_TOO_SHORT 1
+#define UTF8_TOO_LONG 2
+#define UTF8_OVERLONG_3 4
+#define UTF8_TOO_LARGE 8
+#define UTF8_SURROGATE 16
+#define UTF8_OVERLONG_2 32
+#define UTF8_TOO_LARGE_1000 64
+#define UTF8_OVERLONG_4 64
+#define UTF8_TWO_CONTS 128
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+#define utf8_table(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+__attribute__((target("avx2"))) static inline __m256i utf8_prev(__m256i v, __m256i prev, int n) {
+    __m256i carried = _mm256_permute2x128_si256(prev, v, 0x21);
+    switch (n) {
+    case 1: return _mm256_alignr_epi8(v, carried, 15);
+    case 2: return _mm256_alignr_epi8(v, carried, 14);
+    default: return _mm256_alignr_epi8(v, carried, 13);
+    }
+}
+
+__attribute__((target("avx2"))) static inline __m256i utf8_block_errors(__m256i v, __m256i prev) {
+    const __m256i byte_1_high = utf8_table(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+    const __m256i byte_1_low = utf8_table(
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+    const __m256i byte_2_high = utf8_table(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    __m256i prev1 = utf8_prev(v, prev, 1);
+    __m256i sc = _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    sc = _mm256_and_si256(sc, _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble)));
+    sc = _mm256_and_si256(sc, _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+
+    // the third and fourth byte of a sequence have to be continuations, which is the only pair flagged twice
+    __m256i third = _mm256_subs_epu8(utf8_prev(v, prev, 2), _mm256_set1_epi8((char) (0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(utf8_prev(v, prev, 3), _mm256_set1_epi8((char) (0xF0 - 0x80)));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char) 0x80));
+    return _mm256_xor_si256(must23, sc);
+}
+
+// nonzero when one of the last three bytes starts a character that needs more bytes than are left in the block
+__attribute__((target("avx2"))) static inline __m256i utf8_incomplete(__m256i v) {
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char) 0xEF, (char) 0xDF, (char) 0xBF);
+    return _mm256_subs_epu8(v, max);
+}
+
+__attribute__((target("avx2"))) static size_t avx2_utf8(const char *s, size_t i, size_t len) {
+    size_t start = i;
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    char tail[32];
+
+    for (; i < len || !_mm256_testz_si256(incomplete, incomplete); i += 32) {
+        __m256i v;
+        if (i + 32 <= len) {
+            v = _mm256_loadu_si256((const __m256i *) (s + i));
+        } else {
+            // the zero padding after the end also catches a character cut off by it
+            memset(tail, 0, sizeof(tail));
+            if (i < len) memcpy(tail, s + i, len - i);
+            v = _mm256_loadu_si256((const __m256i *) tail);
+        }
+
+        __m256i errors;
+        if (_mm256_movemask_epi8(v) == 0) {
+            errors = incomplete;
+            incomplete = _mm256_setzero_si256();
+        } else {
+            errors = utf8_block_errors(v, prev);
+            incomplete = utf8_incomplete(v);
+        }
+        prev = v;
+
+        if (!_mm256_testz_si256(errors, errors)) {
+            // the error may belong to a character that started in the previous block
+            size_t j = i - start < 3 ? start : i - 3;
+            while (j > start && ((unsigned char) s[j] & 0xC0) == 0x80) j--;
+            return scalar_utf8(s, j, len);
+        }
+    }
+    return len;
+}
+
+#endif
+
+pyc_scanners pyc_scan = {
+    .line_end = scalar_line_end,
+    .blank = scalar_blank,
+    .identifier = scalar_identifier,
+    .string = scalar_string,
+    .newlines = scalar_newlines,
+    .utf8 = scalar_utf8
+};
+
+// runs before main so the table is never written while a lexer on another thread reads it
+__attribute__((constructor)) void pyc_simd_init() {
+#ifdef PYC_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        pyc_scan = (pyc_scanners){avx2_line_end, avx2_blank, avx2_identifier, avx2_string, avx2_newlines,
+                                  avx2_utf8};
+    } else if (__builtin_cpu_supports("sse2")) {
+        pyc_scan = (pyc_scanners){sse2_line_end, sse2_blank, sse2_identifier, sse2_string, sse2_newlines,
+                                  sse2_utf8};
+    }
+#endif
+}
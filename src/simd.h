@@ -0,0 +1,42 @@
+#ifndef PYC_SIMD_H
+#define PYC_SIMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Byte scanners used by the lexer to jump over runs of uninteresting bytes.
+// Every scanner except newlines takes the index to start from and returns the index of the first interesting byte, or len.
+// The implementation (AVX2, SSE2 or scalar) is picked once at startup by pyc_simd_init.
+
+typedef struct {
+    // first '\n' or '\0'
+    size_t (*line_end)(const char *s, size_t i, size_t len);
+
+    // first byte that is not ' ' or '\t'
+    size_t (*blank)(const char *s, size_t i, size_t len);
+
+    // first byte that can't continue an ASCII identifier (A-Z a-z 0-9 _)
+    size_t (*identifier)(const char *s, size_t i, size_t len);
+
+    // first quote, '\\', '\n', '\r', '\0' or '{' if brace is set
+    size_t (*string)(const char *s, size_t i, size_t len, char quote, bool brace);
+
+    // counts the '\n' bytes in s, if out is set the index right after each one is written to it
+    size_t (*newlines)(const char *s, size_t len, size_t *out);
+
+    // first byte that is not part of a valid UTF-8 character, see pyc_utf8_decode
+    size_t (*utf8)(const char *s, size_t i, size_t len);
+} pyc_scanners;
+
+extern pyc_scanners pyc_scan;
+
+void pyc_simd_init();
+
+#define scan_line_end(s, i, len) pyc_scan.line_end(s, i, len)
+#define scan_blank(s, i, len) pyc_scan.blank(s, i, len)
+#define scan_identifier(s, i, len) pyc_scan.identifier(s, i, len)
+#define scan_string(s, i, len, quote, brace) pyc_scan.string(s, i, len, quote, brace)
+#define scan_newlines(s, len, out) pyc_scan.newlines(s, len, out)
+#define scan_utf8(s, i, len) pyc_scan.utf8(s, i, len)
+
+#endif // PYC_SIMD_H
@@ -0,0 +1,12 @@
+#include "unicode.h"
+#include "unicode_xid.h"
+
+static inline bool xid_lookup(uint32_t cp, int property) {
+    if (cp > 0x10FFFF) return false;
+    const uint64_t *bits = pyc_xid_blocks[pyc_xid_index[cp >> 8]][property];
+    return bits[(cp >> 6) & 3] >> (cp & 63) & 1;
+}
+
+bool pyc_is_xid_start(uint32_t cp) { return xid_lookup(cp, 0); }
+
+bool pyc_is_xid_continue(uint32_t cp) { return xid_lookup(cp, 1); }
@@ -0,0 +1,50 @@
+#ifndef PYC_UNICODE_H
+#define PYC_UNICODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Decodes the UTF-8 character at the start of s, which has len bytes left. Returns its length, or 0 if it is not
+// valid: a stray continuation byte, a cut off or overlong sequence, a surrogate or a code point above U+10FFFF.
+static inline size_t pyc_utf8_decode(const char *s, size_t len, uint32_t *cp) {
+    const unsigned char *u = (const unsigned char *) s;
+    unsigned char c = u[0];
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    }
+
+    size_t n;
+    uint32_t v, min;
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+        v = c & 0x1F;
+        min = 0x80;
+    } else if ((c & 0xF0) == 0xE0) {
+        n = 3;
+        v = c & 0x0F;
+        min = 0x800;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        v = c & 0x07;
+        min = 0x10000;
+    } else return 0;
+
+    if (len < n) return 0;
+    for (size_t k = 1; k < n; k++) {
+        if ((u[k] & 0xC0) != 0x80) return 0;
+        v = v << 6 | (u[k] & 0x3F);
+    }
+
+    if (v < min || v > 0x10FFFF || (v >= 0xD800 && v <= 0xDFFF)) return 0;
+    *cp = v;
+    return n;
+}
+
+// Whether the code point can start or continue an identifier, '_' included.
+bool pyc_is_xid_start(uint32_t cp);
+
+bool pyc_is_xid_continue(uint32_t cp);
+
+#endif // PYC_UNICODE_H
@@ -1,6 +1,12 @@
 #include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 void sstream_print(sstream *a, int _) {
     printf("%.*s", (int) a->size, a->data);
@@ -45,4 +51,261 @@ void sstream_appendf(sstream *a, char *fmt, ...) {
 
     sstream_append_l(a, buf, (size_t) needed);
     free(buf);
-}
\ No newline at end of file
+}
+
+void hash_index_reserve(hash_index *h, size_t n) {
+    if (n * 2 <= h->capacity) return;
+
+    size_t capacity = h->capacity < 16 ? 16 : h->capacity;
+    while (n * 2 > capacity) capacity <<= 1;
+
+    hash_slot *slots = calloc(capacity, sizeof(hash_slot));
+    if (slots == NULL) {
+        perror("Error allocating memory for hash_index");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < h->capacity; i++) {
+        hash_slot slot = h->slots[i];
+        if (slot.index == 0) continue;
+        size_t j = slot.hash & (capacity - 1);
+        while (slots[j].index != 0) j = (j + 1) & (capacity - 1);
+        slots[j] = slot;
+    }
+
+    free(h->slots);
+    h->slots = slots;
+    h->capacity = capacity;
+}
+
+void hash_index_clear(hash_index *h) {
+    free(h->slots);
+    h->slots = NULL;
+    h->capacity = 0;
+    h->count = 0;
+}
+_Thread_local pyc_arena *pyc_ast_arena = NULL;
+
+static pyc_arena_chunk *arena_chunk_new(size_t size) {
+    size_t bytes = sizeof(pyc_arena_chunk) + size;
+    pyc_arena_chunk *chunk;
+    bool mapped = bytes >= PYC_ARENA_HUGE_PAGE;
+    if (mapped) {
+        bytes = (bytes + PYC_ARENA_HUGE_PAGE - 1) / PYC_ARENA_HUGE_PAGE * PYC_ARENA_HUGE_PAGE;
+        chunk = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) chunk = NULL;
+#ifdef MADV_HUGEPAGE
+        if (chunk != NULL) madvise(chunk, bytes, MADV_HUGEPAGE);
+#endif
+    } else chunk = malloc(bytes);
+
+    if (chunk == NULL) {
+        perror("Error allocating memory for pyc_arena");
+        fail();
+    }
+    chunk->size = bytes - sizeof(pyc_arena_chunk);
+    chunk->mapped = mapped;
+    return chunk;
+}
+
+static void arena_chunk_free(pyc_arena_chunk *chunk) {
+    if (chunk->mapped) munmap(chunk, sizeof(pyc_arena_chunk) + chunk->size);
+    else free(chunk);
+}
+
+void *pyc_arena_new_chunk(pyc_arena *a, size_t n) {
+    // a big allocation gets a chunk of its own, the current one is kept for the small ones
+    bool own = n > a->chunk_size / 4;
+    pyc_arena_chunk *chunk = arena_chunk_new(own ? n : a->chunk_size);
+    chunk->prev = a->chunks;
+    a->chunks = chunk;
+    if (own) return chunk->data;
+
+    a->current = chunk;
+    a->ptr = chunk->data + n;
+    a->left = chunk->size - n;
+    return chunk->data;
+}
+
+void pyc_arena_reset(pyc_arena *a) {
+    pyc_arena_chunk *chunk = a->chunks;
+    while (chunk != NULL) {
+        pyc_arena_chunk *prev = chunk->prev;
+        if (chunk != a->current) arena_chunk_free(chunk);
+        chunk = prev;
+    }
+
+    a->chunks = a->current;
+    if (a->current == NULL) return;
+    a->current->prev = NULL;
+    a->ptr = a->current->data;
+    a->left = a->current->size;
+}
+
+void pyc_arena_free(pyc_arena *a) {
+    a->current = NULL;
+    pyc_arena_reset(a);
+    a->ptr = NULL;
+    a->left = 0;
+}
+
+void pyc_arena_adopt(pyc_arena *a, pyc_arena *from) {
+    if (from->chunks == NULL) return;
+
+    pyc_arena_chunk *oldest = from->chunks;
+    while (oldest->prev != NULL)
+        oldest = oldest->prev;
+    oldest->prev = a->chunks;
+    a->chunks = from->chunks;
+
+    from->chunks = NULL;
+    from->current = NULL;
+    from->ptr = NULL;
+    from->left = 0;
+}
+
+static bool source_map_read(source_map *m, int fd) {
+    size_t capacity = 64 * 1024, len = 0;
+    char *data = malloc(capacity + 1);
+    ssize_t n;
+    while (data != NULL && (n = read(fd, data + len, capacity - len)) > 0) {
+        len += n;
+        if (len < capacity) continue;
+        capacity *= 2;
+        char *grown = realloc(data, capacity + 1);
+        if (grown == NULL) free(data);
+        data = grown;
+    }
+
+    if (data == NULL || n < 0) {
+        perror("Error reading file");
+        free(data);
+        return false;
+    }
+
+    data[len] = '\0';
+    *m = (source_map){.data = data, .len = len, .map_len = 0};
+    return true;
+}
+
+bool source_map_open(source_map *m, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        bool ok = source_map_read(m, fd);
+        close(fd);
+        return ok;
+    }
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t len = (size_t) st.st_size;
+    size_t map_len = (len + page - 1) / page * page + page;
+
+    // reserve the file pages plus the zero page first, then put the file over the front of it
+    char *data = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        perror("Error mapping file");
+        close(fd);
+        return false;
+    }
+
+    if (len > 0 && mmap(data, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        perror("Error mapping file");
+        munmap(data, map_len);
+        close(fd);
+        return false;
+    }
+
+    close(fd);
+#ifdef MADV_SEQUENTIAL
+    madvise(data, map_len, MADV_SEQUENTIAL);
+#endif
+    *m = (source_map){.data = data, .len = len, .map_len = map_len};
+    return true;
+}
+
+void source_map_close(source_map *m) {
+    if (m->data == NULL) return;
+    if (m->map_len != 0) munmap(m->data, m->map_len);
+    else free(m->data);
+    m->data = NULL;
+    m->len = 0;
+    m->map_len = 0;
+}
+
+bool pyc_write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+void pyc_writer_init(pyc_writer *w, int fd) {
+    *w = (pyc_writer){.fd = fd, .buf = malloc(PYC_WRITER_CHUNK), .len = 0, .failed = false};
+    if (w->buf == NULL) {
+        perror("malloc failed");
+        fail();
+    }
+}
+
+bool pyc_writer_flush(pyc_writer *w) {
+    if (!w->failed && !pyc_write_all(w->fd, w->buf, w->len)) w->failed = true;
+    w->len = 0;
+    return !w->failed;
+}
+
+bool pyc_writer_close(pyc_writer *w) {
+    bool ok = pyc_writer_flush(w);
+    free(w->buf);
+    w->buf = NULL;
+    return ok;
+}
+
+void pyc_writer_spill(pyc_writer *w, const char *data, size_t len) {
+    if (len < PYC_WRITER_CHUNK) {
+        pyc_writer_flush(w);
+        memcpy(w->buf, data, len);
+        w->len = len;
+        return;
+    }
+    if (w->failed) return;
+
+    struct iovec iov[2] = {{.iov_base = w->buf, .iov_len = w->len}, {.iov_base = (void *) data, .iov_len = len}};
+    ssize_t n;
+    do {
+        n = writev(w->fd, iov, 2);
+    } while (n < 0 && errno == EINTR);
+    // a short writev leaves the rest to plain writes
+    size_t done = n < 0 ? 0 : (size_t) n;
+    if (n < 0) {
+        w->failed = true;
+    } else if (done < w->len) {
+        w->failed = !pyc_write_all(w->fd, w->buf + done, w->len - done) || !pyc_write_all(w->fd, data, len);
+    } else {
+        w->failed = !pyc_write_all(w->fd, data + (done - w->len), len - (done - w->len));
+    }
+    w->len = 0;
+}
+
+void pyc_write_int(pyc_writer *w, long long v) {
+    char digits[24];
+    size_t i = sizeof(digits);
+    unsigned long long u = v < 0 ? 0ull - (unsigned long long) v : (unsigned long long) v;
+    do {
+        digits[--i] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (v < 0) digits[--i] = '-';
+    pyc_write(w, digits + i, sizeof(digits) - i);
+}
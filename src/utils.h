@@ -15,16 +15,18 @@
 #endif
 
 #ifdef NEED_AST_PRINT
-#define vec_define_pyc(singular, plural, val)                              \
+#define vec_define_pyc(singular, plural, val) vec_define_pyc_alloc(singular, plural, val, vec_heap)
+#define vec_define_pyc_alloc(singular, plural, val, alloc)                     \
         void singular##_free(val obj);                                         \
-        vec_define(val, plural);                                               \
+        vec_define_alloc(val, plural, alloc);                                  \
         vec_define_free(val, plural, singular##_free(a));                      \
         void singular##_print(val obj, int indent);                            \
         vec_define_print(val, plural, singular##_print(a, indent));
 #else
-#define vec_define_pyc(singular, plural, val)                              \
+#define vec_define_pyc(singular, plural, val) vec_define_pyc_alloc(singular, plural, val, vec_heap)
+#define vec_define_pyc_alloc(singular, plural, val, alloc)                     \
         void singular##_free(val obj);                                         \
-        vec_define(val, plural, plural);                                       \
+        vec_define_alloc(val, plural, alloc);                                  \
         vec_define_free(val, plural, plural##_free, singular##_free);
 #endif
 
@@ -34,13 +36,15 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define print_spaces(spaces)                                                   \
     for (int __ir = 0; __ir < spaces; __ir++)                                  \
     putchar(' ')
 
+// Reads the whole file into a NUL terminated buffer the caller owns. '\r' and NUL bytes are left to the lexer.
 static inline char *read_file(char *filename) {
-    FILE *file = fopen(filename, "r");
+    FILE *file = fopen(filename, "rb");
 
     if (file == NULL) {
         perror("Error opening file");
@@ -51,49 +55,75 @@ static inline char *read_file(char *filename) {
     long file_size = ftell(file);
     fseek(file, 0, SEEK_SET);
 
-    char *code = (char *) malloc(file_size);
+    char *code = (char *) malloc(file_size + 1);
     if (code == NULL) {
         perror("Error allocating memory");
         fclose(file);
         return NULL;
     }
 
-    fread(code, 1, file_size, file);
+    code[fread(code, 1, file_size, file)] = '\0';
+    fclose(file);
 
-    size_t new_size = 0;
-    for (int i = 0; i < file_size; i++) {
-        if (code[i] != '\r')
-            new_size++;
-    }
+    return code;
+}
 
-    char *new_code = (char *) malloc(new_size + 1);
-    if (new_code == NULL) {
-        perror("Error allocating memory");
-        free(code);
-        fclose(file);
-        return NULL;
-    }
+// A source file mapped read-only without copying it. The mapping is followed by a zero page, so data[len] is
+// always readable and '\0' even though the file itself isn't NUL terminated.
+// Files that can't be mapped (pipes etc.) are read into a malloc'd buffer instead.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t map_len; // 0 if data is malloc'd
+} source_map;
 
-    for (size_t i = 0, j = 0; i < file_size; i++) {
-        char c = code[i];
-        if (c == '\0') {
-            fprintf(stderr, "Error: Null character found in file\n");
-            free(code);
-            free(new_code);
-            fclose(file);
-            return NULL;
-        }
-        if (c != '\r')
-            new_code[j++] = c;
-    }
-    free(code);
-    new_code[new_size] = '\0';
+bool source_map_open(source_map *m, const char *filename);
 
-    fclose(file);
+void source_map_close(source_map *m);
+
+// Writes all of data to fd, retrying partial writes. False on an error.
+bool pyc_write_all(int fd, const char *data, size_t len);
+
+#define PYC_WRITER_CHUNK (1 << 20)
+
+// Buffered output to a file descriptor for large dumps. Output is collected into chunks of PYC_WRITER_CHUNK bytes
+// and each one goes out with a single write, instead of a call per fragment like with printf and putchar.
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    // a write failed, whatever comes after it is dropped
+    bool failed;
+} pyc_writer;
+
+void pyc_writer_init(pyc_writer *w, int fd);
+
+bool pyc_writer_flush(pyc_writer *w);
 
-    return new_code;
+// Flushes and frees the buffer, false if anything couldn't be written.
+bool pyc_writer_close(pyc_writer *w);
+
+// What doesn't fit into the buffer, large pieces go out together with it in one writev.
+void pyc_writer_spill(pyc_writer *w, const char *data, size_t len);
+
+static inline void pyc_write(pyc_writer *w, const char *data, size_t len) {
+    if (len > PYC_WRITER_CHUNK - w->len) {
+        pyc_writer_spill(w, data, len);
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+static inline void pyc_write_char(pyc_writer *w, char c) {
+    if (w->len == PYC_WRITER_CHUNK) pyc_writer_flush(w);
+    w->buf[w->len++] = c;
 }
 
+static inline void pyc_write_str(pyc_writer *w, const char *s) { pyc_write(w, s, strlen(s)); }
+
+void pyc_write_int(pyc_writer *w, long long v);
+
 typedef struct {
     char *data;
     size_t size;
@@ -114,9 +144,170 @@ static inline void sstream_free(sstream *a) {
 
 vec_define_pyc(string, strings, char *);
 
+vec_define(char, char_list);
+vec_define_free_simple(char, char_list);
+vec_define(uint16_t, u16_list);
+vec_define_free_simple(uint16_t, u16_list);
+vec_define(uint32_t, u32_list);
+vec_define_free_simple(uint32_t, u32_list);
+vec_define(size_t, size_list);
+vec_define_free_simple(size_t, size_list);
 vec_define(uint64_t, u64_list);
 vec_define(double, f64_list);
 
+// Hashes a byte slice 8 bytes at a time, used for interning identifiers etc.
+static inline uint64_t pyc_hash_bytes(const char *data, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+    uint64_t w;
+    while (len >= 8) {
+        memcpy(&w, data, 8);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 31;
+        data += 8;
+        len -= 8;
+    }
+    w = 0;
+    memcpy(&w, data, len);
+    h = (h ^ w) * 0x94D049BB133111EBull;
+    return h ^ (h >> 29);
+}
+
+// Mixes all bits of x into the low ones the index probes with (splitmix64 finalizer).
+static inline uint64_t pyc_hash_u64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Open-addressing index that maps hashes to dense indices of an outside vector.
+// The vector holds the actual values, so the indices stay stable while the
+// table grows.
+typedef struct {
+    uint64_t hash;
+    size_t index; // 0 means empty, otherwise index + 1
+} hash_slot;
+
+typedef struct {
+    hash_slot *slots;
+    size_t capacity; // always a power of two
+    size_t count;
+} hash_index;
+
+#define hash_index() {.slots = NULL, .capacity = 0, .count = 0}
+
+// Makes sure n entries can be held, call this before probing for an insertion.
+void hash_index_reserve(hash_index *h, size_t n);
+
+void hash_index_clear(hash_index *h);
+
+static inline hash_slot *hash_index_first(hash_index *h, uint64_t hash) {
+    return &h->slots[hash & (h->capacity - 1)];
+}
+
+static inline hash_slot *hash_index_next(hash_index *h, hash_slot *slot) {
+    return ++slot == h->slots + h->capacity ? h->slots : slot;
+}
+
+// slot must be the empty slot a probe ended on
+static inline void hash_index_insert(hash_index *h, hash_slot *slot, uint64_t hash, size_t index) {
+    slot->hash = hash;
+    slot->index = index + 1;
+    h->count++;
+}
+
+// Bump allocator over chunks that never move, so everything allocated from it stays where it is until the arena is
+// reset or freed. Nothing is freed on its own, pyc_arena_reset drops all allocations at once.
+// Chunks of PYC_ARENA_HUGE_PAGE bytes or more are mapped directly and advised to use transparent huge pages.
+#define PYC_ARENA_HUGE_PAGE (2u << 20)
+
+typedef struct pyc_arena_chunk {
+    struct pyc_arena_chunk *prev;
+    size_t size; // bytes of data
+    bool mapped;
+    _Alignas(16) char data[];
+} pyc_arena_chunk;
+
+typedef struct {
+    pyc_arena_chunk *chunks; // newest first
+    pyc_arena_chunk *current; // the chunk allocations are bumped from
+    char *ptr;
+    size_t left;
+    size_t chunk_size;
+} pyc_arena;
+
+#define pyc_arena(size) {.chunks = NULL, .current = NULL, .ptr = NULL, .left = 0, .chunk_size = (size)}
+
+void *pyc_arena_new_chunk(pyc_arena *a, size_t n);
+
+// Returns n bytes without any alignment, for strings.
+static inline char *pyc_arena_bytes(pyc_arena *a, size_t n) {
+    if (n > a->left) return pyc_arena_new_chunk(a, n);
+    char *p = a->ptr;
+    a->ptr += n;
+    a->left -= n;
+    return p;
+}
+
+// Returns n bytes aligned for any type.
+static inline void *pyc_arena_alloc(pyc_arena *a, size_t n) {
+    size_t pad = -(uintptr_t) a->ptr & 15;
+    if (pad + n > a->left) return pyc_arena_new_chunk(a, (n + 15) & ~(size_t) 15);
+    a->ptr += pad;
+    a->left -= pad;
+    return pyc_arena_bytes(a, n);
+}
+
+// Hands back the n bytes at p if they are the last ones that were allocated, does nothing otherwise.
+static inline void pyc_arena_unwind(pyc_arena *a, void *p, size_t n) {
+    if ((char *) p + n != a->ptr) return;
+    a->ptr -= n;
+    a->left += n;
+}
+
+// realloc for memory of the arena, grows in place if p was the last allocation.
+static inline void *pyc_arena_grow(pyc_arena *a, void *p, size_t old, size_t n) {
+    if (p == NULL) return pyc_arena_alloc(a, n);
+    if ((char *) p + old == a->ptr && n - old <= a->left) {
+        a->ptr += n - old;
+        a->left -= n - old;
+        return p;
+    }
+    if (n <= old) return p;
+    void *grown = pyc_arena_alloc(a, n);
+    memcpy(grown, p, old);
+    return grown;
+}
+
+// Drops every allocation, the current chunk is kept to bump from again.
+void pyc_arena_reset(pyc_arena *a);
+
+void pyc_arena_free(pyc_arena *a);
+
+// Moves the chunks of from to a, what was allocated from from then lives as long as a. from is left empty.
+void pyc_arena_adopt(pyc_arena *a, pyc_arena *from);
+
+// Allocation hooks of the AST (see vec_define_alloc). With pyc_ast_arena set, nodes and the data of their vectors
+// are bumped from it and pyc_ast_free does nothing. Every thread has its own.
+extern _Thread_local pyc_arena *pyc_ast_arena;
+
+static inline void *pyc_ast_malloc(size_t n) {
+    void *p = pyc_ast_arena != NULL ? pyc_arena_alloc(pyc_ast_arena, n) : malloc(n);
+    if (p == NULL) {
+        perror("malloc failed");
+        fail();
+    }
+    return p;
+}
+
+static inline void *pyc_ast_realloc(void *p, size_t old, size_t n) {
+    if (pyc_ast_arena != NULL) return pyc_arena_grow(pyc_ast_arena, p, old, n);
+    return realloc(p, n);
+}
+
+static inline void pyc_ast_free(void *p) {
+    if (pyc_ast_arena == NULL) free(p);
+}
+
 #define ensure_str(x) ((x) == NULL ? "" : (x))
 
 #ifndef __THROWNL
@@ -32,16 +32,33 @@
 
 #define vec() {.data = NULL, .size = 0, .capacity = 0}
 
+// Where the data of a vector lives. vec_define uses the heap, vec_define_alloc
+// calls alloc##_malloc(bytes), alloc##_realloc(ptr, old_bytes, bytes) and
+// alloc##_free(ptr) instead.
+#define vec_heap_malloc(n) malloc(n)
+#define vec_heap_realloc(p, old, n) realloc(p, n)
+#define vec_heap_free(p) free(p)
+
 #define vec_define(type, name) vec_define2(type, name, name)
 
 #define vec_define2(type, name, fn_name)                                       \
+    vec_define_alloc2(type, name, fn_name, vec_heap)
+
+#define vec_define_alloc(type, name, alloc)                                    \
+    vec_define_alloc2(type, name, name, alloc)
+
+#define vec_define_alloc2(type, name, fn_name, alloc)                          \
     typedef struct {                                                           \
         size_t size, capacity;                                                 \
         type *data;                                                            \
     } name;                                                                    \
-    vec_define3(type, name, fn_name)
+    vec_define3(type, name, fn_name, alloc)
 
-#define vec_define3(type, name, fn_name)                                       \
+#define vec_define3(type, name, fn_name, alloc)                                \
+                                                                               \
+    static inline void _VCFN(fn_name, data_free)(type * data) {                \
+        alloc##_free(data);                                                    \
+    }                                                                          \
                                                                                \
     static inline name *_VCFN(fn_name, alloc)(void) {                          \
         return (name *)malloc(sizeof(name));                                   \
@@ -51,7 +68,7 @@
                                                      size_t reserved) {        \
         v->size = 0;                                                           \
         v->capacity = reserved;                                                \
-        if (!(v->data = malloc(sizeof(type) * v->capacity))) {                 \
+        if (!(v->data = alloc##_malloc(sizeof(type) * reserved))) {            \
             perror("malloc failed");                                           \
             raise(SIGSEGV);                                                    \
             exit(EXIT_FAILURE);                                                \
@@ -66,17 +83,18 @@
         if (n == v->capacity)                                                  \
             return;                                                            \
         if (n == 0) {                                                          \
-            free(v->data);                                                     \
+            alloc##_free(v->data);                                             \
             v->data = NULL;                                                    \
         } else if (v->data == NULL) {                                          \
-            v->data = malloc(sizeof(type) * n);                                \
+            v->data = alloc##_malloc(sizeof(type) * n);                        \
             if (!v->data) {                                                    \
                 perror("malloc failed");                                       \
                 raise(SIGSEGV);                                                \
                 exit(EXIT_FAILURE);                                            \
             }                                                                  \
         } else {                                                               \
-            type *newData = realloc(v->data, sizeof(type) * n);                \
+            type *newData = alloc##_realloc(                                   \
+                v->data, sizeof(type) * v->capacity, sizeof(type) * n);        \
             if (!newData) {                                                    \
                 perror("realloc failed");                                      \
                 raise(SIGSEGV);                                                \
@@ -149,7 +167,8 @@
     static inline name _VCFN(fn_name, shallow_copy)(name v) {                  \
         name res = {.size = v.size,                                            \
                     .capacity = v.capacity,                                    \
-                    .data = (type *)malloc(sizeof(type) * v.capacity)};        \
+                    .data = (type *)alloc##_malloc(sizeof(type) *              \
+                                                   v.capacity)};               \
         for (size_t i = 0; i < v.size; i++) {                                  \
             res.data[i] = v.data[i];                                           \
         }                                                                      \
@@ -231,7 +250,7 @@
     static inline void _VCFN(name, clear)(name * v) {                          \
         if (!v->data)                                                          \
             return;                                                            \
-        free(v->data);                                                         \
+        _VCFN(name, data_free)(v->data);                                       \
         v->data = NULL;                                                        \
         v->size = 0;                                                           \
         v->capacity = 0;                                                       \
@@ -257,7 +276,7 @@
             type a = v->data[i];                                               \
             free_st;                                                           \
         }                                                                      \
-        free(v->data);                                                         \
+        _VCFN(fn_name, data_free)(v->data);                                    \
         v->data = NULL;                                                        \
         v->size = 0;                                                           \
         v->capacity = 0;                                                       \
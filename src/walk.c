@@ -0,0 +1,232 @@
+#include "walk.h"
+
+#include <stddef.h>
+
+#define N(kind, member) {kind, offsetof(node, member), #member}
+#define R(kind, type, member) {kind, offsetof(type, member), #member}
+#define SCHEMA(fields) {fields, sizeof(fields) / sizeof(fields[0]), 0}
+#define RECORD(fields, type) {fields, sizeof(fields) / sizeof(fields[0]), sizeof(type)}
+
+static const pyc_field identifier_fields[] = {N(FIELD_TOKEN, identifier)};
+static const pyc_field constant_fields[] = {N(FIELD_TOKEN, constant)};
+static const pyc_field fstring_fields[] = {
+    N(FIELD_TOKEN, fstring.start_string), N(FIELD_NODES, fstring.values), N(FIELD_NODES, fstring.extras),
+    N(FIELD_TOKENS, fstring.strings)
+};
+static const pyc_field bin_op_fields[] = {N(FIELD_NODE, bin_op.left), N(FIELD_TOKEN, bin_op.op), N(FIELD_NODE, bin_op.right)};
+static const pyc_field unary_op_fields[] = {N(FIELD_TOKEN, unary_op.op), N(FIELD_NODE, unary_op.expr)};
+static const pyc_field cmp_op_fields[] = {N(FIELD_NODES, cmp_op.ex), N(FIELD_TOKENS, cmp_op.op)};
+static const pyc_field walrus_op_fields[] = {N(FIELD_NODE, walrus_op.left), N(FIELD_NODE, walrus_op.right)};
+static const pyc_field group_fields[] = {N(FIELD_NODES, group.v)};
+static const pyc_field tuple_fields[] = {N(FIELD_NODES, tuple.v)};
+static const pyc_field set_fields[] = {N(FIELD_NODES, set.v)};
+static const pyc_field list_fields[] = {N(FIELD_NODES, list.v)};
+static const pyc_field dict_fields[] = {N(FIELD_NODES, dict.keys), N(FIELD_NODES, dict.values)};
+static const pyc_field list_comp_fields[] = {N(FIELD_NODE, list_comp.value), N(FIELD_COMPREHENSIONS, list_comp.comp)};
+static const pyc_field set_comp_fields[] = {N(FIELD_NODE, set_comp.value), N(FIELD_COMPREHENSIONS, set_comp.comp)};
+static const pyc_field dict_comp_fields[] = {
+    N(FIELD_NODE, dict_comp.key), N(FIELD_NODE, dict_comp.value), N(FIELD_COMPREHENSIONS, dict_comp.comp)
+};
+static const pyc_field lambda_fields[] = {N(FIELD_TOKENS, lambda.args), N(FIELD_NODE, lambda.body)};
+static const pyc_field if_else_expr_fields[] = {
+    N(FIELD_NODE, if_else_expr.if_expr), N(FIELD_NODE, if_else_expr.else_expr), N(FIELD_NODE, if_else_expr.condition)
+};
+static const pyc_field generator_fields[] = {N(FIELD_NODE, generator.value), N(FIELD_COMPREHENSIONS, generator.comp)};
+static const pyc_field await_fields[] = {N(FIELD_NODE, await)};
+static const pyc_field yield_fields[] = {N(FIELD_NODE, yield)};
+static const pyc_field yield_from_fields[] = {N(FIELD_NODE, yield_from)};
+static const pyc_field call_fields[] = {N(FIELD_NODE, call.base), N(FIELD_NODES, call.args), N(FIELD_KEYWORDS, call.kws)};
+static const pyc_field attribute_fields[] = {N(FIELD_NODE, attribute.base), N(FIELD_TOKEN, attribute.key)};
+static const pyc_field index_fields[] = {
+    N(FIELD_NODE, index.base), N(FIELD_NODE, index.slices[0]), N(FIELD_NODE, index.slices[1]),
+    N(FIELD_NODE, index.slices[2])
+};
+static const pyc_field stmt_expr_fields[] = {N(FIELD_NODE, stmt_expr)};
+static const pyc_field function_def_fields[] = {
+    N(FIELD_BOOL, function_def.is_async), N(FIELD_TOKEN, function_def.name), N(FIELD_TOKENS, function_def.args),
+    N(FIELD_NODES, function_def.args_defaults), N(FIELD_TOKEN, function_def.ls_args),
+    N(FIELD_TOKEN, function_def.kw_args), N(FIELD_NODE, function_def.body), N(FIELD_NODES, function_def.decorators)
+};
+static const pyc_field ret_fields[] = {N(FIELD_NODE, ret.v)};
+static const pyc_field del_fields[] = {N(FIELD_NODE, del)};
+static const pyc_field assign_fields[] = {N(FIELD_NODE, assign.var), N(FIELD_TOKEN, assign.set_op), N(FIELD_NODE, assign.val)};
+static const pyc_field assign_mult_fields[] = {N(FIELD_NODES, assign_mult.targets), N(FIELD_NODE, assign_mult.val)};
+static const pyc_field class_def_fields[] = {
+    N(FIELD_TOKEN, class_def.name), N(FIELD_TOKENS, class_def.extends), N(FIELD_NODES, class_def.methods),
+    N(FIELD_NODES, class_def.properties), N(FIELD_NODES, class_def.decorators)
+};
+static const pyc_field for_loop_fields[] = {
+    N(FIELD_BOOL, for_loop.is_async), N(FIELD_NODE, for_loop.value), N(FIELD_NODE, for_loop.iter),
+    N(FIELD_NODE, for_loop.body), N(FIELD_NODE, for_loop.else_body)
+};
+static const pyc_field while_loop_fields[] = {N(FIELD_NODE, while_loop.cond), N(FIELD_NODE, while_loop.body)};
+static const pyc_field with_fields[] = {
+    N(FIELD_NODES, with.contexts), N(FIELD_TOKENS, with.vars), N(FIELD_NODE, with.body), N(FIELD_BOOL, with.is_async)
+};
+static const pyc_field if_stmt_fields[] = {N(FIELD_NODES, if_stmt.conditions), N(FIELD_NODES, if_stmt.bodies)};
+static const pyc_field imports_fields[] = {N(FIELD_IMPORT_LIBS, imports.v)};
+static const pyc_field import_from_fields[] = {
+    N(FIELD_TOKENS, import_from.lib), N(FIELD_IMPORT_ALIASES, import_from.imports), N(FIELD_INT, import_from.level)
+};
+static const pyc_field global_fields[] = {N(FIELD_TOKENS, global)};
+static const pyc_field nonlocal_fields[] = {N(FIELD_TOKENS, nonlocal)};
+static const pyc_field assert_fields[] = {N(FIELD_NODE, assert.condition), N(FIELD_NODE, assert.message)};
+static const pyc_field raise_fields[] = {N(FIELD_NODE, raise.exception), N(FIELD_NODE, raise.cause)};
+static const pyc_field match_fields[] = {N(FIELD_NODE, match.subject), N(FIELD_MATCH_CASES, match.cases)};
+static const pyc_field try_catch_fields[] = {
+    N(FIELD_BOOL, try_catch.is_star), N(FIELD_NODE, try_catch.try_body), N(FIELD_EXCEPT_HANDLERS, try_catch.handlers),
+    N(FIELD_NODE, try_catch.else_body), N(FIELD_NODE, try_catch.finally_body)
+};
+
+const pyc_schema pyc_node_schemas[] = {
+    [EXPR_IDENTIFIER] = SCHEMA(identifier_fields),
+    [EXPR_CONSTANT] = SCHEMA(constant_fields),
+    [EXPR_FORMAT_STRING] = SCHEMA(fstring_fields),
+    [EXPR_BINARY_OPERATION] = SCHEMA(bin_op_fields),
+    [EXPR_UNARY_OPERATION] = SCHEMA(unary_op_fields),
+    [EXPR_CMP_OPERATION] = SCHEMA(cmp_op_fields),
+    [EXPR_WALRUS_OPERATION] = SCHEMA(walrus_op_fields),
+    [NODE_GROUP] = SCHEMA(group_fields),
+    [EXPR_LIST_COMP] = SCHEMA(list_comp_fields),
+    [EXPR_LIST] = SCHEMA(list_fields),
+    [EXPR_DICT_COMP] = SCHEMA(dict_comp_fields),
+    [EXPR_DICT] = SCHEMA(dict_fields),
+    [EXPR_SET_COMP] = SCHEMA(set_comp_fields),
+    [EXPR_SET] = SCHEMA(set_fields),
+    [EXPR_TUPLE] = SCHEMA(tuple_fields),
+    [EXPR_LAMBDA] = SCHEMA(lambda_fields),
+    [EXPR_IF_EXP] = SCHEMA(if_else_expr_fields),
+    [EXPR_GENERATOR] = SCHEMA(generator_fields),
+    [EXPR_AWAIT] = SCHEMA(await_fields),
+    [EXPR_YIELD] = SCHEMA(yield_fields),
+    [EXPR_YIELD_FROM] = SCHEMA(yield_from_fields),
+    [EXPR_CALL] = SCHEMA(call_fields),
+    [EXPR_ATTRIBUTE] = SCHEMA(attribute_fields),
+    [EXPR_INDEX] = SCHEMA(index_fields),
+    [STMT_FUNCTION_DEF] = SCHEMA(function_def_fields),
+    [STMT_CLASS_DEF] = SCHEMA(class_def_fields),
+    [STMT_RETURN] = SCHEMA(ret_fields),
+    [STMT_DELETE] = SCHEMA(del_fields),
+    [STMT_ASSIGN] = SCHEMA(assign_fields),
+    [STMT_ASSIGN_MULT] = SCHEMA(assign_mult_fields),
+    [STMT_FOR] = SCHEMA(for_loop_fields),
+    [STMT_WHILE] = SCHEMA(while_loop_fields),
+    [STMT_IF] = SCHEMA(if_stmt_fields),
+    [STMT_WITH] = SCHEMA(with_fields),
+    [STMT_MATCH] = SCHEMA(match_fields),
+    [STMT_RAISE] = SCHEMA(raise_fields),
+    [STMT_TRY_CATCH] = SCHEMA(try_catch_fields),
+    [STMT_ASSERT] = SCHEMA(assert_fields),
+    [STMT_IMPORT] = SCHEMA(imports_fields),
+    [STMT_IMPORT_FROM] = SCHEMA(import_from_fields),
+    [STMT_GLOBAL] = SCHEMA(global_fields),
+    [STMT_NONLOCAL] = SCHEMA(nonlocal_fields),
+    [STMT_EXPR] = SCHEMA(stmt_expr_fields),
+    [NODE_LAZY_GROUP] = {NULL, 0, 0}
+};
+
+static const pyc_field comprehension_fields[] = {
+    R(FIELD_INT, comprehension, is_async), R(FIELD_NODE, comprehension, target), R(FIELD_NODE, comprehension, iter),
+    R(FIELD_NODES, comprehension, ifs)
+};
+static const pyc_field keyword_fields[] = {R(FIELD_TOKEN, keyword, name), R(FIELD_NODE, keyword, value)};
+static const pyc_field import_lib_fields[] = {R(FIELD_TOKENS, import_lib, tok), R(FIELD_TOKEN, import_lib, as)};
+static const pyc_field import_alias_fields[] = {R(FIELD_TOKEN, import_alias, tok), R(FIELD_TOKEN, import_alias, as)};
+static const pyc_field except_handler_fields[] = {
+    R(FIELD_NODE, except_handler, class), R(FIELD_TOKEN, except_handler, name), R(FIELD_NODE, except_handler, body)
+};
+static const pyc_field match_case_fields[] = {
+    R(FIELD_NODE, match_case, pattern), R(FIELD_TOKEN, match_case, as), R(FIELD_NODE, match_case, condition),
+    R(FIELD_NODE, match_case, body)
+};
+
+const pyc_schema pyc_record_schemas[] = {
+    [FIELD_COMPREHENSIONS - FIELD_COMPREHENSIONS] = RECORD(comprehension_fields, comprehension),
+    [FIELD_KEYWORDS - FIELD_COMPREHENSIONS] = RECORD(keyword_fields, keyword),
+    [FIELD_IMPORT_LIBS - FIELD_COMPREHENSIONS] = RECORD(import_lib_fields, import_lib),
+    [FIELD_IMPORT_ALIASES - FIELD_COMPREHENSIONS] = RECORD(import_alias_fields, import_alias),
+    [FIELD_EXCEPT_HANDLERS - FIELD_COMPREHENSIONS] = RECORD(except_handler_fields, except_handler),
+    [FIELD_MATCH_CASES - FIELD_COMPREHENSIONS] = RECORD(match_case_fields, match_case)
+};
+
+static void visit_fields(const pyc_schema *s, char *obj, void (*visit)(node *child, void *ctx), void *ctx) {
+    for (size_t i = 0; i < s->count; i++) {
+        pyc_field_kind kind = s->fields[i].kind;
+        char *p = obj + s->fields[i].offset;
+        if (kind == FIELD_NODE) {
+            node *child = *(node **) p;
+            if (child != NULL) visit(child, ctx);
+            continue;
+        }
+        if (kind != FIELD_NODES && kind < FIELD_COMPREHENSIONS) continue;
+
+        pyc_raw_vec v;
+        memcpy(&v, p, sizeof(v));
+        if (v.data == NULL) continue;
+        for (size_t j = 0; j < v.size; j++) {
+            if (kind == FIELD_NODES) {
+                node *child = ((node **) v.data)[j];
+                if (child != NULL) visit(child, ctx);
+            } else {
+                const pyc_schema *rec = &pyc_record_schemas[kind - FIELD_COMPREHENSIONS];
+                visit_fields(rec, v.data + j * rec->size, visit, ctx);
+            }
+        }
+    }
+}
+
+void pyc_node_children(node *n, void (*visit)(node *child, void *ctx), void *ctx) {
+    visit_fields(&pyc_node_schemas[n->type], (char *) n, visit, ctx);
+}
+
+typedef struct {
+    node *n;
+    // its children are on the stack above it, post is next
+    bool expanded;
+} walk_frame;
+
+vec_define(walk_frame, walk_frames);
+
+static void push_child(node *child, void *ctx) {
+    walk_frames_push(ctx, (walk_frame){.n = child, .expanded = false});
+}
+
+bool pyc_walk(node *root, pyc_walk_fn pre, pyc_walk_fn post, void *ctx) {
+    if (root == NULL) return true;
+    walk_frames stack = vec();
+    walk_frames_push(&stack, (walk_frame){.n = root, .expanded = false});
+    bool done = true;
+
+    while (stack.size > 0) {
+        walk_frame *f = &stack.data[stack.size - 1];
+        node *n = f->n;
+        if (f->expanded) {
+            stack.size--;
+            if (post != NULL && post(n, ctx) == PYC_WALK_STOP) {
+                done = false;
+                break;
+            }
+            continue;
+        }
+
+        f->expanded = true;
+        pyc_walk_result r = pre != NULL ? pre(n, ctx) : PYC_WALK_CONTINUE;
+        if (r == PYC_WALK_STOP) {
+            done = false;
+            break;
+        }
+        if (r == PYC_WALK_SKIP) continue;
+
+        // pushed in field order, then turned around so the first child is on top
+        size_t first = stack.size;
+        pyc_node_children(n, push_child, &stack);
+        for (size_t i = first, j = stack.size; i + 1 < j; i++, j--) {
+            walk_frame t = stack.data[i];
+            stack.data[i] = stack.data[j - 1];
+            stack.data[j - 1] = t;
+        }
+    }
+
+    free(stack.data);
+    return done;
+}
@@ -0,0 +1,69 @@
+#ifndef PYC_WALK_H
+#define PYC_WALK_H
+
+#include "parser.h"
+
+// The fields of every node kind, and a walk over a tree that is driven by them instead of a switch over node_type.
+// The walk keeps its own stack on the heap, so a deeply nested tree (e.g. a generated expression) can't overflow the
+// C stack.
+
+typedef enum {
+    FIELD_TOKEN,
+    FIELD_NODE,
+    FIELD_BOOL,
+    FIELD_INT,
+    FIELD_TOKENS,
+    FIELD_NODES,
+    // vectors of records, in the order of pyc_record_schemas
+    FIELD_COMPREHENSIONS,
+    FIELD_KEYWORDS,
+    FIELD_IMPORT_LIBS,
+    FIELD_IMPORT_ALIASES,
+    FIELD_EXCEPT_HANDLERS,
+    FIELD_MATCH_CASES
+} pyc_field_kind;
+
+typedef struct {
+    pyc_field_kind kind;
+    size_t offset;
+    // the member, as in "bin_op.left"
+    const char *name;
+} pyc_field;
+
+typedef struct {
+    const pyc_field *fields;
+    size_t count;
+    size_t size; // of the record struct, unused for nodes
+} pyc_schema;
+
+// every vector type has this layout
+typedef struct {
+    size_t size, capacity;
+    char *data;
+} pyc_raw_vec;
+
+// Indexed by node_type, in the order the fields have in the node's member of struct node. The module, pass, break,
+// continue and lazy groups have no fields, and the tok fields only some kinds fill in aren't listed.
+extern const pyc_schema pyc_node_schemas[];
+
+// Indexed by kind - FIELD_COMPREHENSIONS.
+extern const pyc_schema pyc_record_schemas[];
+
+typedef enum {
+    PYC_WALK_CONTINUE,
+    // from pre, the children of the node are not walked, its post is still called
+    PYC_WALK_SKIP,
+    PYC_WALK_STOP
+} pyc_walk_result;
+
+typedef pyc_walk_result (*pyc_walk_fn)(node *n, void *ctx);
+
+// Calls visit for each child of n that isn't NULL, the ones in records (comprehensions, keywords etc.) included, in
+// the order of the fields.
+void pyc_node_children(node *n, void (*visit)(node *child, void *ctx), void *ctx);
+
+// Walks the tree depth first, pre is called for a node before its children and post after them, either may be NULL.
+// post may free its node, its children are done by then. Returns false if a callback stopped the walk.
+bool pyc_walk(node *root, pyc_walk_fn pre, pyc_walk_fn post, void *ctx);
+
+#endif // PYC_WALK_H
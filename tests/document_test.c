@@ -0,0 +1,87 @@
+#include "document.h"
+#include "dump.h"
+
+#include <unistd.h>
+
+#define check(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);    \
+            return false;                                                      \
+        }                                                                      \
+    } while (0)
+
+// The text dump of the tree, to compare an edited document with a freshly opened one.
+static char *dump(pyc_document *doc) {
+    FILE *f = tmpfile();
+    pyc_writer w;
+    pyc_writer_init(&w, fileno(f));
+    pyc_dump_text(&w, doc->source.data, doc->tree, 0);
+    pyc_writer_close(&w);
+    long size = lseek(fileno(f), 0, SEEK_END);
+    char *text = calloc(size + 1, 1);
+    pread(fileno(f), text, size, 0);
+    fclose(f);
+    return text;
+}
+
+static bool same_as_fresh(pyc_document *doc) {
+    pyc_document fresh;
+    pyc_doc_open(&fresh, "test.py", doc->source.data, doc->source.size);
+    char *a = dump(doc), *b = dump(&fresh);
+    bool same = strcmp(a, b) == 0;
+    free(a);
+    free(b);
+    pyc_doc_free(&fresh);
+    return same;
+}
+
+// An edit that breaks the source fails and keeps the old statements, the edit that fixes it parses the damaged part
+// again.
+static bool test_invalid_then_valid(void) {
+    const char *code = "a = 1\n"
+                       "def f(x):\n"
+                       "    return x + 1\n"
+                       "b = f(a)\n";
+    pyc_document doc;
+    pyc_doc_open(&doc, "test.py", code, strlen(code));
+    check(doc.tree->group.v.size == 3);
+    node *first = doc.tree->group.v.data[0];
+
+    size_t at = strlen("a = 1\ndef f(x):\n    return x + 1\n");
+    check(!pyc_doc_edit(&doc, at, 0, "x(", 2));
+    check(doc.error[0] != '\0');
+    check(doc.error_pos >= at && doc.error_pos <= doc.source.size);
+    check(doc.tree->group.v.size == 3);
+    check(doc.tree->group.v.data[0] == first);
+
+    // still broken, and the unit in front of the damage moves with the text
+    check(!pyc_doc_edit(&doc, 0, 1, "aa", 2));
+    check(doc.error[0] != '\0');
+
+    // the message of an invalid character is formatted by the lexer, it has to outlive the edit
+    check(!pyc_doc_edit(&doc, 3, 0, "\xe2\x82\xac", 3));
+    check(strstr(doc.error, "invalid character '\xe2\x82\xac' (U+20AC)") != NULL);
+    check(doc.error_pos == 3);
+    check(!pyc_doc_edit(&doc, 3, 3, "", 0));
+
+    check(pyc_doc_edit(&doc, at + 1, 2, "", 0));
+    check(doc.error[0] == '\0');
+    check(strcmp(doc.source.data, "aa = 1\ndef f(x):\n    return x + 1\nb = f(a)\n") == 0);
+    check(doc.tree->group.v.size == 3);
+    check(same_as_fresh(&doc));
+
+    // the document goes on working after it recovered
+    check(pyc_doc_edit(&doc, doc.source.size, 0, "c = b\n", 6));
+    check(doc.tree->group.v.size == 4);
+    check(same_as_fresh(&doc));
+
+    pyc_doc_free(&doc);
+    return true;
+}
+
+int main(void) {
+    bool ok = test_invalid_then_valid();
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}